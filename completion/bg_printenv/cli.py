@@ -25,5 +25,8 @@ def bg_printenv():
         help="Comma-separated list of fields which are printed",
     )
     parser.add_argument("-r", "--raw", action="store_true", help="Raw output mode")
+    parser.add_argument(
+        "-T", "--boot-timing", action="store_true", help="Print the boot phase timing exported by the boot loader"
+    )
     parser.add_argument("--usage", action="store_true", help="Give a short usage message")
     return parser
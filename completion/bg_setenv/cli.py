@@ -44,4 +44,10 @@ def bg_setenv():
         choices=["0", "1"],
         help="Set in_progress variable to simulate a running update process.",
     )
+    parser.add_argument(
+        "-L",
+        "--layout",
+        metavar="PARTS:USERVAR_SIZE",
+        help="Write the environment file in the self-describing layout for PARTS config partitions and USERVAR_SIZE bytes of user variables. Requires --filepath.",
+    )
     return parser
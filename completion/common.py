@@ -17,6 +17,7 @@ def add_common_opts(parser):
         "-f", "--filepath", metavar="ENVFILE", help="Environment to use. Expects a file name, usually called BGENV.DAT."
     ).complete = shtab.FILE
     parser.add_argument("-A", "--all", action="store_true", help="Probe all partitions for ebg environments")
+    parser.add_argument("-C", "--probe-cache", action="store_true", help="Reuse config partitions found by a previous call")
     parser.add_argument("-p", "--part", metavar="ENV_PART", type=int, help="Set environment partition to use")
     parser.add_argument("-v", "--verbose", action="store_true", help="Be verbose")
     parser.add_argument("-V", "--version", action="store_true", help="Print version")
@@ -0,0 +1,188 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2020-2023
+ *
+ * Authors:
+ *  Dr. Johann Pfefferl <johann.pfefferl@siemens.com>
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include "fwtables.h"
+#include "print.h"
+
+#define EFI_ACPI_ROOT_SDP_REVISION 0x02
+
+#define ACPI_SIG_RSDP (CHAR8 *)"RSD PTR "
+#define ACPI_SIG_RSDT (CHAR8 *)"RSDT"
+#define ACPI_SIG_XSDT (CHAR8 *)"XSDT"
+
+#define SMBIOS_NUM_TYPES	256
+
+static BOOLEAN acpi_indexed;
+static EFI_ACPI_SDT_HEADER **acpi_tables;
+static UINTN acpi_table_count;
+
+static BOOLEAN smbios_indexed;
+/* Structures sorted by type, those of type t start at smbios_first[t] */
+static UINT8 **smbios_structs;
+static UINT16 smbios_first[SMBIOS_NUM_TYPES + 1];
+
+static EFI_ACPI_ROOT_SDP_HEADER *locate_rsdp(VOID)
+{
+	EFI_CONFIGURATION_TABLE *ect = ST->ConfigurationTable;
+	EFI_GUID acpi_table_guid = ACPI_TABLE_GUID;
+	EFI_GUID acpi2_table_guid = ACPI_20_TABLE_GUID;
+	UINTN n;
+
+	for (n = 0; n < ST->NumberOfTableEntries; n++, ect++) {
+		if ((CompareGuid(&ect->VendorGuid, &acpi_table_guid) ||
+		     CompareGuid(&ect->VendorGuid, &acpi2_table_guid)) &&
+		    !strncmpa(ACPI_SIG_RSDP, (CHAR8 *)(ect->VendorTable), 8)) {
+			return (EFI_ACPI_ROOT_SDP_HEADER *)ect->VendorTable;
+		}
+	}
+	return NULL;
+}
+
+static VOID acpi_build_index(VOID)
+{
+	EFI_ACPI_ROOT_SDP_HEADER *rsdp;
+	EFI_ACPI_SDT_HEADER *sdt;
+	UINT8 *entry_ptr;
+	UINTN entry_size, n;
+	UINT64 address;
+
+	acpi_indexed = TRUE;
+
+	rsdp = locate_rsdp();
+	if (!rsdp) {
+		return;
+	}
+
+	if (rsdp->revision > EFI_ACPI_ROOT_SDP_REVISION) {
+		ERROR(L"SDP revision not supported (%d)\n", rsdp->revision);
+		return;
+	}
+
+	if (rsdp->revision == EFI_ACPI_ROOT_SDP_REVISION) {
+		sdt = (EFI_ACPI_SDT_HEADER *)(UINTN)(rsdp->xsdt_address);
+		if (strncmpa(ACPI_SIG_XSDT, sdt->signature, 4)) {
+			return;
+		}
+		entry_size = sizeof(UINT64);
+	} else {
+		sdt = (EFI_ACPI_SDT_HEADER *)(UINTN)(rsdp->rsdt_address);
+		if (strncmpa(ACPI_SIG_RSDT, sdt->signature, 4)) {
+			return;
+		}
+		entry_size = sizeof(UINT32);
+	}
+
+	acpi_table_count = (sdt->length - sizeof(EFI_ACPI_SDT_HEADER)) /
+		entry_size;
+	acpi_tables = AllocatePool(acpi_table_count * sizeof(*acpi_tables));
+	if (!acpi_tables) {
+		acpi_table_count = 0;
+		return;
+	}
+
+	/* Entries are not naturally aligned in the RSDT/XSDT. */
+	entry_ptr = (UINT8 *)(sdt + 1);
+	for (n = 0; n < acpi_table_count; n++, entry_ptr += entry_size) {
+		address = 0;
+		CopyMem(&address, entry_ptr, entry_size);
+		acpi_tables[n] = (EFI_ACPI_SDT_HEADER *)(UINTN)address;
+	}
+}
+
+EFI_ACPI_SDT_HEADER *acpi_find_table(const CHAR8 *signature, UINTN instance)
+{
+	UINTN n;
+
+	if (!acpi_indexed) {
+		acpi_build_index();
+	}
+
+	for (n = 0; n < acpi_table_count; n++) {
+		if (!strncmpa((CHAR8 *)signature, acpi_tables[n]->signature,
+			      4) &&
+		    instance-- == 0) {
+			return acpi_tables[n];
+		}
+	}
+	return NULL;
+}
+
+static UINT8 *smbios_next_struct(UINT8 *strct)
+{
+	UINT8 *str;
+
+	/* Read over any appended strings. */
+	str = strct + ((SMBIOS_HEADER *)strct)->Length;
+	while (str[0] != 0 || str[1] != 0) {
+		str++;
+	}
+	return str + 2;
+}
+
+static VOID smbios_build_index(VOID)
+{
+	SMBIOS_STRUCTURE_TABLE *table;
+	UINT16 fill[SMBIOS_NUM_TYPES];
+	UINT8 *strct;
+	UINTN n, type;
+	EFI_STATUS status;
+
+	smbios_indexed = TRUE;
+
+	status = LibGetSystemConfigurationTable(&SMBIOSTableGuid,
+						(VOID **)&table);
+	if (status != EFI_SUCCESS) {
+		return;
+	}
+
+	smbios_structs = AllocatePool(table->NumberOfSmbiosStructures *
+				      sizeof(*smbios_structs));
+	if (!smbios_structs) {
+		return;
+	}
+
+	/* Count the structures per type, then place them in table order. */
+	strct = (UINT8 *)(UINTN)table->TableAddress;
+	for (n = 0; n < table->NumberOfSmbiosStructures; n++) {
+		smbios_first[((SMBIOS_HEADER *)strct)->Type + 1]++;
+		strct = smbios_next_struct(strct);
+	}
+	for (type = 0; type < SMBIOS_NUM_TYPES; type++) {
+		smbios_first[type + 1] += smbios_first[type];
+		fill[type] = smbios_first[type];
+	}
+
+	strct = (UINT8 *)(UINTN)table->TableAddress;
+	for (n = 0; n < table->NumberOfSmbiosStructures; n++) {
+		smbios_structs[fill[((SMBIOS_HEADER *)strct)->Type]++] = strct;
+		strct = smbios_next_struct(strct);
+	}
+}
+
+SMBIOS_STRUCTURE_POINTER smbios_find_struct(UINT8 type, UINTN instance)
+{
+	SMBIOS_STRUCTURE_POINTER strct;
+
+	if (!smbios_indexed) {
+		smbios_build_index();
+	}
+
+	if (instance < (UINTN)(smbios_first[type + 1] - smbios_first[type])) {
+		strct.Raw = smbios_structs[smbios_first[type] + instance];
+	} else {
+		strct.Raw = NULL;
+	}
+	return strct;
+}
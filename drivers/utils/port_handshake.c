@@ -0,0 +1,90 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <sys/io.h>
+
+#include "loader_interface.h"
+#include "port_handshake.h"
+#include "print.h"
+
+VOID port_transaction_begin(PORT_TRANSACTION *transaction,
+			    const CHAR16 *name)
+{
+	transaction->name = name;
+	transaction->start_usec = time_usec();
+	transaction->waited_usec = 0;
+	transaction->polls = 0;
+}
+
+VOID port_transaction_end(const PORT_TRANSACTION *transaction,
+			  EFI_STATUS status)
+{
+	UINT64 elapsed = transaction->waited_usec;
+
+	/* without a CPU counter, only the delays are known */
+	if (transaction->start_usec) {
+		elapsed = time_usec() - transaction->start_usec;
+	}
+	INFO(L"%s: %ld us, %d polls (%r)\n", transaction->name, elapsed,
+	     transaction->polls, status);
+}
+
+EFI_STATUS port_wait_status(UINT16 port, UINT8 mask, UINT8 value,
+			    UINT8 error_mask, UINTN timeout_us,
+			    EFI_EVENT deadline, PORT_TRANSACTION *transaction)
+{
+	UINTN delay = PORT_POLL_MIN_DELAY_US;
+	UINTN waited = 0;
+	EFI_STATUS status = EFI_TIMEOUT;
+
+	for (;;) {
+		UINT8 sts = inb(port);
+
+		if (transaction) {
+			transaction->polls++;
+		}
+		if (error_mask && (sts & error_mask) == error_mask) {
+			status = EFI_DEVICE_ERROR;
+			break;
+		}
+		if ((sts & mask) == value) {
+			status = EFI_SUCCESS;
+			break;
+		}
+		if (timeout_us != PORT_WAIT_NO_TIMEOUT) {
+			if (waited >= timeout_us) {
+				break;
+			}
+			if (delay > timeout_us - waited) {
+				delay = timeout_us - waited;
+			}
+		}
+		if (deadline && BS->CheckEvent(deadline) != EFI_NOT_READY) {
+			break;
+		}
+
+		BS->Stall(delay);
+		waited += delay;
+		if (delay < PORT_POLL_MAX_DELAY_US) {
+			delay *= 2;
+			if (delay > PORT_POLL_MAX_DELAY_US) {
+				delay = PORT_POLL_MAX_DELAY_US;
+			}
+		}
+	}
+
+	if (transaction) {
+		transaction->waited_usec += waited;
+	}
+	return status;
+}
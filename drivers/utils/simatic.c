@@ -18,12 +18,9 @@
 #include <efilib.h>
 
 #include "simatic.h"
-#include "smbios.h"
+#include "fwtables.h"
 #include "utils.h"
 
-static UINT32 station_id;
-static BOOLEAN station_id_cached;
-
 static UINT32 get_station_id(SMBIOS_STRUCTURE_POINTER oem_strct)
 {
 	SIMATIC_OEM_ENTRY *entry;
@@ -49,26 +46,12 @@ static UINT32 get_station_id(SMBIOS_STRUCTURE_POINTER oem_strct)
 
 UINT32 simatic_station_id(VOID)
 {
-	if (station_id_cached)
-		return station_id;
-
-	SMBIOS_STRUCTURE_TABLE *smbios_table;
 	SMBIOS_STRUCTURE_POINTER smbios_struct;
-	EFI_STATUS status;
-
-	status = LibGetSystemConfigurationTable(&SMBIOSTableGuid,
-						(VOID **)&smbios_table);
-	if (status != EFI_SUCCESS) {
-		return 0;
-	}
 
-	smbios_struct = smbios_find_struct(smbios_table, SMBIOS_TYPE_OEM_129);
+	smbios_struct = smbios_find_struct(SMBIOS_TYPE_OEM_129, 0);
 	if (smbios_struct.Raw == NULL) {
 		return 0;
 	}
 
-	station_id = get_station_id(smbios_struct);
-	station_id_cached = TRUE;
-
-	return station_id;
+	return get_station_id(smbios_struct);
 }
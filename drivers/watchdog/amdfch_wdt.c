@@ -140,17 +140,14 @@ static void amdfch_wdt_ping(VOID)
 	writel(val, AMDFCH_WDT_CONTROL(watchdog.base));
 }
 
-static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
-		       UINT16 pci_device_id, UINTN timeout)
+static EFI_STATUS init(EFI_PCI_IO *pci_io,
+		       UINT16 __attribute__((unused)) pci_vendor_id,
+		       UINT16 __attribute__((unused)) pci_device_id,
+		       UINTN timeout)
 {
 	EFI_STATUS status;
 	UINT8 pci_revision_id = 0;
 
-	if (!pci_io || pci_vendor_id != PCI_VENDOR_ID_AMD ||
-	    pci_device_id != PCI_DEVICE_ID_AMD_CARRIZO_SMBUS) {
-		return EFI_UNSUPPORTED;
-	}
-
 	status = pci_io->Pci.Read(
 	    pci_io, EfiPciIoWidthUint8, PCI_REVISION_ID_REG, 1,
 	    &pci_revision_id);
@@ -188,4 +185,9 @@ static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
 	return EFI_SUCCESS;
 }
 
-WATCHDOG_REGISTER(init);
+static const WATCHDOG_PCI_ID pci_ids[] = {
+	WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_AMD, PCI_DEVICE_ID_AMD_CARRIZO_SMBUS),
+	{0},
+};
+
+WATCHDOG_REGISTER_PCI("amdfch_wdt", init, pci_ids);
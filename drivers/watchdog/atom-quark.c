@@ -56,19 +56,14 @@ static void write_timer_regs(UINT32 wdt_base, UINT32 timer, UINT32 value)
 	}
 }
 
-static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
-		       UINT16 pci_device_id, UINTN timeout)
+static EFI_STATUS init(EFI_PCI_IO *pci_io,
+		       UINT16 __attribute__((unused)) pci_vendor_id,
+		       UINT16 __attribute__((unused)) pci_device_id,
+		       UINTN timeout)
 {
 	UINT32 wdt_base;
 	EFI_STATUS status;
 
-	if (!pci_io || pci_vendor_id != PCI_VENDOR_ID_INTEL ||
-	    (pci_device_id != PCI_DEVICE_ID_INTEL_ITC &&
-	     pci_device_id != PCI_DEVICE_ID_INTEL_CENTERTON &&
-	     pci_device_id != PCI_DEVICE_ID_INTEL_QUARK_X1000)) {
-		return EFI_UNSUPPORTED;
-	}
-
 	status = pci_io->Pci.Read(
 	    pci_io, EfiPciIoWidthUint32, WDTBA_REG, 1, &wdt_base);
 	if (EFI_ERROR(status)) {
@@ -94,4 +89,12 @@ static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
 	return status;
 }
 
-WATCHDOG_REGISTER(init);
+static const WATCHDOG_PCI_ID pci_ids[] = {
+	WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_ITC),
+	WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_CENTERTON),
+	WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL,
+			    PCI_DEVICE_ID_INTEL_QUARK_X1000),
+	{0},
+};
+
+WATCHDOG_REGISTER_PCI("atom-quark", init, pci_ids);
@@ -19,8 +19,9 @@
 #include <sys/io.h>
 
 #include "mmio.h"
+#include "port_handshake.h"
 #include "print.h"
-#include "smbios.h"
+#include "fwtables.h"
 #include "utils.h"
 #include "watchdog.h"
 
@@ -71,7 +72,8 @@
 #define EIOIS200_LDN_PMC0		0x0c /* value */
 #define EIOIS200_LDN_PMC1		0x0d /* value */
 
-#define MAX_STATUS_RETRY		25
+/* per handshake, as with the former 25 polls at 200 usec */
+#define PMC_STATUS_TIMEOUT_US		5000
 #define SMBIOS_TYPE_2			2
 
 enum eiois200_port_id {
@@ -102,8 +104,6 @@ static const struct eiois200_dev_port pnp_port[EIOIS200_PNP_COUNT] = {
 	},
 };
 
-static BOOLEAN probed_before = FALSE;
-
 static void eio200_enter(const struct eiois200_dev_port *p)
 {
 	UINT16 iport = p->index_port;
@@ -198,25 +198,14 @@ static void eio200_read_pmc_ports(const struct eiois200_dev_port *p,
 	eio200_write(p, EIOIS200_IRQCTRL, 0);
 }
 
+static PORT_TRANSACTION transaction;
+
 static EFI_STATUS pmc_wait_iobf(const struct pmc_port *p, UINTN iobf)
 {
-	UINTN n;
-
-	for (n = 0; n < MAX_STATUS_RETRY; ++n) {
-		UINT8 status = inb(p->cmd);
-
-		if (iobf == EIOIS200_PMC_STATUS_IBF) {
-			if (!(status & EIOIS200_PMC_STATUS_IBF))
-				return EFI_SUCCESS;
-		} else {
-			if (status & EIOIS200_PMC_STATUS_OBF)
-				return EFI_SUCCESS;
-		}
-
-		BS->Stall(200);	/* 200 usec */
-	}
-
-	return EFI_DEVICE_ERROR;
+	/* IBF we wait for clear, OBF we wait for set */
+	return port_wait_status(p->cmd, iobf,
+				iobf == EIOIS200_PMC_STATUS_IBF ? 0 : iobf, 0,
+				PMC_STATUS_TIMEOUT_US, NULL, &transaction);
 }
 
 static EFI_STATUS pmc_outb(const struct pmc_port *p, UINT8 value, UINT16 port)
@@ -285,6 +274,8 @@ static EFI_STATUS pmc_cmd_exec(const struct pmc_port *p, UINT8 cmd, UINT8 ctl,
 	BOOLEAN is_read;
 	UINTN n;
 
+	port_transaction_begin(&transaction, L"EIO200 PMC command");
+
 	err = pmc_clear(p);
 	if (EFI_ERROR(err))
 		goto fail;
@@ -316,9 +307,11 @@ static EFI_STATUS pmc_cmd_exec(const struct pmc_port *p, UINT8 cmd, UINT8 ctl,
 			goto fail;
 	}
 
+	port_transaction_end(&transaction, EFI_SUCCESS);
 	return EFI_SUCCESS;
 
 fail:
+	port_transaction_end(&transaction, err);
 	ERROR(L"pmc err: cmd=0x%x ctl=0x%x devid=0x%x size=0x%x\n",
 	      cmd, ctl, devid, size);
 	return err;
@@ -378,7 +371,6 @@ static EFI_STATUS init(EFI_PCI_IO __attribute__((unused)) * pci_io,
 		       UINT16 __attribute__((unused)) pci_device_id,
 		       UINTN timeout)
 {
-	SMBIOS_STRUCTURE_TABLE *smbios_table;
 	SMBIOS_STRUCTURE_POINTER smbios_struct;
 	const CHAR8 *smbios_string;
 	const struct eiois200_dev_port *eport;
@@ -386,17 +378,7 @@ static EFI_STATUS init(EFI_PCI_IO __attribute__((unused)) * pci_io,
 	UINT8 status;
 	EFI_STATUS err;
 
-	/* We do not use PCI, and machines may have many PCI devices */
-	if (probed_before)
-		return EFI_UNSUPPORTED;
-	probed_before = TRUE;
-
-	err = LibGetSystemConfigurationTable(&SMBIOSTableGuid,
-					     (VOID **)&smbios_table);
-	if (EFI_ERROR(err))
-		return err;
-
-	smbios_struct = smbios_find_struct(smbios_table, SMBIOS_TYPE_2);
+	smbios_struct = smbios_find_struct(SMBIOS_TYPE_2, 0);
 	if (smbios_struct.Raw == NULL)
 		return EFI_UNSUPPORTED;
 
@@ -463,4 +445,4 @@ end:
 	return err;
 }
 
-WATCHDOG_REGISTER(init);
+WATCHDOG_REGISTER_PLATFORM("eiois200_wdt", init);
@@ -47,17 +47,14 @@ static EFI_STATUS unlock_timer_regs(EFI_PCI_IO *pci_io)
 	    pci_io, EfiPciIoWidthUint32, 0, ESB_RELOAD_REG, 1, &value);
 }
 
-static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
-		       UINT16 pci_device_id, UINTN timeout)
+static EFI_STATUS init(EFI_PCI_IO *pci_io,
+		       UINT16 __attribute__((unused)) pci_vendor_id,
+		       UINT16 __attribute__((unused)) pci_device_id,
+		       UINTN timeout)
 {
 	EFI_STATUS status;
 	UINT32 value;
 
-	if (!pci_io || pci_vendor_id != PCI_VENDOR_ID_INTEL ||
-	    pci_device_id != PCI_DEVICE_ID_INTEL_ESB_9) {
-		return EFI_UNSUPPORTED;
-	}
-
 	INFO(L"Detected i6300ESB watchdog\n");
 
 	status = unlock_timer_regs(pci_io);
@@ -91,4 +88,9 @@ static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
 	return status;
 }
 
-WATCHDOG_REGISTER(init);
+static const WATCHDOG_PCI_ID pci_ids[] = {
+	WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_ESB_9),
+	{0},
+};
+
+WATCHDOG_REGISTER_PCI("i6300esb", init, pci_ids);
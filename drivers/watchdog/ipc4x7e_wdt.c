@@ -77,17 +77,14 @@ static UINT64 get_sbreg_rba(VOID)
 	return sbreg;
 }
 
-static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
-		       UINT16 pci_device_id, UINTN timeout)
+static EFI_STATUS init(EFI_PCI_IO __attribute__((unused)) * pci_io,
+		       UINT16 __attribute__((unused)) pci_vendor_id,
+		       UINT16 __attribute__((unused)) pci_device_id,
+		       UINTN timeout)
 {
 	UINTN pad_cfg;
 	UINT8 val;
 
-	if (!pci_io || pci_vendor_id != PCI_VENDOR_ID_INTEL ||
-	    pci_device_id != PCI_DEVICE_ID_INTEL_SUNRISEPOINT_H_LPC) {
-		return EFI_UNSUPPORTED;
-	}
-
 	switch (simatic_station_id()) {
 	case SIMATIC_IPC427E:
 	case SIMATIC_IPC477E:
@@ -140,4 +137,10 @@ static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
 	}
 }
 
-WATCHDOG_REGISTER(init);
+static const WATCHDOG_PCI_ID pci_ids[] = {
+	WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL,
+			    PCI_DEVICE_ID_INTEL_SUNRISEPOINT_H_LPC),
+	{0},
+};
+
+WATCHDOG_REGISTER_PCI("ipc4x7e_wdt", init, pci_ids);
@@ -76,4 +76,4 @@ static EFI_STATUS init(EFI_PCI_IO __attribute__((unused)) * pci_io,
 	return EFI_SUCCESS;
 }
 
-WATCHDOG_REGISTER(init);
+WATCHDOG_REGISTER_PLATFORM("ipcbx21a", init);
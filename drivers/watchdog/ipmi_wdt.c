@@ -16,8 +16,9 @@
 #include <pci/header.h>
 #include <sys/io.h>
 
+#include "port_handshake.h"
 #include "print.h"
-#include "smbios.h"
+#include "fwtables.h"
 #include "utils.h"
 #include "watchdog.h"
 
@@ -38,40 +39,23 @@
 #define  IPMI_WDT_SET_USE_OSLOAD        0x3
 #define  IPMI_WDT_SET_ACTION_HARD_RESET 0x1
 
-#define kcs_sts_is_error(sts) (((sts >> 6 ) & 0x3) == 0x3)
+#define IPMI_KCS_STS_ERROR		0xc0
 
 static UINT8
 set_wdt_data[] = {IPMI_WDT_SET_USE_OSLOAD, IPMI_WDT_SET_ACTION_HARD_RESET,
 		  0x00, 0x00,0x00, 0x00};
 
 static EFI_EVENT cmdtimer;
-
-static BOOLEAN probed_before;
+static PORT_TRANSACTION transaction;
 
 static EFI_STATUS
 kcs_wait_iobf(UINT16 io_base, UINTN iobf)
 {
-	EFI_STATUS timerstatus = EFI_NOT_READY;
-
-	while (timerstatus == EFI_NOT_READY) {
-		UINT8 sts = inb(io_base + 1);
-
-		if (kcs_sts_is_error(sts))
-			return EFI_DEVICE_ERROR;
-		if (iobf == IPMI_KCS_STS_IBF) {
-			/* IBF we wait for clear */
-			if (!(sts & IPMI_KCS_STS_IBF))
-				return EFI_SUCCESS;
-		} else {
-			/* OBF we wait for set */
-			if (sts & IPMI_KCS_STS_OBF)
-				return EFI_SUCCESS;
-		}
-		BS->Stall(1000 * 1000 / 10);
-		timerstatus = BS->CheckEvent(cmdtimer);
-	}
-
-	return EFI_DEVICE_ERROR;
+	/* IBF we wait for clear, OBF we wait for set */
+	return port_wait_status(io_base + 1, iobf,
+				iobf == IPMI_KCS_STS_IBF ? 0 : iobf,
+				IPMI_KCS_STS_ERROR, PORT_WAIT_NO_TIMEOUT,
+				cmdtimer, &transaction);
 }
 
 static EFI_STATUS
@@ -144,15 +128,19 @@ send_ipmi_cmd(UINT16 io_base, UINT8 cmd, const UINT8 *data, UINTN datalen)
 	 * recover.
 	 */
 	BS->SetTimer(cmdtimer, TimerRelative, 50000000);
+	port_transaction_begin(&transaction, cmd == IPMI_WDT_CMD_SET ?
+						     L"IPMI watchdog set" :
+						     L"IPMI watchdog reset");
 
 	do {
 		status = _send_ipmi_cmd(io_base, cmd, data, datalen);
 		if (status == EFI_SUCCESS)
-			return status;
+			break;
 		handle_ipmi_error(io_base);
 		timerstatus = BS->CheckEvent(cmdtimer);
 	} while (timerstatus == EFI_NOT_READY);
 
+	port_transaction_end(&transaction, status);
 	return status;
 }
 
@@ -161,24 +149,12 @@ static EFI_STATUS init(__attribute__((unused)) EFI_PCI_IO *pci_io,
 		       __attribute__((unused)) UINT16 pci_device_id,
 		       UINTN timeout)
 {
-	SMBIOS_STRUCTURE_TABLE *smbios_table;
 	SMBIOS_STRUCTURE_POINTER smbios_struct;
 	EFI_STATUS status;
 	UINT64 io_base;
 	UINT16 *timeout_value;
 
-	/* We do not use PCI, and machines with IPMI have many PCI devices */
-	if (probed_before)
-		return EFI_UNSUPPORTED;
-	probed_before = TRUE;
-
-	status = LibGetSystemConfigurationTable(&SMBIOSTableGuid,
-						(VOID **)&smbios_table);
-
-	if (status != EFI_SUCCESS)
-		return EFI_UNSUPPORTED;
-
-	smbios_struct = smbios_find_struct(smbios_table, SMBIOS_TYPE_IPMI_KCS);
+	smbios_struct = smbios_find_struct(SMBIOS_TYPE_IPMI_KCS, 0);
 
 	if (smbios_struct.Raw == NULL)
 		return EFI_UNSUPPORTED;
@@ -215,4 +191,4 @@ static EFI_STATUS init(__attribute__((unused)) EFI_PCI_IO *pci_io,
 	return status;
 }
 
-WATCHDOG_REGISTER(init);
+WATCHDOG_REGISTER_PLATFORM("ipmi_wdt", init);
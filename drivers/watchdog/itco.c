@@ -353,7 +353,8 @@ static void update_no_reboot_flag_apl(const iTCO_info *itco)
 	}
 }
 
-static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
+static EFI_STATUS init(EFI_PCI_IO *pci_io,
+		       UINT16 __attribute__((unused)) pci_vendor_id,
 		       UINT16 pci_device_id, UINTN timeout)
 {
 	UINT32 pm_base, tco_base, value;
@@ -361,8 +362,7 @@ static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
 	const iTCO_info *itco;
 	EFI_STATUS status;
 
-	if (!pci_io || pci_vendor_id != PCI_VENDOR_ID_INTEL ||
-	    !itco_supported(pci_device_id, &itco_chip)) {
+	if (!itco_supported(pci_device_id, &itco_chip)) {
 		return EFI_UNSUPPORTED;
 	}
 	itco = &iTCO_chipset_info[itco_chip];
@@ -421,4 +421,10 @@ static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
 	return EFI_SUCCESS;
 }
 
-WATCHDOG_REGISTER(init);
+/* the supported chipsets are looked up in iTCO_chipset_info */
+static const WATCHDOG_PCI_ID pci_ids[] = {
+	WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, WATCHDOG_PCI_ANY_ID),
+	{0},
+};
+
+WATCHDOG_REGISTER_PCI("itco", init, pci_ids);
@@ -180,17 +180,14 @@ static void wdt_set_time(unsigned int timeout)
 	superio_exit();
 }
 
-static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
+static EFI_STATUS init(EFI_PCI_IO __attribute__((unused)) * pci_io,
+		       UINT16 __attribute__((unused)) pci_vendor_id,
 		       UINT16 __attribute__((unused)) pci_device_id,
 		       UINTN timeout)
 {
 	const char *device;
 	int chip;
 
-	if (!pci_io || pci_vendor_id != PCI_VENDOR_ID_INTEL) {
-		return EFI_UNSUPPORTED;
-	}
-
 	switch (simatic_station_id()) {
 	case SIMATIC_IPC227G:
 		device = "IPC227G";
@@ -223,4 +220,4 @@ static EFI_STATUS init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
 	return EFI_SUCCESS;
 }
 
-WATCHDOG_REGISTER(init);
+WATCHDOG_REGISTER_PLATFORM("w83627hf_wdt", init);
@@ -20,20 +20,11 @@
 #include <mmio.h>
 #include <sys/io.h>
 
+#include "fwtables.h"
 #include "print.h"
 #include "utils.h"
 #include "watchdog.h"
 
-#define EFI_ACPI_TABLE_GUID \
-    { 0xeb9d2d30, 0x2d88, 0x11d3, {0x9a, 0x16, 0x0, 0x90, 0x27, 0x3f, 0xc1, 0x4d }}
-#define EFI_ACPI_20_TABLE_GUID \
-    { 0x8868e871, 0xe4f1, 0x11d3, {0xbc, 0x22, 0x0, 0x80, 0xc7, 0x3c, 0x88, 0x81 }}
-
-#define EFI_ACPI_ROOT_SDP_REVISION 0x02
-
-#define ACPI_SIG_RSDP (CHAR8 *)"RSD PTR "
-#define ACPI_SIG_RSDT (CHAR8 *)"RSDT"
-#define ACPI_SIG_XSDT (CHAR8 *)"XSDT"
 #define ACPI_SIG_WDAT (CHAR8 *)"WDAT"
 
 #define ACPI_WDAT_ENABLED	1
@@ -46,32 +37,6 @@
  * --------------------------------------------------------------------------
  */
 
-/* Root System Description Pointer  (ACPI section 5.2.5.3) */
-typedef struct {
-    CHAR8   signature[8];
-    UINT8   checksum;
-    UINT8   oem_id[6];
-    UINT8   revision;
-    UINT32  rsdt_address;
-    UINT32  length;
-    UINT64  xsdt_address;
-    UINT8   extended_checksum;
-    UINT8   reserved[3];
-} EFI_ACPI_ROOT_SDP_HEADER;
-
-/* System Description Table  (ACPI section 5.2.6) */
-typedef struct {
-	CHAR8   signature[4];
-	UINT32  length;
-	UINT8   revision;
-	UINT8   checksum;
-	CHAR8   oem_id[6];
-	CHAR8   oem_table_id[8];
-	UINT32  oem_revision;
-	UINT32  creator_id;
-	UINT32  creator_revision;
-} EFI_ACPI_SDT_HEADER;
-
 /* Generic Address Structure (ACPI section 5.2.3.2) */
 typedef struct {
 	UINT8 space_id;            /* Address space where struct or register exists */
@@ -140,102 +105,6 @@ typedef struct {
 
 #pragma pack()
 
-static BOOLEAN probed_before;
-
-/* --------------------------------------------------------------------------
- * Parsing of ACPI/WDAT structures for efibootguard
- * --------------------------------------------------------------------------
- */
-
-static EFI_STATUS
-parse_rsdt(EFI_ACPI_SDT_HEADER *rsdt, ACPI_TABLE_WDAT **wdat_table_ptr)
-{
-	UINT32 *entry_ptr;
-	UINT32 n, count;
-
-	if (strncmpa(ACPI_SIG_RSDT, (CHAR8 *)(VOID *)(rsdt->signature), 4)) {
-		return EFI_INCOMPATIBLE_VERSION;
-	}
-
-	entry_ptr = (UINT32 *)(rsdt + 1);
-	count = (rsdt->length - sizeof (EFI_ACPI_SDT_HEADER)) / sizeof(UINT32);
-	for (n = 0; n < count; n++, entry_ptr++) {
-		EFI_ACPI_SDT_HEADER *entry =
-			(EFI_ACPI_SDT_HEADER *)((UINTN)(*entry_ptr));
-		if (!strncmpa(ACPI_SIG_WDAT, entry->signature, 4)) {
-			*wdat_table_ptr = (ACPI_TABLE_WDAT *)entry;
-			return EFI_SUCCESS;
-		}
-	}
-	return EFI_UNSUPPORTED;
-}
-
-static EFI_STATUS
-parse_xsdt(EFI_ACPI_SDT_HEADER *xsdt, ACPI_TABLE_WDAT **wdat_table_ptr)
-{
-	UINT64 *entry_ptr;
-	UINT64 n, count;
-
-	if (strncmpa(ACPI_SIG_XSDT, (CHAR8 *)(VOID *)(xsdt->signature), 4)) {
-		return EFI_INCOMPATIBLE_VERSION;
-	}
-
-	entry_ptr = (UINT64 *)(xsdt + 1);
-	count = (xsdt->length - sizeof (EFI_ACPI_SDT_HEADER)) / sizeof(UINT64);
-	for (n = 0; n < count; n++, entry_ptr++) {
-		EFI_ACPI_SDT_HEADER *entry =
-			(EFI_ACPI_SDT_HEADER *)((UINTN)(*entry_ptr));
-		if (!strncmpa(ACPI_SIG_WDAT, entry->signature, 4)) {
-			*wdat_table_ptr = (ACPI_TABLE_WDAT *)entry;
-			return EFI_SUCCESS;
-		}
-	}
-	return EFI_UNSUPPORTED;
-}
-
-static EFI_STATUS
-parse_rsdp(EFI_ACPI_ROOT_SDP_HEADER *rsdp, ACPI_TABLE_WDAT **wdat_table_ptr)
-{
-	EFI_ACPI_SDT_HEADER *sdt;
-
-	*wdat_table_ptr = NULL;
-
-	if (rsdp->revision > EFI_ACPI_ROOT_SDP_REVISION) {
-		ERROR(L"SDP revision not supported (%d)\n", rsdp->revision);
-		return EFI_INCOMPATIBLE_VERSION;
-	}
-
-	if (rsdp->revision == EFI_ACPI_ROOT_SDP_REVISION) {
-		sdt = (EFI_ACPI_SDT_HEADER *)(UINTN)(rsdp->xsdt_address);
-		return parse_xsdt(sdt, wdat_table_ptr);
-	}
-	else {
-		sdt = (EFI_ACPI_SDT_HEADER *)(UINTN)(rsdp->rsdt_address);
-		return parse_rsdt(sdt, wdat_table_ptr);
-	}
-}
-
-static EFI_STATUS
-locate_and_parse_rsdp(ACPI_TABLE_WDAT **wdat_table_ptr)
-{
-	EFI_CONFIGURATION_TABLE *ect = ST->ConfigurationTable;
-	EFI_ACPI_ROOT_SDP_HEADER *rsdp;
-	EFI_GUID acpi_table_guid = ACPI_TABLE_GUID;
-	EFI_GUID acpi2_table_guid = ACPI_20_TABLE_GUID;
-	UINTN n;
-
-	for (n = 0; n < ST->NumberOfTableEntries; n++) {
-		if ((CompareGuid(&ect->VendorGuid, &acpi_table_guid) ||
-		     CompareGuid(&ect->VendorGuid, &acpi2_table_guid)) &&
-		    !strncmpa(ACPI_SIG_RSDP, (CHAR8 *)(ect->VendorTable), 8)) {
-			rsdp = (EFI_ACPI_ROOT_SDP_HEADER *)ect->VendorTable;
-			return parse_rsdp(rsdp, wdat_table_ptr);
-		}
-		ect++;
-	}
-	return EFI_UNSUPPORTED;
-}
-
 static EFI_STATUS
 read_reg(ACPI_ADDR *addr, UINT32 *value_ptr)
 {
@@ -432,15 +301,10 @@ static EFI_STATUS init(EFI_PCI_IO __attribute__((unused)) * pci_io,
 	UINT32 boot_status;
 	UINTN n;
 
-	/* We do not use PCI, and machines may have many PCI devices */
-	if (probed_before)
-		return EFI_UNSUPPORTED;
-	probed_before = TRUE;
-
 	/* Locate WDAT in ACPI tables */
-	status = locate_and_parse_rsdp(&wdat_table);
-	if (EFI_ERROR(status)) {
-		return status;
+	wdat_table = (ACPI_TABLE_WDAT *)acpi_find_table(ACPI_SIG_WDAT, 0);
+	if (!wdat_table) {
+		return EFI_UNSUPPORTED;
 	}
 
 	INFO(L"Detected WDAT watchdog\n");
@@ -496,4 +360,4 @@ static EFI_STATUS init(EFI_PCI_IO __attribute__((unused)) * pci_io,
 	return EFI_SUCCESS;
 }
 
-WATCHDOG_REGISTER(init);
+WATCHDOG_REGISTER_PLATFORM("wdat", init);
@@ -70,6 +70,21 @@ int ebg_set_opt_bool(ebg_opt_t opt, bool value)
 		ebgenv_opts.verbose = value;
 		bgenv_be_verbose(value);
 		break;
+	case EBG_OPT_PARALLEL_PROBE:
+		ebgenv_opts.parallel_probe = value;
+		break;
+	case EBG_OPT_PROBE_CACHE:
+		ebgenv_opts.probe_cache = value;
+		break;
+	case EBG_OPT_INPLACE_WRITE:
+		ebgenv_opts.inplace_write = value;
+		break;
+	case EBG_OPT_CRC_CROSS_CHECK:
+		ebgenv_opts.crc_cross_check = value;
+		break;
+	case EBG_OPT_DEFERRED_COMPACTION:
+		ebgenv_opts.deferred_compaction = value;
+		break;
 	default:
 		return EINVAL;
 	}
@@ -85,6 +100,21 @@ int ebg_get_opt_bool(ebg_opt_t opt, bool *value)
 	case EBG_OPT_VERBOSE:
 		*value = ebgenv_opts.verbose;
 		break;
+	case EBG_OPT_PARALLEL_PROBE:
+		*value = ebgenv_opts.parallel_probe;
+		break;
+	case EBG_OPT_PROBE_CACHE:
+		*value = ebgenv_opts.probe_cache;
+		break;
+	case EBG_OPT_INPLACE_WRITE:
+		*value = ebgenv_opts.inplace_write;
+		break;
+	case EBG_OPT_CRC_CROSS_CHECK:
+		*value = ebgenv_opts.crc_cross_check;
+		break;
+	case EBG_OPT_DEFERRED_COMPACTION:
+		*value = ebgenv_opts.deferred_compaction;
+		break;
 	default:
 		return EINVAL;
 	}
@@ -96,13 +126,9 @@ void ebg_beverbose(ebgenv_t __attribute__((unused)) * e, bool v)
 	ebg_set_opt_bool(EBG_OPT_VERBOSE, v);
 }
 
-int ebg_env_create_new(ebgenv_t *e)
+static int env_create_new(ebgenv_t *e, EBG_CONTEXT *ctx)
 {
-	if (!bgenv_init()) {
-		return EIO;
-	}
-
-	BGENV *latest_env = bgenv_open_latest();
+	BGENV *latest_env = bgenv_ctx_open_latest(ctx);
 	if (!latest_env) {
 		return EIO;
 	}
@@ -110,7 +136,7 @@ int ebg_env_create_new(ebgenv_t *e)
 	const BG_ENVDATA *latest_data = ((BGENV *)latest_env)->data;
 
 	if (latest_data->in_progress != 1) {
-		e->bgenv = (void *)bgenv_create_new();
+		e->bgenv = (void *)bgenv_ctx_create_new(ctx);
 		if (!e->bgenv) {
 			bgenv_close(latest_env);
 			return errno;
@@ -118,7 +144,13 @@ int ebg_env_create_new(ebgenv_t *e)
 		BG_ENVDATA *new_data = ((BGENV *)e->bgenv)->data;
 		uint32_t new_rev = new_data->revision;
 		uint8_t new_in_progress = new_data->in_progress;
-		memcpy(new_data, latest_env->data, sizeof(BG_ENVDATA));
+		/* the environments may have different layouts */
+		if (!bgenv_copy((BGENV *)e->bgenv, latest_env)) {
+			bgenv_close((BGENV *)e->bgenv);
+			e->bgenv = NULL;
+			bgenv_close(latest_env);
+			return ENOSPC;
+		}
 		new_data->revision = new_rev;
 		new_data->in_progress = new_in_progress;
 		bgenv_close(latest_env);
@@ -129,15 +161,43 @@ int ebg_env_create_new(ebgenv_t *e)
 	return 0;
 }
 
+int ebg_env_create_new(ebgenv_t *e)
+{
+	int res;
+
+	pthread_rwlock_wrlock(&bgenv_default_ctx.lock);
+	if (!bgenv_init()) {
+		pthread_rwlock_unlock(&bgenv_default_ctx.lock);
+		return EIO;
+	}
+	res = env_create_new(e, NULL);
+	if (res) {
+		pthread_rwlock_unlock(&bgenv_default_ctx.lock);
+		return res;
+	}
+	((BGENV *)e->bgenv)->default_locked = true;
+	return 0;
+}
+
 int ebg_env_open_current(ebgenv_t *e)
 {
+	BGENV *env;
+
+	pthread_rwlock_wrlock(&bgenv_default_ctx.lock);
 	if (!bgenv_init()) {
+		pthread_rwlock_unlock(&bgenv_default_ctx.lock);
 		return EIO;
 	}
 
-	e->bgenv = (void *)bgenv_open_latest();
+	env = bgenv_open_latest();
+	if (!env) {
+		pthread_rwlock_unlock(&bgenv_default_ctx.lock);
+		return EIO;
+	}
+	env->default_locked = true;
+	e->bgenv = env;
 
-	return e->bgenv == NULL ? EIO : 0;
+	return 0;
 }
 
 int ebg_env_get(ebgenv_t *e, const char *key, char *buffer)
@@ -165,30 +225,65 @@ int ebg_env_set_ex(ebgenv_t *e, const char *key, uint64_t usertype,
 	return bgenv_set((BGENV *)e->bgenv, key, usertype, value, datalen);
 }
 
-uint32_t ebg_env_user_free(ebgenv_t *e)
+int ebg_env_set_many(ebgenv_t *e, const ebg_kv_t *kvs, size_t count)
 {
-	if (!e->bgenv) {
-		return 0;
+	/* the checksum is updated once by ebg_env_close */
+	return bgenv_set_many((BGENV *)e->bgenv, kvs, count);
+}
+
+int ebg_env_iter_begin(ebgenv_t *e, ebg_env_iter_t *it)
+{
+	return ebg_env_iter_begin_prefix(e, it, NULL);
+}
+
+int ebg_env_iter_begin_prefix(ebgenv_t *e, ebg_env_iter_t *it,
+			      const char *prefix)
+{
+	if (!it) {
+		return EINVAL;
+	}
+	memset(it, 0, sizeof(*it));
+	if (!e) {
+		return EINVAL;
+	}
+	if (!e->bgenv || !((BGENV *)e->bgenv)->data) {
+		return EIO;
 	}
-	if (!((BGENV *)e->bgenv)->data) {
+	bgenv_uservar_iter_init(it, ((BGENV *)e->bgenv)->data->userdata,
+				((BGENV *)e->bgenv)->userdata_size, prefix);
+	return 0;
+}
+
+bool ebg_env_iter_next(ebg_env_iter_t *it, ebg_kv_t *kv)
+{
+	if (!it || !kv) {
+		return false;
+	}
+	return bgenv_uservar_iter_next(it, kv);
+}
+
+uint32_t ebg_env_user_free(ebgenv_t *e)
+{
+	BGENV *env = (BGENV *)e->bgenv;
+
+	if (!env || !env->data) {
 		return 0;
 	}
-	return bgenv_user_free(((BGENV *)e->bgenv)->data->userdata);
+	/* deleted variables are reclaimed as soon as space runs out */
+	return bgenv_user_free_indexed(&env->uservar_index,
+				       env->data->userdata,
+				       env->userdata_size) +
+	       bgenv_user_deleted(env->data->userdata, env->userdata_size);
 }
 
-uint16_t ebg_env_getglobalstate(void __attribute__((unused)) *reserved)
+static uint16_t env_getglobalstate(EBG_CONTEXT *ctx)
 {
 	BGENV *env;
 	int res = USTATE_UNKNOWN;
 
-	if (!bgenv_init()) {
-		errno = EIO;
-		return res;
-	}
-
 	/* Test for rolled-back condition. */
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		env = bgenv_open_by_index(i);
+	for (uint32_t i = 0; i < bgenv_ctx_num_config_parts(ctx); i++) {
+		env = bgenv_ctx_open_by_index(ctx, i);
 
 		if (!env) {
 			continue;
@@ -206,7 +301,7 @@ uint16_t ebg_env_getglobalstate(void __attribute__((unused)) *reserved)
 		}
 	}
 
-	env = bgenv_open_latest();
+	env = bgenv_ctx_open_latest(ctx);
 	if (!env) {
 		errno = EIO;
 		return res;
@@ -218,6 +313,23 @@ uint16_t ebg_env_getglobalstate(void __attribute__((unused)) *reserved)
 	return res;
 }
 
+uint16_t ebg_env_getglobalstate(void __attribute__((unused)) *reserved)
+{
+	uint16_t res;
+
+	/* bgenv_init rescans the partitions of the default context */
+	pthread_rwlock_wrlock(&bgenv_default_ctx.lock);
+	if (!bgenv_init()) {
+		pthread_rwlock_unlock(&bgenv_default_ctx.lock);
+		errno = EIO;
+		return USTATE_UNKNOWN;
+	}
+	res = env_getglobalstate(NULL);
+	pthread_rwlock_unlock(&bgenv_default_ctx.lock);
+
+	return res;
+}
+
 int ebg_env_setglobalstate(ebgenv_t *e, uint16_t ustate)
 {
 	char buffer[2];
@@ -226,24 +338,30 @@ int ebg_env_setglobalstate(ebgenv_t *e, uint16_t ustate)
 	if (ustate > USTATE_FAILED) {
 		return -EINVAL;
 	}
+	if (!e->bgenv || ((BGENV *)e->bgenv)->readonly) {
+		return -EPERM;
+	}
 	(void)snprintf(buffer, sizeof(buffer), "%d", ustate);
 	res = bgenv_set((BGENV *)e->bgenv, "ustate", 0, buffer,
 			strlen(buffer) + 1);
 
-	if (ustate != USTATE_OK) {
+	if (res != 0 || ustate != USTATE_OK) {
 		return res;
 	}
 
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		BGENV *env = bgenv_open_by_index(i);
+	/* the other environments of the same context */
+	EBG_CONTEXT *ctx = e->bgenv ? ((BGENV *)e->bgenv)->ctx : NULL;
+
+	for (uint32_t i = 0; i < bgenv_ctx_num_config_parts(ctx); i++) {
+		BGENV *env = bgenv_ctx_open_by_index(ctx, i);
 
 		if (!env) {
 			continue;
 		}
 		if (env->data->ustate != ustate) {
+			BGENV_CRC_MARK_FIELD(env, ustate);
 			env->data->ustate = ustate;
-			env->data->crc32 = bgenv_crc32(0, env->data,
-				sizeof(BG_ENVDATA) - sizeof(env->data->crc32));
+			bgenv_crc_update(env);
 			if (!bgenv_write(env)) {
 				bgenv_close(env);
 				return -EIO;
@@ -264,19 +382,32 @@ int ebg_env_close(ebgenv_t *e)
 	}
 
 	BGENV *env_current;
+	EBG_CONTEXT *ctx;
+	bool default_locked;
 	env_current = (BGENV *)e->bgenv;
-
-	/* recalculate checksum */
-	env_current->data->crc32 =
-	    bgenv_crc32(0, env_current->data,
-			sizeof(BG_ENVDATA) - sizeof(env_current->data->crc32));
-	/* save */
-	if (!bgenv_write(env_current)) {
-		res = EIO;
+	ctx = env_current->ctx;
+	default_locked = env_current->default_locked;
+
+	if (!env_current->readonly) {
+		/* drop deleted user variables and update checksum */
+		bgenv_compact(env_current);
+		bgenv_crc_update(env_current);
+		/* save */
+		if (!bgenv_write(env_current)) {
+			res = EIO;
+		}
 	}
 	bgenv_close(env_current);
 	e->bgenv = NULL;
-	bgenv_finalize();
+	if (ctx) {
+		/* the context keeps partitions and environments */
+		pthread_rwlock_unlock(&ctx->lock);
+	} else {
+		bgenv_finalize();
+		if (default_locked) {
+			pthread_rwlock_unlock(&bgenv_default_ctx.lock);
+		}
+	}
 	return res;
 }
 
@@ -308,17 +439,33 @@ int ebg_env_finalize_update(ebgenv_t *e)
 	if (!e->bgenv || !((BGENV *)e->bgenv)->data) {
 		return EIO;
 	}
+	if (((BGENV *)e->bgenv)->readonly) {
+		return EPERM;
+	}
 
 	GC_ITEM *pgci, *tmp;
+	BGENV *env = (BGENV *)e->bgenv;
+	USERVAR_INDEX *index;
 	uint8_t *udata;
+	uint32_t size;
 
 	pgci = (GC_ITEM *)e->gc_registry;
-	udata = ((BGENV *)e->bgenv)->data->userdata;
+	index = &env->uservar_index;
+	udata = env->data->userdata;
+	size = env->userdata_size;
 	while (pgci) {
 		uint8_t *var;
-		var = bgenv_find_uservar(udata, pgci->key);
+		var = bgenv_find_uservar_indexed(index, udata, size,
+						 pgci->key);
 		if (var) {
-			bgenv_del_uservar(udata, var);
+			/* the deletion may move all variables behind it */
+			uint32_t used = size - bgenv_user_free_indexed(
+						       index, udata, size);
+
+			bgenv_crc_mark_dirty(env,
+					     offsetof(BG_ENVDATA, userdata) +
+					     (var - udata), used - (var - udata));
+			bgenv_del_uservar_indexed(index, udata, size, var);
 		}
 		free(pgci->key);
 		tmp = pgci->next;
@@ -326,7 +473,108 @@ int ebg_env_finalize_update(ebgenv_t *e)
 		pgci = tmp;
 	}
 
-	((BGENV *)e->bgenv)->data->in_progress = 0;
-	((BGENV *)e->bgenv)->data->ustate = USTATE_INSTALLED;
+	BGENV_CRC_MARK_FIELD(env, in_progress);
+	BGENV_CRC_MARK_FIELD(env, ustate);
+	env->data->in_progress = 0;
+	env->data->ustate = USTATE_INSTALLED;
 	return 0;
 }
+
+ebg_ctx_t *ebg_ctx_new(void)
+{
+	EBG_CONTEXT *ctx;
+
+	/* partitions and environments are allocated as they are found */
+	ctx = calloc(1, sizeof(EBG_CONTEXT));
+	if (!ctx) {
+		return NULL;
+	}
+	if (pthread_rwlock_init(&ctx->lock, NULL) != 0) {
+		goto error;
+	}
+	if (!bgenv_ctx_init(ctx)) {
+		pthread_rwlock_destroy(&ctx->lock);
+		goto error;
+	}
+	return ctx;
+
+error:
+	free(ctx);
+	return NULL;
+}
+
+void ebg_ctx_free(ebg_ctx_t *ctx)
+{
+	if (!ctx) {
+		return;
+	}
+	bgenv_ctx_finalize(ctx);
+	pthread_rwlock_destroy(&ctx->lock);
+	free(ctx);
+}
+
+int ebg_ctx_reload(ebg_ctx_t *ctx)
+{
+	bool read_ok;
+
+	if (!ctx) {
+		return EINVAL;
+	}
+	pthread_rwlock_wrlock(&ctx->lock);
+	read_ok = bgenv_ctx_reload(ctx);
+	pthread_rwlock_unlock(&ctx->lock);
+
+	return read_ok ? 0 : EIO;
+}
+
+int ebg_env_open_current_ctx(ebgenv_t *e, ebg_ctx_t *ctx, bool readonly)
+{
+	BGENV *env;
+
+	if (!ctx) {
+		return EINVAL;
+	}
+	if (readonly) {
+		pthread_rwlock_rdlock(&ctx->lock);
+	} else {
+		pthread_rwlock_wrlock(&ctx->lock);
+	}
+	env = bgenv_ctx_open_latest(ctx);
+	if (!env) {
+		pthread_rwlock_unlock(&ctx->lock);
+		return EIO;
+	}
+	env->readonly = readonly;
+	e->bgenv = env;
+	return 0;
+}
+
+int ebg_env_create_new_ctx(ebgenv_t *e, ebg_ctx_t *ctx)
+{
+	int res;
+
+	if (!ctx) {
+		return EINVAL;
+	}
+	pthread_rwlock_wrlock(&ctx->lock);
+	res = env_create_new(e, ctx);
+	if (res) {
+		pthread_rwlock_unlock(&ctx->lock);
+	}
+	return res;
+}
+
+uint16_t ebg_ctx_getglobalstate(ebg_ctx_t *ctx)
+{
+	uint16_t res;
+
+	if (!ctx) {
+		errno = EINVAL;
+		return USTATE_UNKNOWN;
+	}
+	pthread_rwlock_rdlock(&ctx->lock);
+	res = env_getglobalstate(ctx);
+	pthread_rwlock_unlock(&ctx->lock);
+
+	return res;
+}
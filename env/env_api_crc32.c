@@ -52,6 +52,7 @@
  */
 
 #include "env_api.h"
+#include "env_api_crc32.h"
 
 static uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -99,16 +100,350 @@ static uint32_t crc32_tab[] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t
-bgenv_crc32(uint32_t crc, const void *buf, size_t size)
+/*
+ * The tables for slicing by 8 and 16 bytes are derived from crc32_tab:
+ * crc32_slice_tab[k][n] is the CRC of byte n followed by k zero bytes.
+ */
+static uint32_t crc32_slice_tab[16][256];
+
+static inline uint32_t crc32_load_le32(const uint8_t *p)
 {
-	const uint8_t *p;
+	uint32_t val;
 
-	p = buf;
-	crc = crc ^ ~0U;
+	memcpy(&val, p, sizeof(val));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	val = __builtin_bswap32(val);
+#endif
+	return val;
+}
 
+static uint32_t crc32_bytewise(uint32_t crc, const uint8_t *p, size_t size)
+{
 	while (size--)
 		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
 
-	return crc ^ ~0U;
+	return crc;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	while (size >= 8) {
+		uint32_t one = crc32_load_le32(p) ^ crc;
+		uint32_t two = crc32_load_le32(p + 4);
+
+		crc = crc32_slice_tab[7][one & 0xFF] ^
+		      crc32_slice_tab[6][(one >> 8) & 0xFF] ^
+		      crc32_slice_tab[5][(one >> 16) & 0xFF] ^
+		      crc32_slice_tab[4][one >> 24] ^
+		      crc32_slice_tab[3][two & 0xFF] ^
+		      crc32_slice_tab[2][(two >> 8) & 0xFF] ^
+		      crc32_slice_tab[1][(two >> 16) & 0xFF] ^
+		      crc32_slice_tab[0][two >> 24];
+		p += 8;
+		size -= 8;
+	}
+	return crc32_bytewise(crc, p, size);
+}
+
+static uint32_t crc32_slice16(uint32_t crc, const uint8_t *p, size_t size)
+{
+	while (size >= 16) {
+		uint32_t one = crc32_load_le32(p) ^ crc;
+		uint32_t two = crc32_load_le32(p + 4);
+		uint32_t three = crc32_load_le32(p + 8);
+		uint32_t four = crc32_load_le32(p + 12);
+
+		crc = crc32_slice_tab[15][one & 0xFF] ^
+		      crc32_slice_tab[14][(one >> 8) & 0xFF] ^
+		      crc32_slice_tab[13][(one >> 16) & 0xFF] ^
+		      crc32_slice_tab[12][one >> 24] ^
+		      crc32_slice_tab[11][two & 0xFF] ^
+		      crc32_slice_tab[10][(two >> 8) & 0xFF] ^
+		      crc32_slice_tab[9][(two >> 16) & 0xFF] ^
+		      crc32_slice_tab[8][two >> 24] ^
+		      crc32_slice_tab[7][three & 0xFF] ^
+		      crc32_slice_tab[6][(three >> 8) & 0xFF] ^
+		      crc32_slice_tab[5][(three >> 16) & 0xFF] ^
+		      crc32_slice_tab[4][three >> 24] ^
+		      crc32_slice_tab[3][four & 0xFF] ^
+		      crc32_slice_tab[2][(four >> 8) & 0xFF] ^
+		      crc32_slice_tab[1][(four >> 16) & 0xFF] ^
+		      crc32_slice_tab[0][four >> 24];
+		p += 16;
+		size -= 16;
+	}
+	return crc32_bytewise(crc, p, size);
+}
+
+static bool crc32_always_supported(void)
+{
+	return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define CRC32_PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+
+/*
+ * Folding with carry-less multiplication as described in Intel's paper
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction". The constants are for the bit-reflected polynomial.
+ */
+static CRC32_PCLMUL_TARGET uint32_t crc32_pclmul_fold(uint32_t crc,
+						      const uint8_t *p,
+						      size_t size)
+{
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = {
+		0x0154442bd4, 0x01c6e41596
+	};
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = {
+		0x01751997d0, 0x00ccaa009e
+	};
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = {
+		0x0163cd6124, 0x0000000000
+	};
+	static const uint64_t __attribute__((aligned(16))) poly[] = {
+		0x01db710641, 0x01f7011641
+	};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	/* size is a multiple of 16 and at least 64 */
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	p += 64;
+	size -= 64;
+
+	/* fold 4 x 128 bits in parallel */
+	while (size >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		p += 64;
+		size -= 64;
+	}
+
+	/* fold into 128 bits */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* fold remaining blocks of 128 bits */
+	while (size >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)p);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		p += 16;
+		size -= 16;
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	if (size >= 64) {
+		size_t chunk = size & ~(size_t)15;
+
+		crc = crc32_pclmul_fold(crc, p, chunk);
+		p += chunk;
+		size -= chunk;
+	}
+	return crc32_slice16(crc, p, size);
+}
+
+static bool crc32_pclmul_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") &&
+	       __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+
+static __attribute__((target("+crc"))) uint32_t
+crc32_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint64_t val;
+
+	while (size && ((uintptr_t)p & 7)) {
+		crc = __crc32b(crc, *p++);
+		size--;
+	}
+	while (size >= 8) {
+		memcpy(&val, p, sizeof(val));
+		crc = __crc32d(crc, val);
+		p += 8;
+		size -= 8;
+	}
+	while (size--) {
+		crc = __crc32b(crc, *p++);
+	}
+	return crc;
+}
+
+static bool crc32_armv8_supported(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+/* ordered by preference, the first supported one is used */
+const BGENV_CRC32_IMPL bgenv_crc32_impls[] = {
+#if defined(__aarch64__)
+	{"armv8-crc32", crc32_armv8_supported, crc32_armv8},
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	{"pclmul", crc32_pclmul_supported, crc32_pclmul},
+#endif
+	{"slice-by-16", crc32_always_supported, crc32_slice16},
+	{"slice-by-8", crc32_always_supported, crc32_slice8},
+	{"bytewise", crc32_always_supported, crc32_bytewise},
+};
+const size_t bgenv_crc32_num_impls =
+	sizeof(bgenv_crc32_impls) / sizeof(bgenv_crc32_impls[0]);
+
+static uint32_t (*crc32_update)(uint32_t, const uint8_t *, size_t) =
+	crc32_bytewise;
+
+/*
+ * Operators for combining CRCs as in zlib's crc32_combine(): crc32_x2n[n]
+ * is x^(2^n) modulo the polynomial, so appending len zero bytes to a CRC
+ * register takes O(log(len)) carry-less multiplications.
+ */
+static uint32_t crc32_x2n[32];
+
+/* multiply a and b modulo the polynomial, both bit-reflected */
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1U << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ 0xedb88320 : b >> 1;
+	}
+	return p;
+}
+
+/* x^(len * 8) modulo the polynomial */
+static uint32_t crc32_x8nmodp(size_t len)
+{
+	uint32_t p = 1U << 31; /* x^0 == 1 */
+	unsigned int k = 3;
+
+	while (len) {
+		if (len & 1) {
+			p = crc32_multmodp(crc32_x2n[k & 31], p);
+		}
+		len >>= 1;
+		k++;
+	}
+	return p;
+}
+
+static void __attribute__((constructor)) crc32_init(void)
+{
+	for (int n = 0; n < 256; n++) {
+		crc32_slice_tab[0][n] = crc32_tab[n];
+	}
+	for (int k = 1; k < 16; k++) {
+		for (int n = 0; n < 256; n++) {
+			uint32_t prev = crc32_slice_tab[k - 1][n];
+
+			crc32_slice_tab[k][n] =
+				crc32_tab[prev & 0xFF] ^ (prev >> 8);
+		}
+	}
+	crc32_x2n[0] = 1U << 30; /* x^1 */
+	for (int n = 1; n < 32; n++) {
+		crc32_x2n[n] = crc32_multmodp(crc32_x2n[n - 1], crc32_x2n[n - 1]);
+	}
+	for (size_t i = 0; i < bgenv_crc32_num_impls; i++) {
+		if (bgenv_crc32_impls[i].supported()) {
+			crc32_update = bgenv_crc32_impls[i].update;
+			break;
+		}
+	}
+}
+
+uint32_t
+bgenv_crc32(uint32_t crc, const void *buf, size_t size)
+{
+	return crc32_update(crc ^ ~0U, buf, size) ^ ~0U;
+}
+
+uint32_t bgenv_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	return crc32_multmodp(crc32_x8nmodp(len2), crc1) ^ crc2;
+}
+
+uint32_t bgenv_crc32_delta(const void *buf, size_t size, size_t tail)
+{
+	return crc32_multmodp(crc32_x8nmodp(tail), crc32_update(0, buf, size));
 }
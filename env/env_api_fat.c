@@ -12,13 +12,19 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include <time.h>
+
 #include "env_api.h"
+#include "env_api_crc32.h"
 #include "env_disk_utils.h"
 #include "env_config_partitions.h"
 #include "env_config_file.h"
+#include "env_layout.h"
+#include "env_probe_cache.h"
 #include "uservars.h"
 #include "test-interface.h"
 #include "ebgpart.h"
+#include "fat.h"
 
 extern ebgenv_opts_t ebgenv_opts;
 
@@ -50,38 +56,172 @@ void bgenv_be_verbose(bool v)
 	ebgpart_beverbose(v);
 }
 
-static void clear_envdata(BG_ENVDATA *data)
+static void clear_envdata(BG_ENVDATA *data, uint32_t userdata_size)
 {
-	memset(data, 0, sizeof(BG_ENVDATA));
-	data->crc32 = bgenv_crc32(0, data,
-				  sizeof(BG_ENVDATA) - sizeof(data->crc32));
+	size_t size = ENV_DATA_SIZE(userdata_size) - sizeof(uint32_t);
+
+	memset(data, 0, size);
+	env_data_set_crc32(data, userdata_size, bgenv_crc32(0, data, size));
 }
 
-bool validate_envdata(BG_ENVDATA *data)
+bool validate_envdata(BG_ENVDATA *data, uint32_t userdata_size)
 {
 	uint32_t sum = bgenv_crc32(0, data,
-				   sizeof(BG_ENVDATA) - sizeof(data->crc32));
+				   ENV_DATA_SIZE(userdata_size) -
+					   sizeof(uint32_t));
 
-	if (data->crc32 != sum) {
+	if (env_data_crc32(data, userdata_size) != sum) {
 		VERBOSE(stderr, "Invalid CRC32!\n");
 		/* clear invalid environment */
-		clear_envdata(data);
+		clear_envdata(data, userdata_size);
 		return false;
 	}
-	if (!bgenv_validate_uservars(data->userdata)) {
+	if (!bgenv_validate_uservars(data->userdata, userdata_size)) {
 		VERBOSE(stderr, "Corrupt uservars!\n");
 		/* clear invalid environment */
-		clear_envdata(data);
+		clear_envdata(data, userdata_size);
 		return false;
 	}
 	return true;
 }
 
-bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
+/*
+ * In-place writes only rewrite the sectors whose contents differ from the
+ * stored environment file. The CRC is the last member, so it is always part
+ * of the last range written. The caller syncs once after all ranges.
+ */
+typedef ssize_t (*env_pwrite_fn)(void *ctx, const void *buf, size_t count,
+				 off64_t offset);
+
+#define ENV_WRITE_SECTOR 512
+
+static bool write_env_changes(const uint8_t *old, const uint8_t *new,
+			      size_t size, env_pwrite_fn write_fn, void *ctx)
 {
-	if (!part) {
+	size_t start = 0, end = 0;
+	bool in_range = false;
+
+	for (size_t pos = 0; pos < size; pos += ENV_WRITE_SECTOR) {
+		size_t len = size - pos < ENV_WRITE_SECTOR ? size - pos
+							   : ENV_WRITE_SECTOR;
+		bool changed = memcmp(old + pos, new + pos, len) != 0;
+
+		if (changed && !in_range) {
+			start = pos;
+			while (old[start] == new[start]) {
+				start++;
+			}
+			in_range = true;
+		}
+		if (changed) {
+			end = pos + len;
+			while (old[end - 1] == new[end - 1]) {
+				end--;
+			}
+		}
+		if (in_range && (!changed || pos + len == size)) {
+			if (write_fn(ctx, new + start, end - start, start) !=
+			    (ssize_t)(end - start)) {
+				return false;
+			}
+			in_range = false;
+		}
+	}
+	return true;
+}
+
+static ssize_t fat_file_pread_fn(void *ctx, void *buf, size_t count,
+				 off64_t offset)
+{
+	return fat_file_pread(ctx, buf, count, offset);
+}
+
+static ssize_t fat_file_pwrite_fn(void *ctx, const void *buf, size_t count,
+				  off64_t offset)
+{
+	return fat_file_pwrite(ctx, buf, count, offset);
+}
+
+static ssize_t fd_pwrite_fn(void *ctx, const void *buf, size_t count,
+			    off64_t offset)
+{
+	return pwrite64(*(int *)ctx, buf, count, offset);
+}
+
+/*
+ * Access the environment file of an unmounted partition directly on the
+ * block device. This avoids the mount/umount cycle, mounting the partition
+ * is only needed as fallback if the filesystem cannot be handled here.
+ */
+static bool read_env_from_device(CONFIG_PART *part, BG_ENVDATA **env)
+{
+	struct fat_file file;
+	bool result = true;
+	int ret;
+
+	ret = fat_file_open(part->devpath, FAT_ENV_FILENAME, false, &file,
+			    ebgenv_opts.verbose);
+	if (ret) {
+		VERBOSE(stdout, "Cannot access %s directly on %s (%s).\n",
+			FAT_ENV_FILENAME, part->devpath, strerror(-ret));
+		return false;
+	}
+	*env = env_layout_read(fat_file_pread_fn, &file, &part->layout);
+	if (!*env) {
+		VERBOSE(stderr, "Error reading environment data from %s\n",
+			part->devpath);
+		result = false;
+	}
+	fat_file_close(&file);
+	return result;
+}
+
+static bool write_env_to_device(const CONFIG_PART *part, const uint8_t *buf,
+				size_t size)
+{
+	struct fat_file file;
+	bool result = true;
+	int ret;
+
+	ret = fat_file_open(part->devpath, FAT_ENV_FILENAME, true, &file,
+			    ebgenv_opts.verbose);
+	if (ret) {
+		VERBOSE(stdout, "Cannot access %s directly on %s (%s).\n",
+			FAT_ENV_FILENAME, part->devpath, strerror(-ret));
+		return false;
+	}
+	/* only rewrite in place, resizing the file is left to the fallback */
+	if (file.size != size) {
+		VERBOSE(stdout, "Unexpected size of %s on %s.\n",
+			FAT_ENV_FILENAME, part->devpath);
+		fat_file_close(&file);
 		return false;
 	}
+	if (ebgenv_opts.inplace_write) {
+		uint8_t *stored = malloc(size);
+
+		if (!stored ||
+		    fat_file_pread(&file, stored, size, 0) != (ssize_t)size ||
+		    !write_env_changes(stored, buf, size, fat_file_pwrite_fn,
+				       &file) ||
+		    fat_file_sync(&file)) {
+			VERBOSE(stderr, "Error saving environment data to %s\n",
+				part->devpath);
+			result = false;
+		}
+		free(stored);
+	} else if (fat_file_pwrite(&file, buf, size, 0) != (ssize_t)size ||
+		   fat_file_sync(&file)) {
+		VERBOSE(stderr, "Error saving environment data to %s\n",
+			part->devpath);
+		result = false;
+	}
+	fat_file_close(&file);
+	return result;
+}
+
+static bool read_env_from_file(CONFIG_PART *part, BG_ENVDATA **env)
+{
 	if (part->not_mounted) {
 		/* mount partition before reading config file */
 		if (!mount_partition(part)) {
@@ -97,12 +237,11 @@ bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
 		return false;
 	}
 	bool result = true;
-	if (!(fread(env, sizeof(BG_ENVDATA), 1, config) == 1)) {
+	int fd = fileno(config);
+	*env = env_layout_read(env_layout_fd_pread, &fd, &part->layout);
+	if (!*env) {
 		VERBOSE(stderr, "Error reading environment data from %s\n",
 			part->devpath);
-		if (feof(config)) {
-			VERBOSE(stderr, "End of file encountered.\n");
-		}
 		result = false;
 	}
 	if (fclose(config)) {
@@ -112,40 +251,146 @@ bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
 	if (part->not_mounted) {
 		unmount_partition(part);
 	}
-	if (result == false) {
-		clear_envdata(env);
+	return result;
+}
+
+/*
+ * The partition may have been mounted since it was probed. Raw access to
+ * the device would then bypass the mounted file system, so switch over to
+ * the mount point. The lookup is served from the mount table snapshot.
+ */
+static void refresh_mount_state(CONFIG_PART *part)
+{
+	char *mountpoint;
+
+	if (!part->not_mounted) {
+		return;
+	}
+	if ((mountpoint = get_mountpoint(part->devpath))) {
+		free(part->mountpoint);
+		part->mountpoint = mountpoint;
+		part->not_mounted = false;
+	}
+}
+
+/*
+ * On success, env is allocated for the user variables of the layout found
+ * on the partition. It is left NULL otherwise.
+ */
+bool read_env(CONFIG_PART *part, BG_ENVDATA **env)
+{
+	if (!part || !env) {
+		return false;
+	}
+	*env = NULL;
+	refresh_mount_state(part);
+	if (!(part->not_mounted && read_env_from_device(part, env)) &&
+	    !read_env_from_file(part, env)) {
 		return false;
 	}
 
 	/* enforce NULL-termination of strings */
-	env->kernelfile[ENV_STRING_LENGTH - 1] = 0;
-	env->kernelparams[ENV_STRING_LENGTH - 1] = 0;
+	(*env)->kernelfile[ENV_STRING_LENGTH - 1] = 0;
+	(*env)->kernelparams[ENV_STRING_LENGTH - 1] = 0;
+
+	if (!validate_envdata(*env, env_layout_userdata_size(&part->layout))) {
+		free(*env);
+		*env = NULL;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Rewrite the environment file of a mounted partition in place, without
+ * truncating it first. Returns false without writing anything if the file
+ * does not have the expected size, so the caller can fall back.
+ */
+static bool write_env_in_place(CONFIG_PART *part, const uint8_t *buf,
+			       size_t size, bool *written)
+{
+	uint8_t *stored;
+	struct stat st;
+	bool result = true;
+	FILE *config;
+	int fd;
 
-	return validate_envdata(env);
+	*written = false;
+	config = open_config_file_from_part(part, "r+b");
+	if (!config) {
+		return false;
+	}
+	fd = fileno(config);
+	stored = malloc(size);
+	if (!stored || fstat(fd, &st) || st.st_size != (off_t)size ||
+	    pread64(fd, stored, size, 0) != (ssize_t)size) {
+		free(stored);
+		(void)fclose(config);
+		return false;
+	}
+	*written = true;
+	if (!write_env_changes(stored, buf, size, fd_pwrite_fn, &fd) ||
+	    fdatasync(fd)) {
+		VERBOSE(stderr, "Error saving environment data to %s\n",
+			part->devpath);
+		result = false;
+	}
+	free(stored);
+	if (fclose(config)) {
+		VERBOSE(stderr,
+			"Error closing environment file after writing.\n");
+		result = false;
+	}
+	return result;
 }
 
 bool write_env(CONFIG_PART *part, const BG_ENVDATA *env)
 {
+	uint8_t *buf;
+	size_t size;
+
 	if (!part) {
 		return false;
 	}
+	/* keep the layout the environment file was found in */
+	buf = env_layout_encode(env, env_layout_userdata_size(&part->layout),
+				&part->layout, &size);
+	if (!buf) {
+		VERBOSE(stderr, "Cannot encode environment for %s\n",
+			part->devpath);
+		return false;
+	}
+	refresh_mount_state(part);
+	bool result = true;
+	if (part->not_mounted && write_env_to_device(part, buf, size)) {
+		goto out_free;
+	}
 	if (part->not_mounted) {
 		/* mount partition before reading config file */
 		if (!mount_partition(part)) {
-			return false;
+			result = false;
+			goto out_free;
 		}
 	} else {
 		VERBOSE(stdout, "Read config file: mounted to %s\n",
 			part->mountpoint);
 	}
+	bool written = false;
+	if (ebgenv_opts.inplace_write) {
+		result = write_env_in_place(part, buf, size, &written);
+	}
+	if (written) {
+		goto out;
+	}
 	FILE *config;
 	config = open_config_file_from_part(part, "wb");
 	if (!config) {
 		VERBOSE(stderr, "Could not open config file for writing.\n");
-		return false;
+		result = false;
+		goto out;
 	}
-	bool result = true;
-	if (!(fwrite(env, sizeof(BG_ENVDATA), 1, config) == 1)) {
+	result = true;
+	if (!(fwrite(buf, size, 1, config) == 1)) {
 		VERBOSE(stderr, "Error saving environment data to %s\n",
 			part->devpath);
 		result = false;
@@ -155,92 +400,361 @@ bool write_env(CONFIG_PART *part, const BG_ENVDATA *env)
 			"Error closing environment file after writing.\n");
 		result = false;
 	};
+out:
 	if (part->not_mounted) {
 		unmount_partition(part);
 	}
+out_free:
+	free(buf);
 	return result;
 }
 
-/* Weaken the symbols in order to permit overloading in the test cases. */
-CONFIG_PART __attribute__((weak)) config_parts[ENV_NUM_CONFIG_PARTS];
-BG_ENVDATA __attribute__((weak)) envdata[ENV_NUM_CONFIG_PARTS];
+/* Weaken the symbol in order to permit overloading in the test cases. */
+EBG_CONTEXT __attribute__((weak)) bgenv_default_ctx = {
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+};
 
-static bool initialized;
+/* probing touches process-wide state like the probe cache */
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;
 
-bool bgenv_init(void)
+static void free_context(EBG_CONTEXT *ctx)
 {
-	if (initialized) {
-		return true;
+	for (uint32_t i = 0; i < ctx->num_parts; i++) {
+		free(ctx->parts[i].devpath);
+		free(ctx->parts[i].mountpoint);
+		free(ctx->envdata[i]);
 	}
-	/* enumerate all config partitions */
-	if (!probe_config_partitions(config_parts,
+	free(ctx->parts);
+	ctx->parts = NULL;
+	free(ctx->envdata);
+	ctx->envdata = NULL;
+	ctx->num_parts = 0;
+}
+
+static bool probe_parts(EBG_CONTEXT *ctx)
+{
+	CONFIG_PART found[ENV_V2_MAX_CONFIG_PARTS];
+	uint32_t count = 0;
+
+	memset(found, 0, sizeof(found));
+	if (!probe_config_partitions(found, &count,
 				     ebgenv_opts.search_all_devices)) {
 		VERBOSE(stderr, "Error finding config partitions.\n");
 		return false;
 	}
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		read_env(&config_parts[i], &envdata[i]);
+	ctx->parts = calloc(count, sizeof(CONFIG_PART));
+	ctx->envdata = calloc(count, sizeof(BG_ENVDATA *));
+	if (!ctx->parts || !ctx->envdata) {
+		for (uint32_t i = 0; i < count; i++) {
+			free(found[i].devpath);
+			free(found[i].mountpoint);
+		}
+		free_context(ctx);
+		return false;
 	}
-	initialized = true;
+	memcpy(ctx->parts, found, count * sizeof(CONFIG_PART));
+	ctx->num_parts = count;
 	return true;
 }
 
-void bgenv_finalize(void)
+/*
+ * With EBG_OPT_PARALLEL_PROBE, the environments are read and validated by
+ * one thread per config partition, as the partitions may sit on different
+ * or slow devices.
+ */
+typedef struct {
+	CONFIG_PART *part;
+	BG_ENVDATA *env;
+	bool ok;
+	uint64_t usec;
+} READ_JOB;
+
+static uint64_t monotonic_usec(void)
 {
-	if (!initialized) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *read_worker(void *arg)
+{
+	READ_JOB *job = arg;
+	uint64_t start = monotonic_usec();
+
+	job->ok = read_env(job->part, &job->env);
+	job->usec = monotonic_usec() - start;
+	return NULL;
+}
+
+/*
+ * The environments tell how many config partitions there should be. Files
+ * without a header do not, they are expected in the number the library was
+ * built for if no file tells otherwise.
+ */
+static uint32_t expected_parts(const READ_JOB *jobs, uint32_t count)
+{
+	uint32_t expected = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const ENV_LAYOUT *layout = &jobs[i].part->layout;
+
+		if (!jobs[i].ok || layout->version == ENV_LAYOUT_LEGACY) {
+			continue;
+		}
+		if (expected && layout->num_config_parts != expected) {
+			VERBOSE(stderr, "Error, the environments disagree on "
+					"the number of config partitions.\n");
+			return 0;
+		}
+		expected = layout->num_config_parts;
+	}
+	return expected ? expected : ENV_NUM_CONFIG_PARTS;
+}
+
+/*
+ * Returns -EIO if some environments could not be read, they are replaced
+ * by empty ones in the layout of the others then. -EINVAL means that the
+ * environments do not match the config partitions found.
+ */
+static int read_envs(EBG_CONTEXT *ctx)
+{
+	READ_JOB jobs[ENV_V2_MAX_CONFIG_PARTS];
+	pthread_t workers[ENV_V2_MAX_CONFIG_PARTS];
+	bool started[ENV_V2_MAX_CONFIG_PARTS] = {false};
+	const ENV_LAYOUT *layout = NULL;
+	uint32_t n = ctx->num_parts;
+	uint64_t start = monotonic_usec();
+	uint32_t expected;
+	int res = 0;
+
+	for (uint32_t i = 0; i < n; i++) {
+		jobs[i].part = &ctx->parts[i];
+		jobs[i].env = NULL;
+	}
+	/* the calling thread reads the first environment itself */
+	for (uint32_t i = 1; i < n && ebgenv_opts.parallel_probe; i++) {
+		started[i] = pthread_create(&workers[i], NULL, read_worker,
+					    &jobs[i]) == 0;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		if (!started[i]) {
+			read_worker(&jobs[i]);
+		}
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		if (started[i]) {
+			pthread_join(workers[i], NULL);
+		}
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		VERBOSE(stdout, "Environment %u from %s: %s, %llu.%03llu ms\n",
+			i, jobs[i].part->devpath ? jobs[i].part->devpath : "-",
+			jobs[i].ok ? "ok" : "failed",
+			(unsigned long long)jobs[i].usec / 1000,
+			(unsigned long long)jobs[i].usec % 1000);
+		if (jobs[i].ok && !layout) {
+			layout = &jobs[i].part->layout;
+		}
+	}
+	uint64_t total = monotonic_usec() - start;
+	VERBOSE(stdout, "Read %u environments %s in %llu.%03llu ms\n", n,
+		ebgenv_opts.parallel_probe ? "concurrently" : "sequentially",
+		(unsigned long long)total / 1000,
+		(unsigned long long)total % 1000);
+
+	expected = expected_parts(jobs, n);
+	for (uint32_t i = 0; i < n; i++) {
+		free(ctx->envdata[i]);
+		ctx->envdata[i] = jobs[i].env;
+		if (jobs[i].ok) {
+			continue;
+		}
+		/* an empty one, to be written in the layout of the others */
+		if (layout) {
+			jobs[i].part->layout = *layout;
+		} else {
+			memset(&jobs[i].part->layout, 0, sizeof(ENV_LAYOUT));
+		}
+		ctx->envdata[i] = env_data_alloc(
+			env_layout_userdata_size(&jobs[i].part->layout));
+		if (!ctx->envdata[i]) {
+			res = -ENOMEM;
+		} else if (!res) {
+			res = -EIO;
+		}
+	}
+	if (res != -ENOMEM && n != expected) {
+		if (expected) {
+			VERBOSE(stderr,
+				"Error, found %u config partitions, the "
+				"environments expect %u.\n",
+				n, expected);
+		}
+		res = -EINVAL;
+	}
+	return res;
+}
+
+static bool probe_and_read(EBG_CONTEXT *ctx)
+{
+	int res;
+
+	if (!probe_parts(ctx)) {
+		return false;
+	}
+	res = read_envs(ctx);
+	if (res && probe_cache_invalidate()) {
+		/* the cached partitions are stale, probe from scratch */
+		free_context(ctx);
+		if (!probe_parts(ctx)) {
+			return false;
+		}
+		res = read_envs(ctx);
+	}
+	if (res && res != -EIO) {
+		free_context(ctx);
+		return false;
+	}
+	return true;
+}
+
+bool bgenv_ctx_init(EBG_CONTEXT *ctx)
+{
+	bool result;
+
+	if (!ctx) {
+		ctx = &bgenv_default_ctx;
+	}
+	if (ctx->initialized) {
+		return true;
+	}
+	/* a missing snapshot is not fatal, lookups then scan the table */
+	if (!mount_table_load()) {
+		VERBOSE(stderr, "Could not load mount table.\n");
+	}
+	pthread_mutex_lock(&probe_lock);
+	result = probe_and_read(ctx);
+	pthread_mutex_unlock(&probe_lock);
+	if (!result) {
+		mount_table_free();
+		return false;
+	}
+	ctx->initialized = true;
+	return true;
+}
+
+void bgenv_ctx_finalize(EBG_CONTEXT *ctx)
+{
+	if (!ctx) {
+		ctx = &bgenv_default_ctx;
+	}
+	if (!ctx->initialized) {
 		return;
 	}
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		free(config_parts[i].devpath);
-		config_parts[i].devpath = NULL;
-		free(config_parts[i].mountpoint);
-		config_parts[i].mountpoint = NULL;
+	free_context(ctx);
+	mount_table_free();
+	ctx->initialized = false;
+}
+
+/* Read the environments again from the partitions found before. */
+bool bgenv_ctx_reload(EBG_CONTEXT *ctx)
+{
+	if (!ctx) {
+		ctx = &bgenv_default_ctx;
+	}
+	if (!ctx->initialized) {
+		return false;
 	}
-	initialized = false;
+	return read_envs(ctx) == 0;
 }
 
-BGENV *bgenv_open_by_index(uint32_t index)
+bool bgenv_init(void)
+{
+	return bgenv_ctx_init(NULL);
+}
+
+void bgenv_finalize(void)
+{
+	bgenv_ctx_finalize(NULL);
+}
+
+uint32_t bgenv_ctx_num_config_parts(EBG_CONTEXT *ctx)
+{
+	return (ctx ? ctx : &bgenv_default_ctx)->num_parts;
+}
+
+uint32_t bgenv_num_config_parts(void)
 {
+	return bgenv_ctx_num_config_parts(NULL);
+}
+
+BGENV *bgenv_ctx_open_by_index(EBG_CONTEXT *ctx, uint32_t index)
+{
+	EBG_CONTEXT *c = ctx ? ctx : &bgenv_default_ctx;
 	BGENV *handle;
 
 	/* get config partition by index and allocate handle */
-	if (index >= ENV_NUM_CONFIG_PARTS) {
+	if (index >= c->num_parts || !c->envdata[index]) {
 		return NULL;
 	}
 	if (!(handle = calloc(1, sizeof(BGENV)))) {
 		return NULL;
 	}
-	handle->desc = (void *)&config_parts[index];
-	handle->data = &envdata[index];
+	handle->desc = (void *)&c->parts[index];
+	handle->data = c->envdata[index];
+	handle->userdata_size =
+		env_layout_userdata_size(&c->parts[index].layout);
+	handle->ctx = ctx;
+	/* the environment was validated or cleared when it was read */
+	handle->crc.tracking = true;
 	return handle;
 }
 
-BGENV *bgenv_open_oldest(void)
+BGENV *bgenv_ctx_open_oldest(EBG_CONTEXT *ctx)
 {
+	EBG_CONTEXT *c = ctx ? ctx : &bgenv_default_ctx;
 	uint32_t minrev = 0xFFFFFFFF;
 	uint32_t min_idx = 0;
 
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		if (envdata[i].revision < minrev) {
-			minrev = envdata[i].revision;
+	for (uint32_t i = 0; i < c->num_parts; i++) {
+		if (c->envdata[i] && c->envdata[i]->revision < minrev) {
+			minrev = c->envdata[i]->revision;
 			min_idx = i;
 		}
 	}
-	return bgenv_open_by_index(min_idx);
+	return bgenv_ctx_open_by_index(ctx, min_idx);
 }
 
-BGENV *bgenv_open_latest(void)
+BGENV *bgenv_ctx_open_latest(EBG_CONTEXT *ctx)
 {
+	EBG_CONTEXT *c = ctx ? ctx : &bgenv_default_ctx;
 	uint32_t maxrev = 0;
 	uint32_t max_idx = 0;
 
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		if (envdata[i].revision > maxrev) {
-			maxrev = envdata[i].revision;
+	for (uint32_t i = 0; i < c->num_parts; i++) {
+		if (c->envdata[i] && c->envdata[i]->revision > maxrev) {
+			maxrev = c->envdata[i]->revision;
 			max_idx = i;
 		}
 	}
-	return bgenv_open_by_index(max_idx);
+	return bgenv_ctx_open_by_index(ctx, max_idx);
+}
+
+BGENV *bgenv_open_by_index(uint32_t index)
+{
+	return bgenv_ctx_open_by_index(NULL, index);
+}
+
+BGENV *bgenv_open_oldest(void)
+{
+	return bgenv_ctx_open_oldest(NULL);
+}
+
+BGENV *bgenv_open_latest(void)
+{
+	return bgenv_ctx_open_latest(NULL);
 }
 
 bool bgenv_write(BGENV *env)
@@ -281,6 +795,9 @@ BG_ENVDATA *bgenv_read(const BGENV *env)
 __attribute((noinline))
 void bgenv_close(BGENV *env)
 {
+	if (env) {
+		bgenv_uservar_index_invalidate(&env->uservar_index);
+	}
 	free(env);
 }
 
@@ -316,6 +833,226 @@ static int bgenv_get_string(uint64_t *type, void *data, const char16_t *srcstr)
 	return 0;
 }
 
+#define ENV_CRC_SIZE(env)                                                      \
+	(ENV_DATA_SIZE((env)->userdata_size) - sizeof(uint32_t))
+
+static void crc_fold_range(BGENV *env, size_t start, size_t end)
+{
+	env->crc.delta ^= bgenv_crc32_delta((uint8_t *)env->data + start,
+					    end - start,
+					    ENV_CRC_SIZE(env) - end);
+}
+
+/*
+ * Must be called before modifying the given bytes of the environment. The
+ * old contents of bytes not yet marked are folded into the CRC delta, the
+ * new ones are folded in by bgenv_crc_update.
+ */
+void bgenv_crc_mark_dirty(BGENV *env, size_t offset, size_t len)
+{
+	BGENV_CRC_STATE *s = &env->crc;
+	BGENV_CRC_RANGE merged[BGENV_CRC_MAX_RANGES];
+	size_t start = offset, end = offset + len;
+	size_t pos = start;
+	uint32_t n = 0;
+	bool inserted = false;
+
+	if (!s->tracking || s->full || len == 0) {
+		return;
+	}
+	if (end > ENV_CRC_SIZE(env)) {
+		s->full = true;
+		return;
+	}
+
+	for (uint32_t i = 0; i < s->num_ranges && pos < end; i++) {
+		BGENV_CRC_RANGE *r = &s->ranges[i];
+
+		if (r->end <= pos) {
+			continue;
+		}
+		if (r->start >= end) {
+			break;
+		}
+		if (r->start > pos) {
+			crc_fold_range(env, pos, r->start);
+		}
+		pos = r->end;
+	}
+	if (pos < end) {
+		crc_fold_range(env, pos, end);
+	}
+
+	/* keep the ranges sorted and disjoint */
+	for (uint32_t i = 0; i < s->num_ranges; i++) {
+		BGENV_CRC_RANGE *r = &s->ranges[i];
+
+		if (r->end < start) {
+			merged[n++] = *r;
+			continue;
+		}
+		if (r->start > end) {
+			if (!inserted) {
+				merged[n].start = start;
+				merged[n++].end = end;
+				inserted = true;
+			}
+			if (n == BGENV_CRC_MAX_RANGES) {
+				s->full = true;
+				return;
+			}
+			merged[n++] = *r;
+			continue;
+		}
+		start = r->start < start ? r->start : start;
+		end = r->end > end ? r->end : end;
+	}
+	if (!inserted) {
+		if (n == BGENV_CRC_MAX_RANGES) {
+			s->full = true;
+			return;
+		}
+		merged[n].start = start;
+		merged[n++].end = end;
+	}
+	memcpy(s->ranges, merged, n * sizeof(BGENV_CRC_RANGE));
+	s->num_ranges = n;
+}
+
+void bgenv_crc_mark_full(BGENV *env)
+{
+	env->crc.full = true;
+}
+
+/* Update the CRC32 of the environment after changes marked before. */
+void bgenv_crc_update(BGENV *env)
+{
+	BGENV_CRC_STATE *s = &env->crc;
+	BG_ENVDATA *data = env->data;
+	uint32_t crc;
+
+	if (!s->tracking || s->full) {
+		crc = bgenv_crc32(0, data, ENV_CRC_SIZE(env));
+	} else {
+		crc = env_data_crc32(data, env->userdata_size) ^ s->delta;
+		for (uint32_t i = 0; i < s->num_ranges; i++) {
+			BGENV_CRC_RANGE *r = &s->ranges[i];
+
+			crc ^= bgenv_crc32_delta((uint8_t *)data + r->start,
+						 r->end - r->start,
+						 ENV_CRC_SIZE(env) - r->end);
+		}
+		if (ebgenv_opts.crc_cross_check) {
+			uint32_t sum = bgenv_crc32(0, data, ENV_CRC_SIZE(env));
+
+			if (sum != crc) {
+				VERBOSE(stderr, "Incremental CRC32 %08x does "
+					"not match %08x!\n", crc, sum);
+				crc = sum;
+			}
+		}
+	}
+	env_data_set_crc32(data, env->userdata_size, crc);
+	memset(s, 0, sizeof(BGENV_CRC_STATE));
+	s->tracking = true;
+}
+
+/*
+ * Mark the bytes of the user variables a bgenv_set_uservar may change:
+ * the record of the variable if it keeps its size, otherwise everything
+ * from the variable up to the end of the (possibly grown) used area. A
+ * compaction may also move everything behind the first deleted record.
+ */
+static void crc_mark_uservar(BGENV *env, const char *key, uint64_t type,
+			     uint32_t datalen)
+{
+	uint8_t *udata = env->data->userdata;
+	size_t base = offsetof(BG_ENVDATA, userdata);
+	uint64_t rsize = (uint64_t)datalen + sizeof(uint64_t) +
+			 sizeof(uint32_t) + strlen(key) + 1;
+	uint32_t used, old_rsize, start;
+	uint64_t end;
+	uint8_t *var;
+
+	used = env->userdata_size -
+	       bgenv_user_free_indexed(&env->uservar_index, udata,
+				       env->userdata_size);
+	var = bgenv_find_uservar_indexed(&env->uservar_index, udata,
+					 env->userdata_size, key);
+	if (var) {
+		bgenv_map_uservar(var, NULL, NULL, NULL, &old_rsize, NULL);
+		start = var - udata;
+		if (old_rsize == rsize && !(type & USERVAR_TYPE_DELETED)) {
+			bgenv_crc_mark_dirty(env, base + start, rsize);
+			return;
+		}
+	} else {
+		start = used;
+	}
+	if (ebgenv_opts.deferred_compaction &&
+	    env->userdata_size - used < rsize + 1) {
+		uint8_t *deleted = bgenv_find_deleted_uservar(udata);
+
+		if (deleted && (uint32_t)(deleted - udata) < start) {
+			start = deleted - udata;
+		}
+	}
+	end = used;
+	if (!(type & USERVAR_TYPE_DELETED)) {
+		/* including the terminating zero */
+		end += rsize + 1;
+	}
+	if (end > env->userdata_size) {
+		end = env->userdata_size;
+	}
+	bgenv_crc_mark_dirty(env, base + start, end - start);
+}
+
+/* Drop user variables left behind by deferred compaction. */
+void bgenv_compact(BGENV *env)
+{
+	uint8_t *udata = env->data->userdata;
+	uint8_t *deleted = bgenv_find_deleted_uservar(udata);
+	uint32_t used;
+
+	if (!deleted) {
+		return;
+	}
+	used = env->userdata_size -
+	       bgenv_user_free_indexed(&env->uservar_index, udata,
+				       env->userdata_size);
+	bgenv_crc_mark_dirty(env,
+			     offsetof(BG_ENVDATA, userdata) + (deleted - udata),
+			     used - (deleted - udata));
+	bgenv_compact_uservars(&env->uservar_index, udata);
+}
+
+/*
+ * Copy the contents of an environment into one that may have a different
+ * layout. Fails if the user variables do not fit.
+ */
+bool bgenv_copy(BGENV *dst, const BGENV *src)
+{
+	uint32_t used;
+
+	if (dst->data == src->data) {
+		return true;
+	}
+	used = src->userdata_size -
+	       bgenv_user_free(src->data->userdata, src->userdata_size);
+	/* the end of the list needs one zero byte */
+	if (used >= dst->userdata_size) {
+		VERBOSE(stderr, "User variables exceed the %u bytes of the "
+				"environment.\n", dst->userdata_size);
+		return false;
+	}
+	bgenv_crc_mark_full(dst);
+	memcpy(dst->data, src->data, ENV_FIXED_SIZE + used);
+	memset(dst->data->userdata + used, 0, dst->userdata_size - used);
+	bgenv_uservar_index_invalidate(&dst->uservar_index);
+	return true;
+}
+
 int bgenv_get(BGENV *env, const char *key, uint64_t *type, void *data,
 	      uint32_t maxlen)
 {
@@ -332,15 +1069,20 @@ int bgenv_get(BGENV *env, const char *key, uint64_t *type, void *data,
 		if (!data) {
 			uint8_t *u;
 			uint32_t size;
-			u = bgenv_find_uservar(env->data->userdata, key);
+			u = bgenv_find_uservar_indexed(&env->uservar_index,
+						       env->data->userdata,
+						       env->userdata_size,
+						       key);
 			if (!u) {
 				return -ENOENT;
 			}
 			bgenv_map_uservar(u, NULL, NULL, NULL, NULL, &size);
 			return size;
 		}
-		return bgenv_get_uservar(env->data->userdata, key, type, data,
-					 maxlen);
+		return bgenv_get_uservar_indexed(&env->uservar_index,
+						 env->data->userdata,
+						 env->userdata_size, key,
+						 type, data, maxlen);
 	}
 	/*
 	 * Callers are not supposed to use bgenv_get via ebg_env_get_ex
@@ -405,12 +1147,15 @@ int bgenv_set(BGENV *env, const char *key, uint64_t type, const void *data,
 	}
 
 	e = bgenv_str2enum(key);
-	if (!env) {
+	if (!env || env->readonly) {
 		return -EPERM;
 	}
 	if (e == EBGENV_UNKNOWN) {
-		return bgenv_set_uservar(env->data->userdata, key, type, data,
-					 datalen);
+		crc_mark_uservar(env, key, type, datalen);
+		return bgenv_set_uservar_indexed(&env->uservar_index,
+						 env->data->userdata,
+						 env->userdata_size, key,
+						 type, data, datalen);
 	}
 	switch (e) {
 	case EBGENV_REVISION:
@@ -418,12 +1163,15 @@ int bgenv_set(BGENV *env, const char *key, uint64_t type, const void *data,
 		if (val < 0) {
 			return -EINVAL;
 		}
+		BGENV_CRC_MARK_FIELD(env, revision);
 		env->data->revision = val;
 		break;
 	case EBGENV_KERNELFILE:
+		BGENV_CRC_MARK_FIELD(env, kernelfile);
 		str8to16(env->data->kernelfile, value);
 		break;
 	case EBGENV_KERNELPARAMS:
+		BGENV_CRC_MARK_FIELD(env, kernelparams);
 		str8to16(env->data->kernelparams, value);
 		break;
 	case EBGENV_WATCHDOG_TIMEOUT_SEC:
@@ -431,6 +1179,7 @@ int bgenv_set(BGENV *env, const char *key, uint64_t type, const void *data,
 		if (val < 0) {
 			return -EINVAL;
 		}
+		BGENV_CRC_MARK_FIELD(env, watchdog_timeout_sec);
 		env->data->watchdog_timeout_sec = val;
 		break;
 	case EBGENV_USTATE:
@@ -438,6 +1187,7 @@ int bgenv_set(BGENV *env, const char *key, uint64_t type, const void *data,
 		if (val < 0) {
 			return -EINVAL;
 		}
+		BGENV_CRC_MARK_FIELD(env, ustate);
 		env->data->ustate = val;
 		break;
 	case EBGENV_IN_PROGRESS:
@@ -445,6 +1195,7 @@ int bgenv_set(BGENV *env, const char *key, uint64_t type, const void *data,
 		if (val < 0) {
 			return -EINVAL;
 		}
+		BGENV_CRC_MARK_FIELD(env, in_progress);
 		env->data->in_progress = val;
 		break;
 	default:
@@ -453,19 +1204,83 @@ int bgenv_set(BGENV *env, const char *key, uint64_t type, const void *data,
 	return 0;
 }
 
+static void crc_mark_userdata(void *ctx, uint32_t offset, uint32_t len)
+{
+	bgenv_crc_mark_dirty(ctx, offsetof(BG_ENVDATA, userdata) + offset,
+			     len);
+}
+
+int bgenv_set_many(BGENV *env, const ebg_kv_t *kvs, size_t count)
+{
+	uint8_t header[offsetof(BG_ENVDATA, userdata)];
+	ebg_kv_t *uservars;
+	size_t num_uservars = 0;
+	int res = 0;
+
+	if (!env || env->readonly) {
+		return -EPERM;
+	}
+	if (!kvs && count) {
+		return -EINVAL;
+	}
+	if (count == 0) {
+		return 0;
+	}
+	uservars = malloc(count * sizeof(ebg_kv_t));
+	if (!uservars) {
+		return -ENOMEM;
+	}
+
+	/* pre-defined variables are stored in place, user variables batched */
+	memcpy(header, env->data, sizeof(header));
+	for (size_t n = 0; n < count; n++) {
+		if (!kvs[n].key) {
+			res = -EINVAL;
+			goto restore;
+		}
+		if (bgenv_str2enum(kvs[n].key) == EBGENV_UNKNOWN) {
+			uservars[num_uservars++] = kvs[n];
+			continue;
+		}
+		res = bgenv_set(env, kvs[n].key, kvs[n].type, kvs[n].value,
+				kvs[n].datalen);
+		if (res) {
+			goto restore;
+		}
+	}
+	res = bgenv_set_uservars_many(&env->uservar_index,
+				      env->data->userdata, env->userdata_size,
+				      uservars, num_uservars,
+				      crc_mark_userdata, env);
+	if (res == 0) {
+		free(uservars);
+		return 0;
+	}
+
+restore:
+	memcpy(env->data, header, sizeof(header));
+	free(uservars);
+	return res;
+}
+
 BGENV *bgenv_create_new(void)
+{
+	return bgenv_ctx_create_new(NULL);
+}
+
+BGENV *bgenv_ctx_create_new(EBG_CONTEXT *ctx)
 {
 	BGENV *env_latest;
 	BGENV *env_new;
 
-	env_latest = bgenv_open_latest();
+	env_latest = bgenv_ctx_open_latest(ctx);
 	if (!env_latest) {
 		goto create_new_io_error;
 	}
 
 	int new_rev = env_latest->data->revision + 1;
 
-	env_new = bgenv_open_oldest();
+	env_new = bgenv_ctx_open_oldest(ctx);
 	if (!env_new) {
 		bgenv_close(env_latest);
 		goto create_new_io_error;
@@ -473,12 +1288,15 @@ BGENV *bgenv_create_new(void)
 
 	if (env_latest->data != env_new->data) {
 		/* zero fields */
-		memset(env_new->data, 0, sizeof(BG_ENVDATA));
+		bgenv_crc_mark_full(env_new);
+		memset(env_new->data, 0, ENV_CRC_SIZE(env_new));
 		/* set default watchdog timeout */
 		env_new->data->watchdog_timeout_sec = DEFAULT_TIMEOUT_SEC;
 	}
 	bgenv_close(env_latest);
 	/* update revision field and testing mode */
+	BGENV_CRC_MARK_FIELD(env_new, revision);
+	BGENV_CRC_MARK_FIELD(env_new, in_progress);
 	env_new->data->revision = new_rev;
 	env_new->data->in_progress = 1;
 
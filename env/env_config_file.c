@@ -12,12 +12,14 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "env_api.h"
 #include "env_disk_utils.h"
 #include "env_config_file.h"
+#include "fat.h"
 
 FILE *open_config_file(const char *configfilepath, const char *mode)
 {
@@ -54,9 +56,31 @@ bool probe_config_file(CONFIG_PART *cfgpart)
 	printf_debug("Checking device: %s\n", cfgpart->devpath);
 	if (!(cfgpart->mountpoint = get_mountpoint(cfgpart->devpath))) {
 		/* partition is not mounted */
+		struct fat_file file;
+		int ret;
+
 		cfgpart->not_mounted = true;
 		VERBOSE(stdout, "Partition %s is not mounted.\n",
 			cfgpart->devpath);
+
+		/*
+		 * Look for the file directly on the device, mounting is only
+		 * needed if the filesystem cannot be handled that way.
+		 */
+		ret = fat_file_open(cfgpart->devpath, FAT_ENV_FILENAME, false,
+				    &file, ebgenv_opts.verbose);
+		if (ret == 0) {
+			fat_file_close(&file);
+			return true;
+		}
+		if (ret != -EINVAL) {
+			printf_debug("Could not open config file on partition "
+				     "%s (%s).\n", cfgpart->devpath,
+				     strerror(-ret));
+			return false;
+		}
+		VERBOSE(stdout, "Cannot access %s directly, mounting it.\n",
+			cfgpart->devpath);
 		if (!mount_partition(cfgpart)) {
 			return false;
 		}
@@ -13,15 +13,19 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include <pthread.h>
+
 #include "env_api.h"
 #include "ebgpart.h"
 #include "env_config_partitions.h"
 #include "env_config_file.h"
+#include "env_probe_cache.h"
 
 #define LOADER_PROT_VENDOR_GUID "4a67b082-0a4c-41cf-b6c7-440b29bb8c4f"
 #define GUID_LEN_CHARS		36
 #define EFI_ATTR_LEN_IN_WCHAR	2
 #define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+#define MAX_PROBE_WORKERS	8
 
 /**
  * Read the ESP UUID from the efivars. This only works if the bootloader
@@ -90,17 +94,119 @@ static char *get_rootdev_from_efi(void)
 	return blockdev;
 }
 
-bool probe_config_partitions(CONFIG_PART *cfgpart, bool search_all_devices)
+/*
+ * Candidate partitions are collected first and then probed for the
+ * environment file. Probing involves mounting and can be done concurrently
+ * by a bounded number of workers. Results are stored per candidate, so the
+ * order of the found config partitions does not depend on the scheduling.
+ */
+typedef struct {
+	CONFIG_PART part;
+	char *diskpath;
+	char uuid[37];
+	bool found;
+} PROBE_CANDIDATE;
+
+typedef struct {
+	PROBE_CANDIDATE *cands;
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int next;
+} PROBE_JOBS;
+
+static void *probe_worker(void *arg)
+{
+	PROBE_JOBS *jobs = arg;
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) <
+	       jobs->count) {
+		jobs->cands[i].found = probe_config_file(&jobs->cands[i].part);
+	}
+	return NULL;
+}
+
+static void probe_candidates(PROBE_JOBS *jobs, bool parallel)
+{
+	pthread_t workers[MAX_PROBE_WORKERS];
+	unsigned int num_workers = 0;
+	long num_cpus;
+
+	if (parallel && jobs->count > 1) {
+		num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		/* probing mostly waits for I/O, allow some oversubscription */
+		num_workers = num_cpus > 0 ? 2 * num_cpus : 1;
+		if (num_workers > MAX_PROBE_WORKERS) {
+			num_workers = MAX_PROBE_WORKERS;
+		}
+		if (num_workers > jobs->count) {
+			num_workers = jobs->count;
+		}
+	}
+	for (unsigned int n = 0; n < num_workers; n++) {
+		if (pthread_create(&workers[n], NULL, probe_worker, jobs)) {
+			VERBOSE(stderr, "Could not start probe worker.\n");
+			num_workers = n;
+			break;
+		}
+	}
+	/* the calling thread helps out, and does all work if alone */
+	probe_worker(jobs);
+	for (unsigned int n = 0; n < num_workers; n++) {
+		pthread_join(workers[n], NULL);
+	}
+}
+
+static bool add_candidate(PROBE_JOBS *jobs, const char *devpath,
+			  const PedDevice *dev, const PedPartition *part)
+{
+	PROBE_CANDIDATE *cand;
+
+	if (jobs->count == jobs->capacity) {
+		unsigned int new_capacity =
+		    jobs->capacity ? 2 * jobs->capacity : 8;
+
+		cand = realloc(jobs->cands, new_capacity * sizeof(*cand));
+		if (!cand) {
+			return false;
+		}
+		jobs->cands = cand;
+		jobs->capacity = new_capacity;
+	}
+	cand = &jobs->cands[jobs->count];
+	memset(cand, 0, sizeof(*cand));
+	cand->part.devpath = strdup(devpath);
+	cand->diskpath = strdup(dev->path);
+	if (!cand->part.devpath || !cand->diskpath) {
+		free(cand->part.devpath);
+		free(cand->diskpath);
+		return false;
+	}
+	memcpy(cand->uuid, part->uuid, sizeof(cand->uuid));
+	jobs->count++;
+	return true;
+}
+
+bool probe_config_partitions(CONFIG_PART *cfgpart, uint32_t *count,
+			     bool search_all_devices)
 {
+	PROBE_CACHE_ENTRY cache_entries[ENV_V2_MAX_CONFIG_PARTS];
 	const PedDevice *dev = NULL;
+	PROBE_JOBS jobs = {0};
 	char devpath[4096];
 	char *rootdev = NULL;
-	int count = 0;
+	bool result = false;
+	uint32_t found = 0;
 
-	if (!cfgpart) {
+	if (!cfgpart || !count) {
 		return false;
 	}
 
+	if (ebgenv_opts.probe_cache &&
+	    probe_cache_load(cfgpart, count, search_all_devices)) {
+		return true;
+	}
+
 	if (!search_all_devices) {
 		if (!(rootdev = get_rootdev_from_efi())) {
 			VERBOSE(stderr, "Warning, could not determine root "
@@ -127,10 +233,14 @@ bool probe_config_partitions(CONFIG_PART *cfgpart, bool search_all_devices)
 				part = ped_disk_next_partition(pd, part);
 				continue;
 			}
-			if (strncmp("/dev/mmcblk", dev->path, 11) == 0 ||
-			    strncmp("/dev/loop", dev->path, 9) == 0 ||
-			    strncmp("/dev/nvme", dev->path, 9) == 0 ||
-			    strncmp("/dev/md", dev->path, 7) == 0) {
+			if (part->path) {
+				/* node name as reported by the kernel */
+				(void)snprintf(devpath, 4096, "%s",
+					       part->path);
+			} else if (strncmp("/dev/mmcblk", dev->path, 11) == 0 ||
+				   strncmp("/dev/loop", dev->path, 9) == 0 ||
+				   strncmp("/dev/nvme", dev->path, 9) == 0 ||
+				   strncmp("/dev/md", dev->path, 7) == 0) {
 				(void)snprintf(devpath, 4096, "%sp%u",
 					       dev->path, part->num);
 			} else {
@@ -138,37 +248,62 @@ bool probe_config_partitions(CONFIG_PART *cfgpart, bool search_all_devices)
 					       dev->path, part->num);
 			}
 
-			CONFIG_PART tmp = {.devpath = strdup(devpath)};
-			if (!tmp.devpath) {
+			if (!add_candidate(&jobs, devpath, dev, part)) {
 				VERBOSE(stderr, "Out of memory.");
-				return false;
-			}
-			if (probe_config_file(&tmp)) {
-				printf_debug("%s", "Environment file found.\n");
-				if (count < ENV_NUM_CONFIG_PARTS) {
-					cfgpart[count] = tmp;
-				} else {
-					free(tmp.devpath);
-					free(tmp.mountpoint);
-					VERBOSE(stderr,
-						"Error, there are "
-						"more than %d config "
-						"partitions.\n",
-						ENV_NUM_CONFIG_PARTS);
-					return false;
-				}
-				count++;
-			} else {
-				free(tmp.devpath);
+				goto out;
 			}
 			part = ped_disk_next_partition(pd, part);
 		}
 	}
-	if (count < ENV_NUM_CONFIG_PARTS) {
-		VERBOSE(stderr,
-			"Error, less than %d config partitions exist.\n",
-			ENV_NUM_CONFIG_PARTS);
-		return false;
+
+	probe_candidates(&jobs, ebgenv_opts.parallel_probe);
+
+	for (unsigned int i = 0; i < jobs.count; i++) {
+		PROBE_CANDIDATE *cand = &jobs.cands[i];
+
+		if (!cand->found) {
+			continue;
+		}
+		printf_debug("%s", "Environment file found.\n");
+		if (found >= ENV_V2_MAX_CONFIG_PARTS) {
+			VERBOSE(stderr,
+				"Error, there are more than %d config "
+				"partitions.\n",
+				ENV_V2_MAX_CONFIG_PARTS);
+			goto out;
+		}
+		cache_entries[found].devpath = cand->part.devpath;
+		cache_entries[found].diskpath = cand->diskpath;
+		cache_entries[found].uuid = cand->uuid;
+		cfgpart[found++] = cand->part;
+		cand->part.devpath = NULL;
+		cand->part.mountpoint = NULL;
 	}
-	return true;
+	if (found == 0) {
+		VERBOSE(stderr, "Error, no config partitions exist.\n");
+		goto out;
+	}
+	if (ebgenv_opts.probe_cache) {
+		probe_cache_store(cache_entries, found, search_all_devices);
+	}
+	*count = found;
+	result = true;
+
+out:
+	if (!result) {
+		/* the partitions taken over so far */
+		for (uint32_t i = 0; i < found; i++) {
+			free(cfgpart[i].devpath);
+			cfgpart[i].devpath = NULL;
+			free(cfgpart[i].mountpoint);
+			cfgpart[i].mountpoint = NULL;
+		}
+	}
+	for (unsigned int i = 0; i < jobs.count; i++) {
+		free(jobs.cands[i].part.devpath);
+		free(jobs.cands[i].part.mountpoint);
+		free(jobs.cands[i].diskpath);
+	}
+	free(jobs.cands);
+	return result;
 }
@@ -13,17 +13,309 @@
  */
 
 #include <mntent.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include "env_api.h"
 #include "env_disk_utils.h"
+#include "env_hash.h"
 
 const char *tmp_mnt_dir = "/tmp/mnt-XXXXXX";
 
-char *get_mountpoint(const char *devpath)
+/* what glibc uses for the static buffer of getmntent */
+#define MNTENT_BUF_SIZE 4096
+
+/*
+ * Snapshot of the mount table, parsed once and then looked up by device
+ * name and by device number. The latter also matches entries that refer
+ * to the device via a different (e.g. symlinked) name. The kernel signals
+ * changes of the mount table via POLLPRI on the mountinfo file, in which
+ * case the snapshot is parsed again on the next lookup.
+ */
+typedef struct {
+	char *fsname;
+	char *dir;
+	dev_t dev;
+	bool is_root;
+} MOUNT_ENTRY;
+
+typedef struct {
+	FILE *mtab;
+	MOUNT_ENTRY *entries;
+	uint32_t num_entries;
+	uint32_t *by_name;
+	uint32_t *by_dev;
+	uint32_t num_slots;
+	bool loaded;
+	/* library contexts sharing the snapshot */
+	uint32_t users;
+} MOUNT_TABLE;
+
+static MOUNT_TABLE mount_table;
+static pthread_mutex_t mount_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t mount_hash_dev(dev_t dev)
+{
+	uint64_t v = (uint64_t)dev * 0x9e3779b97f4a7c15ULL;
+
+	return (uint32_t)(v >> 32);
+}
+
+/* mountinfo escapes blanks, tabs, newlines and backslashes as \ooo */
+static void mount_unescape(char *s)
+{
+	char *d = s;
+
+	while (*s) {
+		if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+		    s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+			*d++ = (char)(((s[1] - '0') << 6) | ((s[2] - '0') << 3) |
+				      (s[3] - '0'));
+			s += 4;
+		} else {
+			*d++ = *s++;
+		}
+	}
+	*d = 0;
+}
+
+/*
+ * Parse a line of /proc/self/mountinfo, see proc(5):
+ * id parent major:minor root mountpoint options [optional...] - type source
+ */
+static bool mount_parse_line(char *line, MOUNT_ENTRY *entry)
+{
+	char *fields[5];
+	char *saveptr = NULL;
+	char *tok;
+	unsigned int major, minor;
+	int i = 0;
+
+	for (tok = strtok_r(line, " \n", &saveptr); tok && i < 5;
+	     tok = strtok_r(NULL, " \n", &saveptr)) {
+		fields[i++] = tok;
+	}
+	if (i < 5 || sscanf(fields[2], "%u:%u", &major, &minor) != 2) {
+		return false;
+	}
+	/* skip options and optional fields up to the separator */
+	while ((tok = strtok_r(NULL, " \n", &saveptr)) && strcmp(tok, "-")) {
+	}
+	/* file system type, then source */
+	if (!tok || !strtok_r(NULL, " \n", &saveptr) ||
+	    !(tok = strtok_r(NULL, " \n", &saveptr))) {
+		return false;
+	}
+	mount_unescape(fields[4]);
+	mount_unescape(tok);
+	entry->fsname = strdup(tok);
+	entry->dir = strdup(fields[4]);
+	entry->dev = makedev(major, minor);
+	entry->is_root = strcmp(fields[3], "/") == 0;
+	if (!entry->fsname || !entry->dir) {
+		free(entry->fsname);
+		free(entry->dir);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Entries mounted at the root of the file system are preferred over bind
+ * mounts of subdirectories, otherwise the first entry wins.
+ */
+static void mount_index_insert(uint32_t *slots, uint32_t pos, uint32_t idx,
+			       bool (*same)(const MOUNT_ENTRY *,
+					    const MOUNT_ENTRY *))
+{
+	const MOUNT_ENTRY *entry = &mount_table.entries[idx];
+	uint32_t mask = mount_table.num_slots - 1;
+
+	for (pos &= mask; slots[pos]; pos = (pos + 1) & mask) {
+		const MOUNT_ENTRY *other = &mount_table.entries[slots[pos] - 1];
+		if (same(entry, other)) {
+			if (entry->is_root && !other->is_root) {
+				slots[pos] = idx + 1;
+			}
+			return;
+		}
+	}
+	slots[pos] = idx + 1;
+}
+
+static bool mount_same_name(const MOUNT_ENTRY *a, const MOUNT_ENTRY *b)
+{
+	return strcmp(a->fsname, b->fsname) == 0;
+}
+
+static bool mount_same_dev(const MOUNT_ENTRY *a, const MOUNT_ENTRY *b)
+{
+	return a->dev == b->dev;
+}
+
+static void mount_table_clear(void)
+{
+	for (uint32_t i = 0; i < mount_table.num_entries; i++) {
+		free(mount_table.entries[i].fsname);
+		free(mount_table.entries[i].dir);
+	}
+	free(mount_table.entries);
+	free(mount_table.by_name);
+	free(mount_table.by_dev);
+	mount_table.entries = NULL;
+	mount_table.num_entries = 0;
+	mount_table.by_name = NULL;
+	mount_table.by_dev = NULL;
+	mount_table.num_slots = 0;
+	mount_table.loaded = false;
+}
+
+static bool mount_table_parse(void)
+{
+	struct pollfd pfd = {.fd = fileno(mount_table.mtab),
+			     .events = POLLPRI};
+	uint32_t capacity = 0;
+	char *line = NULL;
+	size_t len = 0;
+
+	mount_table_clear();
+
+	/* reset the change notification before reading */
+	(void)poll(&pfd, 1, 0);
+	rewind(mount_table.mtab);
+
+	while (getline(&line, &len, mount_table.mtab) != -1) {
+		if (mount_table.num_entries == capacity) {
+			uint32_t new_capacity = capacity ? 2 * capacity : 64;
+			MOUNT_ENTRY *entries;
+
+			entries = realloc(mount_table.entries,
+					  new_capacity * sizeof(*entries));
+			if (!entries) {
+				goto error;
+			}
+			mount_table.entries = entries;
+			capacity = new_capacity;
+		}
+		if (mount_parse_line(
+			line, &mount_table.entries[mount_table.num_entries])) {
+			mount_table.num_entries++;
+		}
+	}
+	free(line);
+	line = NULL;
+
+	mount_table.num_slots = 64;
+	while (mount_table.num_slots < 2 * mount_table.num_entries) {
+		mount_table.num_slots *= 2;
+	}
+	mount_table.by_name = calloc(mount_table.num_slots, sizeof(uint32_t));
+	mount_table.by_dev = calloc(mount_table.num_slots, sizeof(uint32_t));
+	if (!mount_table.by_name || !mount_table.by_dev) {
+		goto error;
+	}
+	for (uint32_t i = 0; i < mount_table.num_entries; i++) {
+		const MOUNT_ENTRY *entry = &mount_table.entries[i];
+
+		mount_index_insert(mount_table.by_name,
+				   env_hash_str(entry->fsname), i,
+				   mount_same_name);
+		/* anonymous devices of virtual file systems are not unique */
+		if (major(entry->dev) != 0) {
+			mount_index_insert(mount_table.by_dev,
+					   mount_hash_dev(entry->dev), i,
+					   mount_same_dev);
+		}
+	}
+	mount_table.loaded = true;
+	VERBOSE(stdout, "Loaded %u mount table entries.\n",
+		mount_table.num_entries);
+	return true;
+
+error:
+	free(line);
+	mount_table_clear();
+	VERBOSE(stderr, "Error, out of memory.\n");
+	return false;
+}
+
+static bool mount_table_changed(void)
+{
+	struct pollfd pfd = {.fd = fileno(mount_table.mtab),
+			     .events = POLLPRI};
+
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR));
+}
+
+static const MOUNT_ENTRY *mount_table_lookup(const char *devpath)
+{
+	uint32_t mask = mount_table.num_slots - 1;
+	struct stat st;
+	uint32_t pos;
+
+	pos = env_hash_str(devpath) & mask;
+	for (; mount_table.by_name[pos]; pos = (pos + 1) & mask) {
+		const MOUNT_ENTRY *entry =
+		    &mount_table.entries[mount_table.by_name[pos] - 1];
+		if (strcmp(entry->fsname, devpath) == 0) {
+			return entry;
+		}
+	}
+
+	if (stat(devpath, &st) || !S_ISBLK(st.st_mode)) {
+		return NULL;
+	}
+	pos = mount_hash_dev(st.st_rdev) & mask;
+	for (; mount_table.by_dev[pos]; pos = (pos + 1) & mask) {
+		const MOUNT_ENTRY *entry =
+		    &mount_table.entries[mount_table.by_dev[pos] - 1];
+		if (entry->dev == st.st_rdev) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+bool mount_table_load(void)
+{
+	bool result;
+
+	pthread_mutex_lock(&mount_table_lock);
+	mount_table.users++;
+	if (!mount_table.mtab) {
+		mount_table.mtab = fopen("/proc/self/mountinfo", "re");
+	}
+	result = mount_table.mtab && mount_table_parse();
+	pthread_mutex_unlock(&mount_table_lock);
+
+	return result;
+}
+
+void mount_table_free(void)
+{
+	pthread_mutex_lock(&mount_table_lock);
+	if (mount_table.users > 0 && --mount_table.users > 0) {
+		pthread_mutex_unlock(&mount_table_lock);
+		return;
+	}
+	mount_table_clear();
+	if (mount_table.mtab) {
+		fclose(mount_table.mtab);
+		mount_table.mtab = NULL;
+	}
+	pthread_mutex_unlock(&mount_table_lock);
+}
+
+/* Probe workers end up here concurrently, so keep the entries local. */
+static char *get_mountpoint_from_mtab(const char *devpath)
 {
 	const struct mntent *part;
+	struct mntent entry;
+	char buf[MNTENT_BUF_SIZE];
 	char *mntpoint = NULL;
 	FILE *mtab;
 
@@ -32,7 +324,7 @@ char *get_mountpoint(const char *devpath)
 		return NULL;
 	}
 
-	while ((part = getmntent(mtab)) != NULL) {
+	while ((part = getmntent_r(mtab, &entry, buf, sizeof(buf))) != NULL) {
 		if ((part->mnt_fsname != NULL) &&
 		    (strcmp(part->mnt_fsname, devpath)) == 0) {
 			mntpoint = strdup(part->mnt_dir);
@@ -44,6 +336,28 @@ char *get_mountpoint(const char *devpath)
 	return mntpoint;
 }
 
+char *get_mountpoint(const char *devpath)
+{
+	const MOUNT_ENTRY *entry;
+	char *mntpoint = NULL;
+
+	pthread_mutex_lock(&mount_table_lock);
+	if (!mount_table.mtab ||
+	    (!(mount_table.loaded && !mount_table_changed()) &&
+	     !mount_table_parse())) {
+		pthread_mutex_unlock(&mount_table_lock);
+		/* no snapshot available, scan the mount table directly */
+		return get_mountpoint_from_mtab(devpath);
+	}
+	entry = mount_table_lookup(devpath);
+	if (entry) {
+		mntpoint = strdup(entry->dir);
+	}
+	pthread_mutex_unlock(&mount_table_lock);
+
+	return mntpoint;
+}
+
 bool mount_partition(CONFIG_PART *cfgpart)
 {
 	char tmpdir_template[256];
@@ -59,7 +373,9 @@ bool mount_partition(CONFIG_PART *cfgpart)
 		VERBOSE(stderr, "Error creating temporary mount point.\n");
 		return false;
 	}
-	if (mount(cfgpart->devpath, mountpoint, "vfat", MS_SYNCHRONOUS, NULL)) {
+	/* in-place writes sync explicitly, avoid synchronous FAT updates */
+	unsigned long flags = ebgenv_opts.inplace_write ? 0 : MS_SYNCHRONOUS;
+	if (mount(cfgpart->devpath, mountpoint, "vfat", flags, NULL)) {
 		VERBOSE(stderr, "Error mounting to temporary mount point.\n");
 		if (rmdir(tmpdir_template)) {
 			VERBOSE(stderr,
@@ -0,0 +1,224 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include "env_api.h"
+#include "env_api_crc32.h"
+#include "env_layout.h"
+
+static bool all_zero(const uint8_t *buf, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		if (buf[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_header(const BG_ENVHDR *hdr)
+{
+	if (hdr->header_size < ENV_V2_BASE_HEADER_SIZE ||
+	    hdr->header_size > ENV_V2_MAX_HEADER_SIZE) {
+		VERBOSE(stderr, "Invalid environment header size %u\n",
+			hdr->header_size);
+		return false;
+	}
+	if (hdr->num_config_parts < 1 ||
+	    hdr->num_config_parts > ENV_V2_MAX_CONFIG_PARTS) {
+		VERBOSE(stderr, "Invalid number of config partitions %u\n",
+			hdr->num_config_parts);
+		return false;
+	}
+	if (hdr->userdata_size < ENV_V2_MIN_USERVARS ||
+	    hdr->userdata_size > ENV_V2_MAX_USERVARS) {
+		VERBOSE(stderr, "Invalid user variable size %u\n",
+			hdr->userdata_size);
+		return false;
+	}
+	return true;
+}
+
+/* CRC32 of header and fixed members, with fixed_crc32 taken as zero */
+static uint32_t fixed_crc32(const uint8_t *buf, size_t header_size)
+{
+	BG_ENVHDR hdr;
+	uint32_t crc32;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	hdr.fixed_crc32 = 0;
+	crc32 = bgenv_crc32(0, &hdr, sizeof(hdr));
+	return bgenv_crc32(crc32, buf + sizeof(hdr),
+			   header_size - sizeof(hdr) + ENV_FIXED_SIZE);
+}
+
+size_t env_layout_file_size(const ENV_LAYOUT *layout)
+{
+	if (layout->version == ENV_LAYOUT_LEGACY) {
+		return sizeof(BG_ENVDATA);
+	}
+	return ENV_V2_FILE_SIZE(sizeof(BG_ENVHDR), layout->userdata_size);
+}
+
+uint32_t env_layout_userdata_size(const ENV_LAYOUT *layout)
+{
+	if (layout->version == ENV_LAYOUT_LEGACY) {
+		return ENV_MEM_USERVARS;
+	}
+	return layout->userdata_size;
+}
+
+BG_ENVDATA *env_layout_read(env_pread_fn read_fn, void *ctx,
+			    ENV_LAYOUT *layout)
+{
+	BG_ENVDATA *env = NULL;
+	BG_ENVHDR hdr;
+	uint32_t crc32;
+	uint8_t *buf;
+	size_t size;
+
+	if (read_fn(ctx, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, ENV_V2_MAGIC, ENV_V2_MAGIC_LEN) != 0) {
+		memset(layout, 0, sizeof(*layout));
+		env = malloc(sizeof(BG_ENVDATA));
+		if (env && read_fn(ctx, env, sizeof(BG_ENVDATA), 0) !=
+				   sizeof(BG_ENVDATA)) {
+			free(env);
+			env = NULL;
+		}
+		return env;
+	}
+	if (!check_header(&hdr)) {
+		return NULL;
+	}
+
+	size = ENV_V2_FILE_SIZE(hdr.header_size, hdr.userdata_size);
+	buf = malloc(size);
+	if (!buf) {
+		return NULL;
+	}
+	if (read_fn(ctx, buf, size, 0) != (ssize_t)size) {
+		VERBOSE(stderr, "Environment file is truncated.\n");
+		goto out;
+	}
+	memcpy(&crc32, buf + size - sizeof(crc32), sizeof(crc32));
+	if (bgenv_crc32(0, buf, size - sizeof(crc32)) != crc32) {
+		VERBOSE(stderr, "Invalid CRC32!\n");
+		goto out;
+	}
+	if (hdr.header_size >= sizeof(BG_ENVHDR) &&
+	    fixed_crc32(buf, hdr.header_size) != hdr.fixed_crc32) {
+		VERBOSE(stderr, "Invalid CRC32 of the fixed header!\n");
+		goto out;
+	}
+
+	/* the environment in memory is the file without its header */
+	size = ENV_DATA_SIZE(hdr.userdata_size) - sizeof(crc32);
+	memmove(buf, buf + hdr.header_size, size);
+	env = (BG_ENVDATA *)buf;
+	buf = NULL;
+	env_data_set_crc32(env, hdr.userdata_size, bgenv_crc32(0, env, size));
+
+	layout->version = ENV_LAYOUT_V2;
+	layout->num_config_parts = hdr.num_config_parts;
+	layout->userdata_size = hdr.userdata_size;
+out:
+	free(buf);
+	return env;
+}
+
+uint8_t *env_layout_encode(const BG_ENVDATA *env, uint32_t userdata_size,
+			   const ENV_LAYOUT *layout, size_t *size)
+{
+	uint32_t file_userdata_size = env_layout_userdata_size(layout);
+	BG_ENVHDR hdr = {
+		.header_size = sizeof(BG_ENVHDR),
+		.num_config_parts = layout->num_config_parts,
+		.userdata_size = layout->userdata_size,
+	};
+	size_t header_size = 0;
+	uint32_t crc32;
+	uint8_t *buf;
+
+	*size = env_layout_file_size(layout);
+	if (layout->version == ENV_LAYOUT_LEGACY &&
+	    userdata_size == ENV_MEM_USERVARS) {
+		/* the environment in memory already is the file */
+		buf = malloc(*size);
+		if (buf) {
+			memcpy(buf, env, *size);
+		}
+		return buf;
+	}
+
+	if (file_userdata_size < userdata_size &&
+	    !all_zero(env->userdata + file_userdata_size,
+		      userdata_size - file_userdata_size)) {
+		VERBOSE(stderr,
+			"User variables exceed the %u bytes of the "
+			"environment file.\n",
+			file_userdata_size);
+		return NULL;
+	}
+	buf = calloc(1, *size);
+	if (!buf) {
+		return NULL;
+	}
+	if (layout->version != ENV_LAYOUT_LEGACY) {
+		header_size = sizeof(hdr);
+		memcpy(hdr.magic, ENV_V2_MAGIC, ENV_V2_MAGIC_LEN);
+	}
+	memcpy(buf + header_size, env, ENV_FIXED_SIZE);
+	memcpy(buf + header_size + ENV_FIXED_SIZE, env->userdata,
+	       file_userdata_size < userdata_size ? file_userdata_size
+						  : userdata_size);
+	if (header_size) {
+		memcpy(buf, &hdr, sizeof(hdr));
+		hdr.fixed_crc32 = fixed_crc32(buf, sizeof(hdr));
+		memcpy(buf, &hdr, sizeof(hdr));
+	}
+	crc32 = bgenv_crc32(0, buf, *size - sizeof(crc32));
+	memcpy(buf + *size - sizeof(crc32), &crc32, sizeof(crc32));
+	return buf;
+}
+
+uint32_t env_data_crc32(const BG_ENVDATA *env, uint32_t userdata_size)
+{
+	uint32_t crc32;
+
+	memcpy(&crc32, (const uint8_t *)env + ENV_FIXED_SIZE + userdata_size,
+	       sizeof(crc32));
+	return crc32;
+}
+
+void env_data_set_crc32(BG_ENVDATA *env, uint32_t userdata_size,
+			uint32_t crc32)
+{
+	memcpy((uint8_t *)env + ENV_FIXED_SIZE + userdata_size, &crc32,
+	       sizeof(crc32));
+}
+
+BG_ENVDATA *env_data_alloc(uint32_t userdata_size)
+{
+	size_t size = ENV_DATA_SIZE(userdata_size) - sizeof(uint32_t);
+	BG_ENVDATA *env = calloc(1, ENV_DATA_SIZE(userdata_size));
+
+	if (env) {
+		env_data_set_crc32(env, userdata_size,
+				   bgenv_crc32(0, env, size));
+	}
+	return env;
+}
+
+ssize_t env_layout_fd_pread(void *ctx, void *buf, size_t count,
+			    off64_t offset)
+{
+	return pread64(*(int *)ctx, buf, count, offset);
+}
@@ -0,0 +1,189 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ *
+ *
+ * Persistent cache of the config partitions found by
+ * probe_config_partitions. Each partition is recorded with its node, its
+ * device number, its PARTUUID and an identifier of the partition table of
+ * its disk. An entry is only trusted if the node still refers to the same
+ * device and the partition table is unchanged, which costs one stat per
+ * partition and one read of the table header per disk.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "env_api.h"
+#include "env_disk_utils.h"
+#include "env_probe_cache.h"
+#include "ebgpart.h"
+
+#define PROBE_CACHE_MAGIC "efibootguard-probe-cache 2"
+#define PROBE_CACHE_ID_LEN 64
+
+const char *probe_cache_file = PROBE_CACHE_FILE;
+
+/* whether the last probe result was taken from the cache */
+static bool cache_used;
+
+static bool valid_token(const char *s)
+{
+	return s && *s && strlen(s) < 4096 && !strpbrk(s, " \t\n");
+}
+
+bool probe_cache_load(CONFIG_PART *cfgpart, uint32_t *num_parts,
+		      bool search_all_devices)
+{
+	char devpath[4096], diskpath[4096], uuid[64];
+	char disk_id[PROBE_CACHE_ID_LEN], cur_id[PROBE_CACHE_ID_LEN];
+	char verified_disk[4096] = "";
+	unsigned int fmajor, fminor;
+	char line[256];
+	unsigned int total;
+	int all, count = 0;
+	struct stat st;
+	FILE *f;
+
+	cache_used = false;
+	f = fopen(probe_cache_file, "re");
+	if (!f) {
+		return false;
+	}
+	if (!fgets(line, sizeof(line), f) ||
+	    strncmp(line, PROBE_CACHE_MAGIC, strlen(PROBE_CACHE_MAGIC)) != 0 ||
+	    fscanf(f, " all=%d count=%u", &all, &total) != 2 ||
+	    all != search_all_devices) {
+		VERBOSE(stdout, "Probe cache does not match, ignoring it.\n");
+		goto fail;
+	}
+	if (total < 1 || total > ENV_V2_MAX_CONFIG_PARTS) {
+		VERBOSE(stderr, "Probe cache is corrupt.\n");
+		goto fail;
+	}
+	for (count = 0; count < (int)total; count++) {
+		if (fscanf(f, " %4095s %u:%u %63s %4095s %63s", devpath,
+			   &fmajor, &fminor, uuid, diskpath, disk_id) != 6) {
+			VERBOSE(stderr, "Probe cache is corrupt.\n");
+			goto fail;
+		}
+		if (stat(devpath, &st) ||
+		    st.st_rdev != makedev(fmajor, fminor)) {
+			VERBOSE(stdout, "Probe cache: %s has changed.\n",
+				devpath);
+			goto fail;
+		}
+		/* partitions usually share a disk, check its table once */
+		if (strcmp(diskpath, verified_disk) != 0) {
+			if (!ebgpart_read_disk_id(diskpath, cur_id,
+						  sizeof(cur_id)) ||
+			    strcmp(cur_id, disk_id) != 0) {
+				VERBOSE(stdout,
+					"Probe cache: partition table of %s "
+					"has changed.\n",
+					diskpath);
+				goto fail;
+			}
+			strcpy(verified_disk, diskpath);
+		}
+		memset(&cfgpart[count], 0, sizeof(CONFIG_PART));
+		cfgpart[count].devpath = strdup(devpath);
+		if (!cfgpart[count].devpath) {
+			goto fail;
+		}
+		cfgpart[count].mountpoint = get_mountpoint(devpath);
+		cfgpart[count].not_mounted = !cfgpart[count].mountpoint;
+		VERBOSE(stdout, "Probe cache: config partition %s (%s).\n",
+			devpath, uuid);
+	}
+	fclose(f);
+	*num_parts = total;
+	cache_used = true;
+	return true;
+
+fail:
+	fclose(f);
+	for (int i = 0; i < count; i++) {
+		free(cfgpart[i].devpath);
+		cfgpart[i].devpath = NULL;
+		free(cfgpart[i].mountpoint);
+		cfgpart[i].mountpoint = NULL;
+	}
+	return false;
+}
+
+void probe_cache_store(const PROBE_CACHE_ENTRY *entries, uint32_t count,
+		       bool search_all_devices)
+{
+	char disk_id[PROBE_CACHE_ID_LEN];
+	char *tmpfile;
+	struct stat st;
+	FILE *f;
+	int fd;
+
+	if (asprintf(&tmpfile, "%s.%d", probe_cache_file, getpid()) == -1) {
+		return;
+	}
+	fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		VERBOSE(stderr, "Could not create probe cache %s.\n",
+			tmpfile);
+		if (fd >= 0) {
+			close(fd);
+		}
+		free(tmpfile);
+		return;
+	}
+	fprintf(f, "%s\nall=%d count=%u\n", PROBE_CACHE_MAGIC,
+		search_all_devices, count);
+	for (uint32_t i = 0; i < count; i++) {
+		const PROBE_CACHE_ENTRY *e = &entries[i];
+
+		if (!valid_token(e->devpath) || !valid_token(e->diskpath) ||
+		    !valid_token(e->uuid) || stat(e->devpath, &st) ||
+		    !ebgpart_read_disk_id(e->diskpath, disk_id,
+					  sizeof(disk_id))) {
+			VERBOSE(stderr, "Cannot cache config partition %s.\n",
+				e->devpath ? e->devpath : "(null)");
+			fclose(f);
+			goto error;
+		}
+		fprintf(f, "%s %u:%u %s %s %s\n", e->devpath,
+			major(st.st_rdev), minor(st.st_rdev), e->uuid,
+			e->diskpath, disk_id);
+	}
+	if (fclose(f) || rename(tmpfile, probe_cache_file)) {
+		VERBOSE(stderr, "Could not write probe cache %s.\n",
+			probe_cache_file);
+		goto error;
+	}
+	free(tmpfile);
+	return;
+
+error:
+	unlink(tmpfile);
+	free(tmpfile);
+}
+
+bool probe_cache_invalidate(void)
+{
+	bool was_used = cache_used;
+
+	if (was_used) {
+		VERBOSE(stdout, "Dropping stale probe cache.\n");
+		unlink(probe_cache_file);
+		cache_used = false;
+	}
+	return was_used;
+}
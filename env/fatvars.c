@@ -22,18 +22,87 @@
 #include "syspart.h"
 #include "utils.h"
 
+/*
+ * An environment as stored in its file. The partition count and the size of
+ * the user variables are taken from the header of self-describing files, so
+ * they can differ from the values this loader was built with. If the header
+ * has its own checksum, only the header and the fixed members are loaded
+ * until the environment is selected.
+ */
+typedef struct {
+	UINT8 *raw;
+	UINTN size;
+	UINTN header_size;
+	UINTN loaded;
+	BOOLEAN invalid;
+} ENV_FILE;
+
+#define HAS_FIXED_CRC(e) ((e)->header_size >= sizeof(BG_ENVHDR))
+
 static int current_partition = 0;
-static BG_ENVDATA *env;
+static ENV_FILE *env;
+static UINTN env_count;
+static UINTN expected_parts;
+
+/* Only the members in front of userdata are accessed through this view. */
+static BG_ENVDATA *env_fields(UINTN i)
+{
+	return (BG_ENVDATA *)(env[i].raw + env[i].header_size);
+}
+
+static uint32_t calc_crc32(VOID *buf, UINTN len)
+{
+	uint32_t crc32;
+
+	(VOID) BS->CalculateCrc32(buf, len, &crc32);
+	return crc32;
+}
+
+/* The fixed header CRC32 is calculated with its own field set to zero. */
+static uint32_t fixed_crc32(ENV_FILE *e)
+{
+	BG_ENVHDR *hdr = (BG_ENVHDR *)e->raw;
+	uint32_t stored = hdr->fixed_crc32;
+	uint32_t crc32;
+
+	hdr->fixed_crc32 = 0;
+	crc32 = calc_crc32(e->raw, e->header_size + ENV_FIXED_SIZE);
+	hdr->fixed_crc32 = stored;
+	return crc32;
+}
+
+static BOOLEAN env_crc_valid(UINTN i)
+{
+	ENV_FILE *e = &env[i];
+	uint32_t crc32, stored;
+
+	if (e->loaded < e->size) {
+		crc32 = fixed_crc32(e);
+		stored = ((BG_ENVHDR *)e->raw)->fixed_crc32;
+	} else {
+		crc32 = calc_crc32(e->raw, e->size - sizeof(crc32));
+		CopyMem(&stored, e->raw + e->size - sizeof(stored),
+			sizeof(stored));
+	}
+	if (crc32 != stored) {
+		ERROR(L"CRC32 error in environment data on config partition %d.\n",
+		      i);
+		INFO(L"calculated: %lx\n", crc32);
+		INFO(L"stored: %lx\n", stored);
+		return FALSE;
+	}
+	return TRUE;
+}
 
 static VOID save_current_config(const UINTN *config_volumes, UINTN numHandles)
 {
 	EFI_STATUS efistatus;
 
-	if (numHandles != ENV_NUM_CONFIG_PARTS) {
+	if (numHandles != expected_parts) {
 		/* In case of saving, this must be treated as error, to not
 		 * overwrite another partition's config file. */
 		ERROR(L"Unexpected number of config partitions: found %d, but expected %d.\n",
-		      numHandles, ENV_NUM_CONFIG_PARTS);
+		      numHandles, expected_parts);
 		return;
 	}
 
@@ -47,14 +116,15 @@ static VOID save_current_config(const UINTN *config_volumes, UINTN numHandles)
 		return;
 	}
 
-	UINTN writelen = sizeof(BG_ENVDATA);
+	ENV_FILE *e = &env[current_partition];
+	UINTN writelen = e->size;
 
-	uint32_t crc32;
-	(VOID) BS->CalculateCrc32(
-	    &env[current_partition],
-	    sizeof(BG_ENVDATA) - sizeof(env[current_partition].crc32), &crc32);
-	env[current_partition].crc32 = crc32;
-	efistatus = fh->Write(fh, &writelen, (VOID *)&env[current_partition]);
+	if (HAS_FIXED_CRC(e)) {
+		((BG_ENVHDR *)e->raw)->fixed_crc32 = fixed_crc32(e);
+	}
+	uint32_t crc32 = calc_crc32(e->raw, e->size - sizeof(crc32));
+	CopyMem(e->raw + e->size - sizeof(crc32), &crc32, sizeof(crc32));
+	efistatus = fh->Write(fh, &writelen, (VOID *)e->raw);
 	if (EFI_ERROR(efistatus)) {
 		ERROR(L"Cannot write environment to file: %r\n", efistatus);
 	}
@@ -64,62 +134,210 @@ static VOID save_current_config(const UINTN *config_volumes, UINTN numHandles)
 	}
 }
 
+/*
+ * Read the header first to learn the size of the file. Files without the
+ * magic have the layout this loader was built with.
+ */
+static EFI_STATUS read_env_file(EFI_FILE_HANDLE fh, ENV_FILE *e,
+				UINTN *num_parts)
+{
+	EFI_STATUS status;
+	BG_ENVHDR hdr;
+	UINTN readlen = sizeof(hdr);
+	UINTN rest;
+
+	status = read_cfg_file(fh, &readlen, (VOID *)&hdr);
+	if (EFI_ERROR(status)) {
+		return status;
+	}
+	if (readlen == sizeof(hdr) &&
+	    CompareMem(hdr.magic, ENV_V2_MAGIC, ENV_V2_MAGIC_LEN) == 0) {
+		if (hdr.header_size < ENV_V2_BASE_HEADER_SIZE ||
+		    hdr.header_size > ENV_V2_MAX_HEADER_SIZE ||
+		    hdr.num_config_parts < 1 ||
+		    hdr.num_config_parts > ENV_V2_MAX_CONFIG_PARTS ||
+		    hdr.userdata_size < ENV_V2_MIN_USERVARS ||
+		    hdr.userdata_size > ENV_V2_MAX_USERVARS) {
+			return EFI_INCOMPATIBLE_VERSION;
+		}
+		e->header_size = hdr.header_size;
+		e->size = ENV_V2_FILE_SIZE(hdr.header_size, hdr.userdata_size);
+		*num_parts = hdr.num_config_parts;
+	} else {
+		e->header_size = 0;
+		e->size = sizeof(BG_ENVDATA);
+	}
+
+	e->raw = AllocatePool(e->size);
+	if (!e->raw) {
+		return EFI_OUT_OF_RESOURCES;
+	}
+	CopyMem(e->raw, &hdr, readlen);
+	e->loaded = HAS_FIXED_CRC(e) ? e->header_size + ENV_FIXED_SIZE
+				     : e->size;
+	rest = e->loaded - readlen;
+	status = read_cfg_file(fh, &rest, e->raw + readlen);
+	if (!EFI_ERROR(status) && readlen + rest < e->loaded) {
+		status = EFI_END_OF_FILE;
+	}
+	return status;
+}
+
+/*
+ * Read the user variables of an environment that was selected by its fixed
+ * header and verify the whole file.
+ */
+static BOOLEAN complete_env_file(const UINTN *config_volumes, UINTN i)
+{
+	VOLUME_DESC *v = &volumes[config_volumes[i]];
+	EFI_FILE_HANDLE fh = NULL;
+	ENV_FILE *e = &env[i];
+	EFI_STATUS status;
+	UINTN readlen;
+
+	if (e->invalid || e->loaded == e->size) {
+		return TRUE;
+	}
+
+	status = open_cfg_file(v->root, &fh, EFI_FILE_MODE_READ);
+	if (!EFI_ERROR(status)) {
+		readlen = e->size - e->loaded;
+		status = fh->SetPosition(fh, e->loaded);
+		if (!EFI_ERROR(status)) {
+			status = read_cfg_file(fh, &readlen,
+					       e->raw + e->loaded);
+		}
+		if (!EFI_ERROR(status) && readlen < e->size - e->loaded) {
+			status = EFI_END_OF_FILE;
+		}
+		if (EFI_ERROR(close_cfg_file(v->root, fh))) {
+			ERROR(L"Could not close environment config file.\n");
+		}
+	}
+	if (EFI_ERROR(status)) {
+		ERROR(L"Cannot read environment from config partition %d.\n", i);
+		e->invalid = TRUE;
+		return FALSE;
+	}
+
+	e->loaded = e->size;
+	if (!env_crc_valid(i)) {
+		e->invalid = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Find environment with latest revision and the one before it. */
+static UINTN select_envs(UINTN *latest_idx, UINTN *pre_latest_idx)
+{
+	UINTN latest_rev = 0, pre_latest_rev = 0;
+	UINTN i;
+
+	*latest_idx = 0;
+	*pre_latest_idx = 0;
+	for (i = 0; i < env_count; i++) {
+		if (!env[i].invalid) {
+			if (env_fields(i)->revision > latest_rev) {
+				pre_latest_rev = latest_rev;
+				latest_rev = env_fields(i)->revision;
+				*pre_latest_idx = *latest_idx;
+				*latest_idx = i;
+			} else if (env_fields(i)->revision > pre_latest_rev) {
+				/* we always need a 2nd iteration if
+				 * revisions are decreasing with growing i
+				 * so that pre_* gets set */
+				pre_latest_rev = env_fields(i)->revision;
+				*pre_latest_idx = i;
+			}
+		}
+	}
+	return latest_rev;
+}
+
+/*
+ * Complete the environments needed for booting: the latest one, unless it
+ * is skipped, and the previous one if the latest is not booted. The latest
+ * one is also needed completely if its ustate will be saved.
+ */
+static BOOLEAN complete_selected(const UINTN *config_volumes,
+				 UINTN latest_idx, UINTN pre_latest_idx)
+{
+	BG_ENVDATA *latest = env_fields(latest_idx);
+	BOOLEAN in_progress = latest->in_progress == 1;
+	BOOLEAN boot_latest = !in_progress &&
+			      latest->ustate != USTATE_TESTING;
+
+	if (!in_progress && !complete_env_file(config_volumes, latest_idx)) {
+		return FALSE;
+	}
+	if (!boot_latest &&
+	    !complete_env_file(config_volumes, pre_latest_idx)) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static VOID free_env_files(VOID)
+{
+	UINTN i;
+
+	for (i = 0; env && i < env_count; i++) {
+		if (env[i].raw) {
+			FreePool(env[i].raw);
+		}
+	}
+	if (env) {
+		FreePool(env);
+	}
+	env = NULL;
+}
+
 BG_STATUS load_config(BG_LOADER_PARAMS *bglp)
 {
 	BG_STATUS result = BG_CONFIG_ERROR;
 	UINTN numHandles = volume_count;
 	UINTN *config_volumes;
 	UINTN i;
-	int env_invalid[ENV_NUM_CONFIG_PARTS] = {0};
-
-	env = (BG_ENVDATA *)AllocateZeroPool(sizeof(BG_ENVDATA) *
-					 ENV_NUM_CONFIG_PARTS);
-	if (!env) {
-		ERROR(L"Could not allocate memory for config data.\n");
-		return result;
-	}
 
 	config_volumes = (UINTN *)AllocatePool(sizeof(UINTN) * volume_count);
 	if (!config_volumes) {
 		ERROR(L"Could not allocate memory for config partition mapping.\n");
-		goto env_cleanup;
+		return result;
 	}
 
 	if (EFI_ERROR(enumerate_cfg_parts(config_volumes, &numHandles))) {
 		ERROR(L"Could not enumerate config partitions.\n");
 		goto lc_cleanup;
 	}
-	if (numHandles > ENV_NUM_CONFIG_PARTS) {
-		ERROR(L"Too many config partitions found. Aborting.\n");
+
+	/* keep at least one, possibly empty, environment to boot from */
+	env_count = numHandles > 0 ? numHandles : 1;
+	env = (ENV_FILE *)AllocateZeroPool(sizeof(ENV_FILE) * env_count);
+	if (!env) {
+		ERROR(L"Could not allocate memory for config data.\n");
 		goto lc_cleanup;
 	}
 
 	result = BG_SUCCESS;
-
-	if (numHandles < ENV_NUM_CONFIG_PARTS) {
-		WARNING(L"Too few config partitions: found: %d, but expected %d.\n",
-			numHandles, ENV_NUM_CONFIG_PARTS);
-		/* Don't treat this as error because we may still be able to
-		 * find a valid config */
-		result = BG_CONFIG_PARTIALLY_CORRUPTED;
-	}
+	expected_parts = 0;
 
 	/* Load all config data */
 	for (i = 0; i < numHandles; i++) {
 		EFI_FILE_HANDLE fh = NULL;
 		VOLUME_DESC *v = &volumes[config_volumes[i]];
+		UINTN num_parts = 0;
 		if (EFI_ERROR(open_cfg_file(v->root, &fh,
 					    EFI_FILE_MODE_READ))) {
 			WARNING(L"Could not open environment file on config partition %d\n",
 				i);
+			env[i].invalid = TRUE;
 			result = BG_CONFIG_PARTIALLY_CORRUPTED;
 			continue;
 		}
-		UINTN readlen = sizeof(BG_ENVDATA);
-		if (EFI_ERROR(read_cfg_file(fh, &readlen, (VOID *)&env[i])) ||
-		    readlen < sizeof(BG_ENVDATA)) {
+		if (EFI_ERROR(read_env_file(fh, &env[i], &num_parts))) {
 			ERROR(L"Cannot read environment from config partition %d.\n", i);
-			env_invalid[i] = 1;
+			env[i].invalid = TRUE;
 			if (EFI_ERROR(close_cfg_file(v->root, fh))) {
 				ERROR(L"Could not close environment config file.\n");
 			}
@@ -127,20 +345,17 @@ BG_STATUS load_config(BG_LOADER_PARAMS *bglp)
 			continue;
 		}
 
-		uint32_t crc32;
-		(VOID) BS->CalculateCrc32(
-		    &env[i], sizeof(BG_ENVDATA) - sizeof(env[i].crc32), &crc32);
-
-		if (crc32 != env[i].crc32) {
-			ERROR(L"CRC32 error in environment data on config partition %d.\n",
-			      i);
-			INFO(L"calculated: %lx\n", crc32);
-			INFO(L"stored: %lx\n", env[i].crc32);
+		if (!env_crc_valid(i)) {
 			/* Don't treat this as fatal error because we may still
 			 * have
 			 * valid environments */
-			env_invalid[i] = 1;
+			env[i].invalid = TRUE;
 			result = BG_CONFIG_PARTIALLY_CORRUPTED;
+		} else if (num_parts && !expected_parts) {
+			expected_parts = num_parts;
+		} else if (num_parts && num_parts != expected_parts) {
+			WARNING(L"Config partition %d expects %d config partitions, others %d.\n",
+				i, num_parts, expected_parts);
 		}
 
 		if (EFI_ERROR(close_cfg_file(v->root, fh))) {
@@ -149,31 +364,58 @@ BG_STATUS load_config(BG_LOADER_PARAMS *bglp)
 			 * config */
 			result = BG_CONFIG_PARTIALLY_CORRUPTED;
 		}
+	}
 
-		/* enforce NULL-termination of strings */
-		env[i].kernelfile[ENV_STRING_LENGTH - 1] = 0;
-		env[i].kernelparams[ENV_STRING_LENGTH - 1] = 0;
+	/* stand-ins for environments that could not be read */
+	for (i = 0; i < env_count; i++) {
+		if (env[i].raw) {
+			continue;
+		}
+		env[i].raw = AllocateZeroPool(sizeof(BG_ENVDATA));
+		if (!env[i].raw) {
+			ERROR(L"Could not allocate memory for config data.\n");
+			result = BG_CONFIG_ERROR;
+			goto lc_cleanup;
+		}
+		env[i].size = sizeof(BG_ENVDATA);
+		env[i].header_size = 0;
+		env[i].loaded = env[i].size;
+		env[i].invalid = TRUE;
+	}
+
+	if (!expected_parts) {
+		expected_parts = ENV_NUM_CONFIG_PARTS;
+	}
+	if (numHandles > expected_parts) {
+		ERROR(L"Too many config partitions found. Aborting.\n");
+		result = BG_CONFIG_ERROR;
+		goto lc_cleanup;
+	}
+	if (numHandles < expected_parts) {
+		WARNING(L"Too few config partitions: found: %d, but expected %d.\n",
+			numHandles, expected_parts);
+		/* Don't treat this as error because we may still be able to
+		 * find a valid config */
+		result = BG_CONFIG_PARTIALLY_CORRUPTED;
 	}
 
 	/* Find environment with latest revision and check if there is a test
-	 * configuration. */
-	UINTN latest_rev = 0, latest_idx = 0;
-	UINTN pre_latest_rev = 0, pre_latest_idx = 0;
-	for (i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		if (!env_invalid[i]) {
-			if (env[i].revision > latest_rev) {
-				pre_latest_rev = latest_rev;
-				latest_rev = env[i].revision;
-				pre_latest_idx = latest_idx;
-				latest_idx = i;
-			} else if (env[i].revision > pre_latest_rev) {
-				/* we always need a 2nd iteration if
-				 * revisions are decreasing with growing i
-				 * so that pre_* gets set */
-				pre_latest_rev = env[i].revision;
-				pre_latest_idx = i;
-			}
+	 * configuration. Only the environments needed are read completely, if
+	 * that fails, select again without them. */
+	UINTN latest_rev, latest_idx, pre_latest_idx;
+	for (;;) {
+		latest_rev = select_envs(&latest_idx, &pre_latest_idx);
+		if (complete_selected(config_volumes, latest_idx,
+				      pre_latest_idx)) {
+			break;
 		}
+		result = BG_CONFIG_PARTIALLY_CORRUPTED;
+	}
+
+	for (i = 0; i < env_count; i++) {
+		/* enforce NULL-termination of strings */
+		env_fields(i)->kernelfile[ENV_STRING_LENGTH - 1] = 0;
+		env_fields(i)->kernelparams[ENV_STRING_LENGTH - 1] = 0;
 	}
 
 	/* Assume we boot with the latest configuration */
@@ -181,41 +423,40 @@ BG_STATUS load_config(BG_LOADER_PARAMS *bglp)
 
 	/* Test if this environment is currently 'in_progress'. If yes,
 	 * do not boot from it, instead ignore it */
-	if (env[latest_idx].in_progress == 1) {
+	if (env_fields(latest_idx)->in_progress == 1) {
 		current_partition = pre_latest_idx;
-	} else if (env[latest_idx].ustate == USTATE_TESTING) {
+	} else if (env_fields(latest_idx)->ustate == USTATE_TESTING) {
 		/* If it has already been booted, this indicates a failed
 		 * update. In this case, mark it as failed by giving a
 		 * zero-revision */
-		env[latest_idx].ustate = USTATE_FAILED;
-		env[latest_idx].revision = REVISION_FAILED;
+		env_fields(latest_idx)->ustate = USTATE_FAILED;
+		env_fields(latest_idx)->revision = REVISION_FAILED;
 		save_current_config(config_volumes, numHandles);
 		/* We must boot with the configuration that was active before
 		 */
 		current_partition = pre_latest_idx;
-	} else if (env[latest_idx].ustate == USTATE_INSTALLED) {
+	} else if (env_fields(latest_idx)->ustate == USTATE_INSTALLED) {
 		/* If this configuration has never been booted with, set ustate
 		 * to indicate that this configuration is now being tested */
-		env[latest_idx].ustate = USTATE_TESTING;
+		env_fields(latest_idx)->ustate = USTATE_TESTING;
 		save_current_config(config_volumes, numHandles);
 	}
 
-	bglp->ustate = env[latest_idx].ustate;
-	bglp->payload_path = StrDuplicate(env[current_partition].kernelfile);
+	bglp->ustate = env_fields(latest_idx)->ustate;
+	bglp->payload_path = StrDuplicate(env_fields(current_partition)->kernelfile);
 	bglp->payload_options =
-	    StrDuplicate(env[current_partition].kernelparams);
-	bglp->timeout = env[current_partition].watchdog_timeout_sec;
+	    StrDuplicate(env_fields(current_partition)->kernelparams);
+	bglp->timeout = env_fields(current_partition)->watchdog_timeout_sec;
 
 	INFO(L"Config Revision: %d:\n", latest_rev);
-	INFO(L" ustate: %d\n", env[current_partition].ustate);
+	INFO(L" ustate: %d\n", env_fields(current_partition)->ustate);
 	INFO(L" kernel: %s\n", bglp->payload_path);
 	INFO(L" args: %s\n", bglp->payload_options);
 	INFO(L" timeout: %d seconds\n", bglp->timeout);
 
 lc_cleanup:
+	free_env_files();
 	FreePool(config_volumes);
-env_cleanup:
-	FreePool(env);
 	return result;
 }
 
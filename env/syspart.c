@@ -29,26 +29,32 @@ EFI_STATUS enumerate_cfg_parts(UINTN *config_volumes, UINTN *numHandles)
 		ERROR(L"Invalid parameter in system partition enumeration.\n");
 		return EFI_INVALID_PARAMETER;
 	}
+	/*
+	 * Volumes on the boot medium are sorted first. Environments found
+	 * there are the only ones used, so the scan only widens to the other
+	 * volumes if the boot medium has none.
+	 */
 	for (UINTN index = 0; index < volume_count && rootCount < *numHandles;
 	     index++) {
 		EFI_FILE_HANDLE fh = NULL;
-		if (!volumes[index].root) {
+		EFI_FILE_HANDLE root;
+		if (use_envs_on_bootmedium_only &&
+		    !volumes[index].onbootmedium) {
+			break;
+		}
+		root = volume_root(&volumes[index]);
+		if (!root) {
 			continue;
 		}
-		status = open_cfg_file(volumes[index].root, &fh,
-				       EFI_FILE_MODE_READ);
+		status = open_cfg_file(root, &fh, EFI_FILE_MODE_READ);
 		if (status == EFI_SUCCESS) {
 			if (volumes[index].onbootmedium) {
 				use_envs_on_bootmedium_only = TRUE;
 			}
-			if (!use_envs_on_bootmedium_only || volumes[index].onbootmedium) {
-				INFO(L"Config file found on volume %d.\n", index);
-				config_volumes[rootCount] = index;
-				rootCount++;
-			} else {
-				WARNING(L"Ignoring config file found on volume %d.\n", index);
-			}
-			status = close_cfg_file(volumes[index].root, fh);
+			INFO(L"Config file found on volume %d.\n", index);
+			config_volumes[rootCount] = index;
+			rootCount++;
+			status = close_cfg_file(root, fh);
 			if (EFI_ERROR(status)) {
 				ERROR(L"Could not close config file on partition %d.\n",
 				      index);
@@ -12,9 +12,11 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "env_api.h"
+#include "env_hash.h"
 #include "uservars.h"
 
 void bgenv_map_uservar(uint8_t *udata, char **key, uint64_t *type, uint8_t **val,
@@ -74,9 +76,219 @@ void bgenv_map_uservar(uint8_t *udata, char **key, uint64_t *type, uint8_t **val
 	}
 }
 
-bool bgenv_validate_uservars(uint8_t *udata)
+/*
+ * In deferred compaction mode, deleted records stay in place with
+ * USERVAR_TYPE_DELETED set in their type until bgenv_compact_uservars
+ * drops all of them at once.
+ */
+static bool uservar_is_deleted(uint8_t *var)
+{
+	uint64_t type;
+
+	bgenv_map_uservar(var, NULL, &type, NULL, NULL, NULL);
+	return (type & USERVAR_TYPE_DELETED) != 0;
+}
+
+static void uservar_mark_deleted(uint8_t *var)
+{
+	uint8_t *type = (uint8_t *)strchr((char *)var, 0) + 1 +
+			sizeof(uint32_t);
+	uint64_t val;
+
+	memcpy(&val, type, sizeof(val));
+	val |= USERVAR_TYPE_DELETED;
+	memcpy(type, &val, sizeof(val));
+}
+
+/*
+ * The index maps keys to record offsets via open addressing with linear
+ * probing. A slot holds the record offset + 1, so 0 marks a free slot.
+ * Besides that, the end of the record list is cached, which includes
+ * deleted records not yet compacted. The hash table is
+ * only set up for lists with a minimum number of variables, otherwise
+ * searching linearly is fast enough.
+ */
+#define USERVAR_INDEX_MIN_VARS 16
+#define USERVAR_INDEX_MIN_SLOTS 64
+
+static void uservar_index_insert(USERVAR_INDEX *index, uint8_t *udata,
+				 uint32_t offset)
+{
+	uint32_t mask = index->num_slots - 1;
+	uint32_t i = env_hash_str((char *)udata + offset) & mask;
+
+	while (index->slots[i]) {
+		i = (i + 1) & mask;
+	}
+	index->slots[i] = offset + 1;
+}
+
+static void uservar_index_rehash(USERVAR_INDEX *index, uint8_t *udata)
+{
+	uint32_t num_slots = USERVAR_INDEX_MIN_SLOTS;
+	uint32_t offset = 0;
+
+	free(index->slots);
+	index->slots = NULL;
+	index->num_slots = 0;
+
+	/* keep the load factor at or below 1/2 */
+	while (num_slots < 2 * index->num_vars + 2) {
+		num_slots *= 2;
+	}
+	index->slots = calloc(num_slots, sizeof(uint32_t));
+	if (!index->slots) {
+		/* no problem, fall back to linear search */
+		return;
+	}
+	index->num_slots = num_slots;
+
+	while (offset < index->end) {
+		if (!uservar_is_deleted(udata + offset)) {
+			uservar_index_insert(index, udata, offset);
+		}
+		offset = bgenv_next_uservar(udata + offset) - udata;
+	}
+}
+
+/*
+ * Returns true if the index can be used, building it if necessary.
+ */
+static bool uservar_index_prepare(USERVAR_INDEX *index, uint8_t *udata,
+				  uint32_t size)
+{
+	uint32_t end = 0, num_vars = 0, rsize;
+
+	if (!index) {
+		return false;
+	}
+	if (index->valid) {
+		return true;
+	}
+	while (end < size && udata[end]) {
+		uint64_t type;
+
+		bgenv_map_uservar(udata + end, NULL, &type, NULL, &rsize, NULL);
+		end += rsize;
+		if (!(type & USERVAR_TYPE_DELETED)) {
+			num_vars++;
+		}
+	}
+	if (end > size) {
+		/* broken list, do not cache anything */
+		return false;
+	}
+	index->end = end;
+	index->num_vars = num_vars;
+	index->valid = true;
+
+	free(index->slots);
+	index->slots = NULL;
+	index->num_slots = 0;
+	if (num_vars >= USERVAR_INDEX_MIN_VARS) {
+		uservar_index_rehash(index, udata);
+	}
+	return true;
+}
+
+static void uservar_index_append(USERVAR_INDEX *index, uint8_t *udata,
+				 uint8_t *var, uint32_t rsize)
+{
+	if (!index || !index->valid) {
+		return;
+	}
+	index->end += rsize;
+	index->num_vars++;
+
+	if (index->slots && 2 * index->num_vars + 2 <= index->num_slots) {
+		uservar_index_insert(index, udata, var - udata);
+	} else if (index->num_vars >= USERVAR_INDEX_MIN_VARS) {
+		uservar_index_rehash(index, udata);
+	}
+}
+
+/*
+ * Drops the slot of the record at var. Returns false if the index is not
+ * in use (anymore).
+ */
+static bool uservar_index_forget(USERVAR_INDEX *index, uint8_t *udata,
+				 uint8_t *var)
+{
+	uint32_t offset = var - udata;
+	uint32_t mask, i, j;
+
+	if (!index || !index->valid) {
+		return false;
+	}
+	index->num_vars--;
+	if (!index->slots) {
+		return true;
+	}
+
+	mask = index->num_slots - 1;
+	i = env_hash_str((char *)var) & mask;
+	while (index->slots[i] != offset + 1) {
+		if (!index->slots[i]) {
+			/* index is out of sync, drop it */
+			bgenv_uservar_index_invalidate(index);
+			return false;
+		}
+		i = (i + 1) & mask;
+	}
+
+	/* backward shift deletion keeps the probe sequences intact */
+	index->slots[i] = 0;
+	for (j = (i + 1) & mask; index->slots[j]; j = (j + 1) & mask) {
+		uint32_t home = env_hash_str((char *)udata +
+					     index->slots[j] - 1) & mask;
+
+		if (i <= j ? (i < home && home <= j)
+			   : (i < home || home <= j)) {
+			continue;
+		}
+		index->slots[i] = index->slots[j];
+		index->slots[j] = 0;
+		i = j;
+	}
+	return true;
+}
+
+/*
+ * Must be called before the record at var is removed from udata.
+ */
+static void uservar_index_remove(USERVAR_INDEX *index, uint8_t *udata,
+				 uint8_t *var, uint32_t rsize)
+{
+	uint32_t offset = var - udata;
+
+	if (!uservar_index_forget(index, udata, var)) {
+		return;
+	}
+	index->end -= rsize;
+	if (!index->slots) {
+		return;
+	}
+
+	/* all records behind the removed one move down */
+	for (uint32_t i = 0; i < index->num_slots; i++) {
+		if (index->slots[i] > offset + 1) {
+			index->slots[i] -= rsize;
+		}
+	}
+}
+
+void bgenv_uservar_index_invalidate(USERVAR_INDEX *index)
 {
-	uint32_t spaceleft = ENV_MEM_USERVARS;
+	if (!index) {
+		return;
+	}
+	free(index->slots);
+	memset(index, 0, sizeof(*index));
+}
+
+bool bgenv_validate_uservars(uint8_t *udata, uint32_t size)
+{
+	uint32_t spaceleft = size;
 
 	while (*udata) {
 		uint32_t key_len = strnlen((char *)udata, spaceleft);
@@ -109,7 +321,8 @@ bool bgenv_validate_uservars(uint8_t *udata)
 	return true;
 }
 
-static uint8_t *bgenv_uservar_alloc(uint8_t *udata, uint32_t datalen)
+static uint8_t *bgenv_uservar_alloc(USERVAR_INDEX *index, uint8_t *udata,
+				    uint32_t size, uint32_t datalen)
 {
 	uint32_t spaceleft;
 
@@ -117,7 +330,11 @@ static uint8_t *bgenv_uservar_alloc(uint8_t *udata, uint32_t datalen)
 		errno = EINVAL;
 		return NULL;
 	}
-	spaceleft = bgenv_user_free(udata);
+	spaceleft = bgenv_user_free_indexed(index, udata, size);
+	if (spaceleft < datalen + 1 && ebgenv_opts.deferred_compaction) {
+		bgenv_compact_uservars(index, udata);
+		spaceleft = bgenv_user_free_indexed(index, udata, size);
+	}
 	VERBOSE(stdout, "uservar_alloc: free: %lu requested: %lu \n",
 		(unsigned long)spaceleft, (unsigned long)datalen);
 
@@ -129,10 +346,11 @@ static uint8_t *bgenv_uservar_alloc(uint8_t *udata, uint32_t datalen)
 		return NULL;
 	}
 
-	return udata + (ENV_MEM_USERVARS - spaceleft);
+	return udata + (size - spaceleft);
 }
 
-static uint8_t *bgenv_uservar_realloc(uint8_t *udata, uint32_t new_rsize,
+static uint8_t *bgenv_uservar_realloc(USERVAR_INDEX *index, uint8_t *udata,
+				      uint32_t size, uint32_t new_rsize,
 				      uint8_t *p)
 {
 	uint32_t spaceleft;
@@ -147,16 +365,20 @@ static uint8_t *bgenv_uservar_realloc(uint8_t *udata, uint32_t new_rsize,
 	}
 
 	/* Delete variable and return pointer to end of whole user vars */
-	bgenv_del_uservar(udata, p);
+	bgenv_del_uservar_indexed(index, udata, size, p);
 
-	spaceleft = bgenv_user_free(udata);
+	spaceleft = bgenv_user_free_indexed(index, udata, size);
+	if (spaceleft < new_rsize - 1 && ebgenv_opts.deferred_compaction) {
+		bgenv_compact_uservars(index, udata);
+		spaceleft = bgenv_user_free_indexed(index, udata, size);
+	}
 
 	if (spaceleft < new_rsize - 1) {
 		errno = ENOMEM;
 		return NULL;
 	}
 
-	return udata + ENV_MEM_USERVARS - spaceleft;
+	return udata + size - spaceleft;
 }
 
 static void bgenv_serialize_uservar(uint8_t *p, const char *key, uint64_t type,
@@ -182,21 +404,18 @@ static void bgenv_serialize_uservar(uint8_t *p, const char *key, uint64_t type,
 	memcpy(p, data, data_size);
 }
 
-int bgenv_get_uservar(uint8_t *udata, const char *key, uint64_t *type,
-		      void *data, uint32_t maxlen)
+static int uservar_copy(uint8_t *uservar, uint64_t *type, void *data,
+			uint32_t maxlen)
 {
-	uint8_t *uservar, *value;
-	char *lkey;
+	uint8_t *value;
 	uint32_t dsize;
 	uint64_t ltype;
 
-	uservar = bgenv_find_uservar(udata, key);
-
 	if (!uservar) {
 		return -ENOENT;
 	}
 
-	bgenv_map_uservar(uservar, &lkey, &ltype, &value, NULL, &dsize);
+	bgenv_map_uservar(uservar, NULL, &ltype, &value, NULL, &dsize);
 
 	if (dsize > maxlen) {
 		dsize = maxlen;
@@ -211,11 +430,35 @@ int bgenv_get_uservar(uint8_t *udata, const char *key, uint64_t *type,
 	return 0;
 }
 
-int bgenv_set_uservar(uint8_t *udata, const char *key, uint64_t type,
-		      const void *data, uint32_t datalen)
+int bgenv_get_uservar(uint8_t *udata, const char *key, uint64_t *type,
+		      void *data, uint32_t maxlen)
+{
+	return uservar_copy(bgenv_find_uservar(udata, key), type, data,
+			    maxlen);
+}
+
+int bgenv_get_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+			      uint32_t size, const char *key, uint64_t *type,
+			      void *data, uint32_t maxlen)
+{
+	return uservar_copy(bgenv_find_uservar_indexed(index, udata, size, key),
+			    type, data, maxlen);
+}
+
+int bgenv_set_uservar(uint8_t *udata, uint32_t size, const char *key,
+		      uint64_t type, const void *data, uint32_t datalen)
+{
+	return bgenv_set_uservar_indexed(NULL, udata, size, key, type, data,
+					 datalen);
+}
+
+int bgenv_set_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+			      uint32_t size, const char *key, uint64_t type,
+			      const void *data, uint32_t datalen)
 {
 	uint64_t total_size;
 	uint8_t *p;
+	bool in_place = false;
 
 	total_size = (uint64_t)datalen + sizeof(uint64_t) + sizeof(uint32_t) +
 		     strlen(key) + 1;
@@ -223,17 +466,21 @@ int bgenv_set_uservar(uint8_t *udata, const char *key, uint64_t type,
 		return -EINVAL;
 	}
 
-	p = bgenv_find_uservar(udata, key);
+	p = bgenv_find_uservar_indexed(index, udata, size, key);
 	if (p) {
+		uint32_t rsize;
+
 		if (type & USERVAR_TYPE_DELETED) {
-			bgenv_del_uservar(udata, p);
+			bgenv_del_uservar_indexed(index, udata, size, p);
 			return 0;
 		}
 
-		p = bgenv_uservar_realloc(udata, total_size, p);
+		bgenv_map_uservar(p, NULL, NULL, NULL, &rsize, NULL);
+		in_place = rsize == total_size;
+		p = bgenv_uservar_realloc(index, udata, size, total_size, p);
 	} else {
 		if ((type & USERVAR_TYPE_DELETED) == 0) {
-			p = bgenv_uservar_alloc(udata, total_size);
+			p = bgenv_uservar_alloc(index, udata, size, total_size);
 		} else {
 			return 0;
 		}
@@ -243,10 +490,202 @@ int bgenv_set_uservar(uint8_t *udata, const char *key, uint64_t type,
 	}
 
 	bgenv_serialize_uservar(p, key, type, data, total_size);
+	if (!in_place) {
+		uservar_index_append(index, udata, p, total_size);
+	}
 
 	return 0;
 }
 
+static int uservar_kv_cmp(const void *a, const void *b)
+{
+	const ebg_kv_t *x = *(const ebg_kv_t *const *)a;
+	const ebg_kv_t *y = *(const ebg_kv_t *const *)b;
+	int res = strcmp(x->key, y->key);
+
+	if (res) {
+		return res;
+	}
+	/* keep the order of the batch for equal keys */
+	return (x > y) - (x < y);
+}
+
+static int uservar_key_cmp(const void *key, const void *elem)
+{
+	return strcmp(key, (*(const ebg_kv_t *const *)elem)->key);
+}
+
+static bool uservar_append_kv(uint8_t *out, uint32_t size, uint32_t *end,
+			      const ebg_kv_t *kv)
+{
+	uint32_t rsize = kv->datalen + sizeof(uint64_t) + sizeof(uint32_t) +
+			 strlen(kv->key) + 1;
+
+	/* keep one byte for the end-of-list marker */
+	if (size - *end < rsize + 1) {
+		return false;
+	}
+	bgenv_serialize_uservar(out + *end, kv->key, kv->type,
+				kv->datalen ? kv->value : (const uint8_t *)"",
+				rsize);
+	*end += rsize;
+	return true;
+}
+
+/*
+ * Applies all updates in one pass: Existing variables are copied into a new
+ * buffer, replaced or dropped, new ones are appended. The user data is only
+ * modified if the whole batch fits.
+ */
+/*
+ * Differences closer than this are written as one range, which keeps the
+ * number of ranges reported low when neighbouring records change.
+ */
+#define USERVAR_MERGE_GAP 16
+
+/* Copy the ranges of out that differ from udata, reporting each first. */
+static void uservar_apply_changes(uint8_t *udata, const uint8_t *out,
+				  uint32_t len, uservar_mark_fn mark,
+				  void *ctx)
+{
+	uint32_t pos = 0;
+
+	while (pos < len) {
+		uint32_t start, gap = 0;
+
+		if (udata[pos] == out[pos]) {
+			pos++;
+			continue;
+		}
+		start = pos;
+		for (; pos < len && gap < USERVAR_MERGE_GAP; pos++) {
+			gap = udata[pos] == out[pos] ? gap + 1 : 0;
+		}
+		if (mark) {
+			mark(ctx, start, pos - gap - start);
+		}
+		memcpy(udata + start, out + start, pos - gap - start);
+	}
+}
+
+int bgenv_set_uservars_many(USERVAR_INDEX *index, uint8_t *udata,
+			    uint32_t size, const ebg_kv_t *kvs, size_t count,
+			    uservar_mark_fn mark, void *ctx)
+{
+	const ebg_kv_t **sorted;
+	uint8_t *out = NULL, *var;
+	bool *applied = NULL;
+	uint32_t end = 0;
+	size_t n, unique = 0;
+	int res = 0;
+
+	if (!udata || (!kvs && count)) {
+		return -EINVAL;
+	}
+	if (count == 0) {
+		return 0;
+	}
+	for (n = 0; n < count; n++) {
+		if (!kvs[n].key || (!kvs[n].value && kvs[n].datalen) ||
+		    (uint64_t)kvs[n].datalen + sizeof(uint64_t) +
+				    sizeof(uint32_t) + strlen(kvs[n].key) + 1 >
+			    UINT32_MAX) {
+			return -EINVAL;
+		}
+	}
+
+	sorted = malloc(count * sizeof(*sorted));
+	if (!sorted) {
+		return -ENOMEM;
+	}
+	for (n = 0; n < count; n++) {
+		sorted[n] = &kvs[n];
+	}
+	qsort(sorted, count, sizeof(*sorted), uservar_kv_cmp);
+	/* only the last update of each key counts */
+	for (n = 0; n < count; n++) {
+		if (n + 1 < count &&
+		    strcmp(sorted[n]->key, sorted[n + 1]->key) == 0) {
+			continue;
+		}
+		sorted[unique++] = sorted[n];
+	}
+
+	applied = calloc(unique, sizeof(bool));
+	out = calloc(1, size);
+	if (!applied || !out) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	for (var = udata; *var; var = bgenv_next_uservar(var)) {
+		const ebg_kv_t **found;
+		uint32_t rsize;
+		uint64_t type;
+		char *key;
+
+		bgenv_map_uservar(var, &key, &type, NULL, &rsize, NULL);
+		if (type & USERVAR_TYPE_DELETED) {
+			/* compacted along the way */
+			continue;
+		}
+		found = bsearch(key, sorted, unique, sizeof(*sorted),
+				uservar_key_cmp);
+		if (found) {
+			applied[found - sorted] = true;
+			if ((*found)->type & USERVAR_TYPE_DELETED) {
+				continue;
+			}
+			if (!uservar_append_kv(out, size, &end, *found)) {
+				res = -ENOMEM;
+				goto out;
+			}
+			continue;
+		}
+		if (size - end < rsize + 1) {
+			res = -ENOMEM;
+			goto out;
+		}
+		memcpy(out + end, var, rsize);
+		end += rsize;
+	}
+
+	/* append new variables in the order of the batch */
+	for (n = 0; n < count; n++) {
+		const ebg_kv_t **found;
+		size_t i;
+
+		found = bsearch(kvs[n].key, sorted, unique, sizeof(*sorted),
+				uservar_key_cmp);
+		i = found - sorted;
+		if (*found != &kvs[n] || applied[i]) {
+			continue;
+		}
+		applied[i] = true;
+		if (kvs[n].type & USERVAR_TYPE_DELETED) {
+			continue;
+		}
+		if (!uservar_append_kv(out, size, &end, &kvs[n])) {
+			res = -ENOMEM;
+			goto out;
+		}
+	}
+
+	/* behind the longer of both lists, everything stays zero */
+	if (end < (uint32_t)(var - udata)) {
+		end = var - udata;
+	}
+	uservar_apply_changes(udata, out, end + 1 < size ? end + 1 : size, mark,
+			      ctx);
+	bgenv_uservar_index_invalidate(index);
+
+out:
+	free(out);
+	free(applied);
+	free(sorted);
+	return res;
+}
+
 uint8_t *bgenv_find_uservar(uint8_t *udata, const char *key)
 {
 	char *varkey;
@@ -255,9 +694,12 @@ uint8_t *bgenv_find_uservar(uint8_t *udata, const char *key)
 		return NULL;
 	}
 	while (*udata) {
-		bgenv_map_uservar(udata, &varkey, NULL, NULL, NULL, NULL);
+		uint64_t type;
+
+		bgenv_map_uservar(udata, &varkey, &type, NULL, NULL, NULL);
 
-		if (strcmp(varkey, key) == 0) {
+		if (strcmp(varkey, key) == 0 &&
+		    !(type & USERVAR_TYPE_DELETED)) {
 			return udata;
 		}
 		udata = bgenv_next_uservar(udata);
@@ -265,6 +707,28 @@ uint8_t *bgenv_find_uservar(uint8_t *udata, const char *key)
 	return NULL;
 }
 
+uint8_t *bgenv_find_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+				    uint32_t size, const char *key)
+{
+	if (!udata) {
+		return NULL;
+	}
+	if (uservar_index_prepare(index, udata, size) && index->slots) {
+		uint32_t mask = index->num_slots - 1;
+
+		for (uint32_t i = env_hash_str(key) & mask; index->slots[i];
+		     i = (i + 1) & mask) {
+			uint8_t *var = udata + index->slots[i] - 1;
+
+			if (strcmp((char *)var, key) == 0) {
+				return var;
+			}
+		}
+		return NULL;
+	}
+	return bgenv_find_uservar(udata, key);
+}
+
 uint8_t *bgenv_next_uservar(uint8_t *udata)
 {
 	uint32_t record_size;
@@ -274,36 +738,158 @@ uint8_t *bgenv_next_uservar(uint8_t *udata)
 	return udata + record_size;
 }
 
-void bgenv_del_uservar(uint8_t *udata, uint8_t *var)
+void bgenv_del_uservar(uint8_t *udata, uint32_t size, uint8_t *var)
+{
+	bgenv_del_uservar_indexed(NULL, udata, size, var);
+}
+
+void bgenv_del_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+			       uint32_t size, uint8_t *var)
 {
 	uint32_t spaceleft;
 	uint32_t rsize;
 
+	if (ebgenv_opts.deferred_compaction) {
+		uservar_index_forget(index, udata, var);
+		uservar_mark_deleted(var);
+		return;
+	}
+
 	/* Get the record size of the variable */
 	bgenv_map_uservar(var, NULL, NULL, NULL, &rsize, NULL);
 
 	/* Move variable out of place and close gap. */
-	spaceleft = bgenv_user_free(udata);
+	spaceleft = bgenv_user_free_indexed(index, udata, size);
+	uservar_index_remove(index, udata, var, rsize);
 
 	memmove(var,
 	        var + rsize,
-	        ENV_MEM_USERVARS - spaceleft - (var - udata) - rsize);
+	        size - spaceleft - (var - udata) - rsize);
 
 	spaceleft = spaceleft + rsize;
 
-	memset(udata + ENV_MEM_USERVARS - spaceleft, 0, spaceleft);
+	memset(udata + size - spaceleft, 0, spaceleft);
+}
+
+uint8_t *bgenv_find_deleted_uservar(uint8_t *udata)
+{
+	while (*udata) {
+		if (uservar_is_deleted(udata)) {
+			return udata;
+		}
+		udata = bgenv_next_uservar(udata);
+	}
+	return NULL;
 }
 
-uint32_t bgenv_user_free(uint8_t *udata)
+void bgenv_compact_uservars(USERVAR_INDEX *index, uint8_t *udata)
+{
+	uint8_t *var = udata, *out = udata;
+	uint32_t rsize;
+
+	/* a single pass moving every live record down */
+	while (*var) {
+		bgenv_map_uservar(var, NULL, NULL, NULL, &rsize, NULL);
+		if (!uservar_is_deleted(var)) {
+			if (out != var) {
+				memmove(out, var, rsize);
+			}
+			out += rsize;
+		}
+		var += rsize;
+	}
+	if (out == var) {
+		return;
+	}
+	memset(out, 0, var - out);
+	bgenv_uservar_index_invalidate(index);
+}
+
+void bgenv_uservar_iter_init(ebg_env_iter_t *it, const uint8_t *udata,
+			     uint32_t size, const char *prefix)
+{
+	it->pos = udata;
+	it->end = udata + size;
+	it->prefix = prefix;
+	it->prefix_len = prefix ? strlen(prefix) : 0;
+}
+
+bool bgenv_uservar_iter_next(ebg_env_iter_t *it, ebg_kv_t *kv)
+{
+	while (it->pos && it->pos < it->end && *it->pos) {
+		uint8_t *var = (uint8_t *)it->pos;
+		uint32_t rsize, dsize;
+		uint64_t type;
+		uint8_t *val;
+		char *key;
+
+		bgenv_map_uservar(var, &key, &type, &val, &rsize, &dsize);
+		/* do not follow a corrupt record out of the user data */
+		if (rsize == 0 || rsize > (size_t)(it->end - var) ||
+		    dsize > rsize) {
+			VERBOSE(stderr, "Corrupt user variable, stopping "
+					"iteration.\n");
+			it->pos = it->end;
+			return false;
+		}
+		it->pos = var + rsize;
+		if (type & USERVAR_TYPE_DELETED) {
+			continue;
+		}
+		if (it->prefix_len &&
+		    strncmp(key, it->prefix, it->prefix_len) != 0) {
+			continue;
+		}
+		kv->key = key;
+		kv->type = type;
+		kv->value = val;
+		kv->datalen = dsize;
+		return true;
+	}
+	return false;
+}
+
+uint32_t bgenv_user_free(uint8_t *udata, uint32_t size)
+{
+	return bgenv_user_free_indexed(NULL, udata, size);
+}
+
+uint32_t bgenv_user_deleted(uint8_t *udata, uint32_t size)
+{
+	uint32_t end = 0, deleted = 0, rsize;
+
+	if (!udata) {
+		return 0;
+	}
+	while (end < size && udata[end]) {
+		uint64_t type;
+
+		bgenv_map_uservar(udata + end, NULL, &type, NULL, &rsize, NULL);
+		if (rsize == 0 || rsize > size - end) {
+			break;
+		}
+		if (type & USERVAR_TYPE_DELETED) {
+			deleted += rsize;
+		}
+		end += rsize;
+	}
+	return deleted;
+}
+
+uint32_t bgenv_user_free_indexed(USERVAR_INDEX *index, uint8_t *udata,
+				 uint32_t size)
 {
 	uint32_t rsize;
 	uint32_t spaceleft;
 
-	spaceleft = ENV_MEM_USERVARS;
+	spaceleft = size;
 
 	if (!udata) {
 		return 0;
 	}
+	if (uservar_index_prepare(index, udata, size)) {
+		return size - index->end;
+	}
 	if (!*udata) {
 		return spaceleft;
 	}
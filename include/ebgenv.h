@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define USERVAR_TYPE_CHAR		1
@@ -39,6 +40,11 @@
 typedef struct {
 	bool search_all_devices;
 	bool verbose;
+	bool parallel_probe;
+	bool probe_cache;
+	bool inplace_write;
+	bool crc_cross_check;
+	bool deferred_compaction;
 } ebgenv_opts_t;
 
 typedef struct {
@@ -47,7 +53,43 @@ typedef struct {
 	ebgenv_opts_t opts;
 } ebgenv_t;
 
-typedef enum { EBG_OPT_PROBE_ALL_DEVICES, EBG_OPT_VERBOSE } ebg_opt_t;
+/* Library context, see ebg_ctx_new. */
+typedef struct ebg_ctx ebg_ctx_t;
+
+typedef enum {
+	EBG_OPT_PROBE_ALL_DEVICES,
+	EBG_OPT_VERBOSE,
+	/* probe candidate config partitions and read their environments
+	 * concurrently */
+	EBG_OPT_PARALLEL_PROBE,
+	/* reuse config partitions found by a previous probe, see
+	 * probe_config_partitions */
+	EBG_OPT_PROBE_CACHE,
+	/* rewrite only changed parts of the environment, then sync once */
+	EBG_OPT_INPLACE_WRITE,
+	/* verify incremental CRC32 updates against a full recomputation */
+	EBG_OPT_CRC_CROSS_CHECK,
+	/* mark deleted user variables and compact them once on close */
+	EBG_OPT_DEFERRED_COMPACTION,
+} ebg_opt_t;
+
+typedef struct {
+	const char *key;
+	uint64_t type;
+	const uint8_t *value;
+	uint32_t datalen;
+} ebg_kv_t;
+
+/* Position of an iteration over the user variables of an environment.
+ * The members are private to the library. The reserved space keeps the
+ * size of the type stable if they change. */
+typedef struct {
+	const uint8_t *pos;
+	const uint8_t *end;
+	const char *prefix;
+	size_t prefix_len;
+	void *reserved[4];
+} ebg_env_iter_t;
 
 /**
  * @brief Set a global EBG option. Call before creating the ebg env.
@@ -118,6 +160,20 @@ int ebg_env_set(ebgenv_t *e, const char *key, const char *value);
 int ebg_env_set_ex(ebgenv_t *e, const char *key, uint64_t datatype,
 		   const uint8_t *value, uint32_t datalen);
 
+/** @brief Store or delete multiple variables at once
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param kvs array of variables to set. Entries with the type flag
+ *         USERVAR_TYPE_DELETED delete the variable. If a key is given
+ *         multiple times, the last entry wins.
+ *  @param count number of entries in kvs
+ *  @return 0 on success, -errno on failure. On failure, the environment
+ *          is left unchanged.
+ *  @note All user variables are updated in one pass over the user data,
+ *        which is considerably faster than calling ebg_env_set_ex for
+ *        each variable.
+ */
+int ebg_env_set_many(ebgenv_t *e, const ebg_kv_t *kvs, size_t count);
+
 /** @brief Get content of user variable
  *  @param e A pointer to an ebgenv_t context.
  *  @param key name of the environment variable to retrieve
@@ -129,9 +185,37 @@ int ebg_env_set_ex(ebgenv_t *e, const char *key, uint64_t datatype,
 int ebg_env_get_ex(ebgenv_t *e, const char *key, uint64_t *datatype,
 		   uint8_t *buffer, uint32_t maxlen);
 
+/** @brief Start an iteration over all user variables
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param it iterator to initialize
+ *  @return 0 on success, errno on failure
+ */
+int ebg_env_iter_begin(ebgenv_t *e, ebg_env_iter_t *it);
+
+/** @brief Start an iteration over the user variables with a key prefix
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param it iterator to initialize
+ *  @param prefix only variables whose keys start with prefix are returned.
+ *         The string must stay valid during the iteration.
+ *  @return 0 on success, errno on failure
+ */
+int ebg_env_iter_begin_prefix(ebgenv_t *e, ebg_env_iter_t *it,
+			      const char *prefix);
+
+/** @brief Get the next user variable of an iteration
+ *  @param it iterator started by ebg_env_iter_begin(_prefix)
+ *  @param kv receives key, type, size and value of the variable. Key and
+ *         value point directly into the environment, nothing is copied.
+ *  @return true if a variable was returned, false at the end
+ *  @note Modifying the user variables invalidates all running iterations
+ *        and the returned pointers.
+ */
+bool ebg_env_iter_next(ebg_env_iter_t *it, ebg_kv_t *kv);
+
 /** @brief Get available space for user variables
  *  @param e A pointer to an ebgenv_t context.
- *  @return Free space in bytes
+ *  @return Free space in bytes, including the space of deleted variables
+ *          that are not compacted yet
  */
 uint32_t ebg_env_user_free(ebgenv_t *e);
 
@@ -169,3 +253,48 @@ int ebg_env_register_gc_var(ebgenv_t *e, char *key);
  *  @return 0 on success, errno on failure
  */
 int ebg_env_finalize_update(ebgenv_t *e);
+
+/** @brief Create a library context. It owns the config partitions and
+ *         their environments, which are probed and read only once here
+ *         instead of on every ebg_env_open_current / ebg_env_close cycle.
+ *  @return the new context, NULL on failure
+ *  @note Handles opened on a context lock it until ebg_env_close: read-only
+ *        ones shared, so that several threads can read in parallel, writing
+ *        ones exclusively. Options set by ebg_set_opt_bool are global.
+ */
+ebg_ctx_t *ebg_ctx_new(void);
+
+/** @brief Free a library context. No handle may be open on it anymore.
+ *  @param ctx context to free
+ */
+void ebg_ctx_free(ebg_ctx_t *ctx);
+
+/** @brief Read the environments of a context again, e.g. after they were
+ *         changed by another process.
+ *  @param ctx library context
+ *  @return 0 on success, errno on failure
+ */
+int ebg_ctx_reload(ebg_ctx_t *ctx);
+
+/** @brief Open the current environment of a context.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param ctx library context
+ *  @param readonly open for reading only. Setters then fail with -EPERM
+ *         and ebg_env_close does not write anything.
+ *  @return 0 on success, errno on failure
+ */
+int ebg_env_open_current_ctx(ebgenv_t *e, ebg_ctx_t *ctx, bool readonly);
+
+/** @brief Like ebg_env_create_new, but on the environments of a context.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param ctx library context
+ *  @return 0 on success, errno on failure
+ */
+int ebg_env_create_new_ctx(ebgenv_t *e, ebg_ctx_t *ctx);
+
+/** @brief Like ebg_env_getglobalstate, but on the environments of a
+ *         context.
+ *  @param ctx library context
+ *  @return ustate value
+ */
+uint16_t ebg_ctx_getglobalstate(ebg_ctx_t *ctx);
@@ -45,6 +45,7 @@
 #include <stdlib.h>
 
 #define SYSBLOCKDIR "/sys/block"
+#define SYSDEVBLOCKDIR "/sys/dev/block"
 #define DEVDIR "/dev"
 
 #define LB_SIZE 512
@@ -119,6 +120,8 @@ typedef enum {
 typedef struct _PedPartition {
 	EbgFileSystemType fs_type;
 	uint16_t num;
+	char *path;
+	char uuid[37];
 	struct _PedPartition *next;
 } PedPartition;
 
@@ -140,3 +143,7 @@ PedPartition *ped_disk_next_partition(const PedDisk *pd,
 				      const PedPartition *part);
 
 void ebgpart_beverbose(bool v);
+/* Prefix the sysfs and dev directories, used by tests */
+void ebgpart_set_sysroot(const char *root);
+/* Identify the partition table of a disk, changes whenever it is altered */
+bool ebgpart_read_disk_id(const char *path, char *id, size_t maxlen);
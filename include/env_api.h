@@ -26,12 +26,14 @@
 #include <mntent.h>
 #include <fcntl.h>
 #include <uchar.h>
+#include <pthread.h>
 #include <sys/file.h>
 #include <sys/mount.h>
 
 #include "config.h"
 #include "envdata.h"
 #include "ebgenv.h"
+#include "uservars.h"
 
 #ifdef DEBUG
 #define printf_debug(fmt, ...) printf(fmt, __VA_ARGS__)
@@ -58,15 +60,75 @@ typedef enum {
 	EBGENV_UNKNOWN
 } EBGENVKEY;
 
+#define ENV_LAYOUT_LEGACY 0
+#define ENV_LAYOUT_V2 2
+
+/* On-disk layout of an environment file, see BG_ENVHDR */
+typedef struct {
+	uint16_t version;
+	uint16_t num_config_parts;
+	uint32_t userdata_size;
+} ENV_LAYOUT;
+
 typedef struct {
 	char *devpath;
 	char *mountpoint;
 	bool not_mounted;
+	ENV_LAYOUT layout;
 } CONFIG_PART;
 
+/*
+ * Byte ranges of the environment changed since its CRC32 was last valid.
+ * The CRC32 is patched with the old and new contents of these ranges
+ * instead of being recomputed over the whole environment.
+ */
+#define BGENV_CRC_MAX_RANGES 8
+
+typedef struct {
+	uint32_t start;
+	uint32_t end;
+} BGENV_CRC_RANGE;
+
+typedef struct {
+	BGENV_CRC_RANGE ranges[BGENV_CRC_MAX_RANGES];
+	uint32_t num_ranges;
+	uint32_t delta;
+	bool tracking;
+	bool full;
+} BGENV_CRC_STATE;
+
+/*
+ * A library context owns the discovered config partitions and the
+ * environments read from them, each sized by the layout of its file.
+ * Handles of a context hold its lock, shared for reading and exclusively
+ * for writing. A NULL context refers to the process-wide default one,
+ * which is set up by bgenv_init.
+ */
+struct ebg_ctx {
+	CONFIG_PART *parts;
+	BG_ENVDATA **envdata;
+	uint32_t num_parts;
+	bool initialized;
+	pthread_rwlock_t lock;
+};
+
+typedef struct ebg_ctx EBG_CONTEXT;
+
+/* context of the legacy API, taken by ebg_env_open_current and friends */
+extern EBG_CONTEXT bgenv_default_ctx;
+
 typedef struct {
 	void *desc;
 	BG_ENVDATA *data;
+	/* user variables behind data, see env_layout_userdata_size */
+	uint32_t userdata_size;
+	USERVAR_INDEX uservar_index;
+	BGENV_CRC_STATE crc;
+	/* set for handles of an explicit context only */
+	EBG_CONTEXT *ctx;
+	bool readonly;
+	/* set if the handle holds the lock of the default context */
+	bool default_locked;
 } BGENV;
 
 typedef struct gc_item {
@@ -83,18 +145,38 @@ extern uint32_t bgenv_crc32(uint32_t, const void *, size_t);
 
 extern bool bgenv_init(void);
 extern void bgenv_finalize(void);
+extern uint32_t bgenv_num_config_parts(void);
+extern uint32_t bgenv_ctx_num_config_parts(EBG_CONTEXT *ctx);
 extern BGENV *bgenv_open_by_index(uint32_t index);
 extern BGENV *bgenv_open_oldest(void);
 extern BGENV *bgenv_open_latest(void);
+
+extern bool bgenv_ctx_init(EBG_CONTEXT *ctx);
+extern void bgenv_ctx_finalize(EBG_CONTEXT *ctx);
+extern bool bgenv_ctx_reload(EBG_CONTEXT *ctx);
+extern BGENV *bgenv_ctx_open_by_index(EBG_CONTEXT *ctx, uint32_t index);
+extern BGENV *bgenv_ctx_open_oldest(EBG_CONTEXT *ctx);
+extern BGENV *bgenv_ctx_open_latest(EBG_CONTEXT *ctx);
 extern bool bgenv_write(BGENV *env);
 extern BG_ENVDATA *bgenv_read(const BGENV *env);
 extern void bgenv_close(BGENV *env);
 
 extern BGENV *bgenv_create_new(void);
+extern BGENV *bgenv_ctx_create_new(EBG_CONTEXT *ctx);
 extern int bgenv_get(BGENV *env, const char *key, uint64_t *type, void *data,
 		     uint32_t maxlen);
 extern int bgenv_set(BGENV *env, const char *key, uint64_t type,
 		     const void *data, uint32_t datalen);
+extern int bgenv_set_many(BGENV *env, const ebg_kv_t *kvs, size_t count);
 extern uint8_t *bgenv_find_uservar(uint8_t *userdata, const char *key);
+extern void bgenv_compact(BGENV *env);
+extern bool bgenv_copy(BGENV *dst, const BGENV *src);
+
+extern void bgenv_crc_mark_dirty(BGENV *env, size_t offset, size_t len);
+extern void bgenv_crc_mark_full(BGENV *env);
+#define BGENV_CRC_MARK_FIELD(env, field)                                       \
+	bgenv_crc_mark_dirty(env, offsetof(BG_ENVDATA, field),                 \
+			     sizeof(((BG_ENVDATA *)0)->field))
+extern void bgenv_crc_update(BGENV *env);
 
-extern bool validate_envdata(BG_ENVDATA *data);
+extern bool validate_envdata(BG_ENVDATA *data, uint32_t userdata_size);
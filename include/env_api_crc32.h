@@ -0,0 +1,44 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Standard CRC32 (as used by zlib and GPT), chainable via crc. */
+extern uint32_t bgenv_crc32(uint32_t crc, const void *buf, size_t size);
+
+/* CRC32 of A followed by B, given crc1 of A, crc2 of B and the size of B. */
+extern uint32_t bgenv_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+/*
+ * Contribution of size bytes at buf, followed by tail more bytes, to the
+ * CRC32 of the whole message. As CRC32 is linear, replacing a range of a
+ * message changes its CRC32 by delta(old range) ^ delta(new range), with
+ * tail being the number of bytes after the range.
+ */
+extern uint32_t bgenv_crc32_delta(const void *buf, size_t size, size_t tail);
+
+/*
+ * A CRC32 implementation. update() operates on the raw CRC register, i.e.
+ * without the pre- and post-inversion done by bgenv_crc32().
+ */
+typedef struct {
+	const char *name;
+	bool (*supported)(void);
+	uint32_t (*update)(uint32_t crc, const uint8_t *p, size_t size);
+} BGENV_CRC32_IMPL;
+
+/* All implementations built for this architecture, best one first. */
+extern const BGENV_CRC32_IMPL bgenv_crc32_impls[];
+extern const size_t bgenv_crc32_num_impls;
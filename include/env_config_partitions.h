@@ -18,4 +18,9 @@
 
 #include "env_api.h"
 
-bool probe_config_partitions(CONFIG_PART *cfgpart, bool search_all_devices);
+/*
+ * Fills cfgpart, which has room for ENV_V2_MAX_CONFIG_PARTS entries, with
+ * the config partitions found and stores their number in count.
+ */
+bool probe_config_partitions(CONFIG_PART *cfgpart, uint32_t *count,
+			     bool search_all_devices);
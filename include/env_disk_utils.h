@@ -18,6 +18,9 @@
 
 #include "env_api.h"
 
+/* Each mount_table_load must be paired with a mount_table_free. */
+bool mount_table_load(void);
+void mount_table_free(void);
 char *get_mountpoint(const char *devpath);
 bool mount_partition(CONFIG_PART *cfgpart);
 void unmount_partition(CONFIG_PART *cfgpart);
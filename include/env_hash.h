@@ -0,0 +1,26 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* FNV-1a hash of a string, for the hash tables of the library */
+static inline uint32_t env_hash_str(const char *s)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*s) {
+		hash ^= (uint8_t)*s++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
@@ -0,0 +1,57 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "env_api.h"
+
+typedef ssize_t (*env_pread_fn)(void *ctx, void *buf, size_t count,
+				off64_t offset);
+
+/* Size of an environment file with the given layout */
+size_t env_layout_file_size(const ENV_LAYOUT *layout);
+
+/* Size of the user variables of an environment with the given layout */
+uint32_t env_layout_userdata_size(const ENV_LAYOUT *layout);
+
+/*
+ * Parse the layout and turn a valid file into an environment in memory,
+ * sized for the user variables of that layout. The returned environment
+ * must be freed by the caller.
+ */
+BG_ENVDATA *env_layout_read(env_pread_fn read_fn, void *ctx,
+			    ENV_LAYOUT *layout);
+
+/*
+ * Serialize an environment with userdata_size bytes of user variables in
+ * the given layout. Fails if the user variables do not fit. The returned
+ * buffer must be freed by the caller.
+ */
+uint8_t *env_layout_encode(const BG_ENVDATA *env, uint32_t userdata_size,
+			   const ENV_LAYOUT *layout, size_t *size);
+
+/*
+ * Environments in memory end with the CRC32 behind their user variables,
+ * so the crc32 member of BG_ENVDATA is only valid for ENV_MEM_USERVARS.
+ */
+uint32_t env_data_crc32(const BG_ENVDATA *env, uint32_t userdata_size);
+void env_data_set_crc32(BG_ENVDATA *env, uint32_t userdata_size,
+			uint32_t crc32);
+
+/* Zeroed environment with a valid CRC32, to be freed by the caller */
+BG_ENVDATA *env_data_alloc(uint32_t userdata_size);
+
+/* env_pread_fn for a file descriptor passed by reference */
+ssize_t env_layout_fd_pread(void *ctx, void *buf, size_t count,
+			    off64_t offset);
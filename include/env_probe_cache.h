@@ -0,0 +1,33 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "env_api.h"
+
+#define PROBE_CACHE_FILE "/run/efibootguard-probe.cache"
+
+/* Where a config partition was found */
+typedef struct {
+	const char *devpath;
+	const char *diskpath;
+	const char *uuid;
+} PROBE_CACHE_ENTRY;
+
+extern const char *probe_cache_file;
+
+bool probe_cache_load(CONFIG_PART *cfgpart, uint32_t *num_parts,
+		      bool search_all_devices);
+void probe_cache_store(const PROBE_CACHE_ENTRY *entries, uint32_t count,
+		       bool search_all_devices);
+bool probe_cache_invalidate(void);
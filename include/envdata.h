@@ -44,3 +44,52 @@ struct _BG_ENVDATA {
 #pragma pack(pop)
 
 typedef struct _BG_ENVDATA BG_ENVDATA;
+
+/*
+ * Self-describing environment layout. The file starts with BG_ENVHDR,
+ * followed by the members of BG_ENVDATA up to userdata, userdata_size
+ * bytes of user variables and a CRC32 over everything before it. Files
+ * without the magic have the BG_ENVDATA layout of the build.
+ *
+ * Headers of at least sizeof(BG_ENVHDR) bytes carry fixed_crc32, the CRC32
+ * of the header and the fixed members, calculated with fixed_crc32 set to
+ * zero. This allows to select an environment without reading its user
+ * variables.
+ */
+#define ENV_V2_MAGIC "EBGENV02"
+#define ENV_V2_MAGIC_LEN 8
+
+#define ENV_V2_MAX_HEADER_SIZE 4096
+#define ENV_V2_MAX_CONFIG_PARTS 16
+#define ENV_V2_MIN_USERVARS 96
+#define ENV_V2_MAX_USERVARS (16 * 1024 * 1024)
+
+#pragma pack(push)
+#pragma pack(1)
+struct _BG_ENVHDR {
+	uint8_t magic[ENV_V2_MAGIC_LEN];
+	uint16_t header_size;
+	uint16_t num_config_parts;
+	uint32_t userdata_size;
+	uint32_t fixed_crc32;
+};
+#pragma pack(pop)
+
+typedef struct _BG_ENVHDR BG_ENVHDR;
+
+/* header without fixed_crc32 */
+#define ENV_V2_BASE_HEADER_SIZE (sizeof(BG_ENVHDR) - sizeof(uint32_t))
+
+/* size of the members in front of userdata */
+#define ENV_FIXED_SIZE                                                         \
+	(sizeof(BG_ENVDATA) - ENV_MEM_USERVARS - sizeof(uint32_t))
+
+/*
+ * size of an environment in memory, with the CRC32 behind userdata_size
+ * bytes of user variables
+ */
+#define ENV_DATA_SIZE(userdata_size)                                           \
+	(ENV_FIXED_SIZE + (userdata_size) + sizeof(uint32_t))
+
+#define ENV_V2_FILE_SIZE(header_size, userdata_size)                           \
+	((header_size) + ENV_DATA_SIZE(userdata_size))
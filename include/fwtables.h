@@ -0,0 +1,60 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2020-2023
+ *
+ * Authors:
+ *  Dr. Johann Pfefferl <johann.pfefferl@siemens.com>
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#pragma pack(1)
+
+/* Root System Description Pointer  (ACPI section 5.2.5.3) */
+typedef struct {
+    CHAR8   signature[8];
+    UINT8   checksum;
+    UINT8   oem_id[6];
+    UINT8   revision;
+    UINT32  rsdt_address;
+    UINT32  length;
+    UINT64  xsdt_address;
+    UINT8   extended_checksum;
+    UINT8   reserved[3];
+} EFI_ACPI_ROOT_SDP_HEADER;
+
+/* System Description Table  (ACPI section 5.2.6) */
+typedef struct {
+	CHAR8   signature[4];
+	UINT32  length;
+	UINT8   revision;
+	UINT8   checksum;
+	CHAR8   oem_id[6];
+	CHAR8   oem_table_id[8];
+	UINT32  oem_revision;
+	UINT32  creator_id;
+	UINT32  creator_revision;
+} EFI_ACPI_SDT_HEADER;
+
+#pragma pack()
+
+/*
+ * The firmware tables are indexed on first use and shared by all drivers,
+ * so they are scanned only once per boot.
+ */
+
+/* Returns the given instance of an ACPI table, NULL if there is none */
+EFI_ACPI_SDT_HEADER *acpi_find_table(const CHAR8 *signature, UINTN instance);
+
+/* Returns the given instance of an SMBIOS structure, Raw is NULL if none */
+SMBIOS_STRUCTURE_POINTER smbios_find_struct(UINT8 type, UINTN instance);
@@ -14,8 +14,25 @@
 
 #pragma once
 
+#define BG_MAX_BOOT_PHASES 8
+
+typedef struct _BG_BOOT_PHASE {
+	const CHAR16 *name;
+	UINT64 start_usec;
+	UINT64 end_usec;
+} BG_BOOT_PHASE;
+
+typedef struct _BG_BOOT_TIMING {
+	BG_BOOT_PHASE phases[BG_MAX_BOOT_PHASES];
+	UINTN count;
+} BG_BOOT_TIMING;
+
 typedef struct _BG_INTERFACE_PARAMS {
 	CHAR16 *loader_device_part_uuid;
+	/* timestamps in microseconds, 0 if unknown */
+	UINT64 time_init_usec;
+	UINT64 time_exec_usec;
+	const BG_BOOT_TIMING *timing;
 } BG_INTERFACE_PARAMS;
 
 // systemd bootloader interface vendor id
@@ -23,3 +40,14 @@ extern EFI_GUID vendor_guid;
 
 EFI_STATUS set_bg_interface_vars(const BG_INTERFACE_PARAMS *params);
 CHAR16 *disk_get_part_uuid(EFI_HANDLE *handle);
+
+/*
+ * Microseconds since an arbitrary point before the boot loader was started,
+ * based on the CPU counter. Returns 0 if no counter is available.
+ */
+UINT64 time_usec(VOID);
+
+VOID boot_phase_begin(BG_BOOT_TIMING *timing, const CHAR16 *name);
+VOID boot_phase_end(BG_BOOT_TIMING *timing);
+/* Reads a timestamp exported by a previous stage, 0 if not available */
+UINT64 get_interface_time(const CHAR16 *name);
@@ -0,0 +1,45 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#pragma once
+
+#include <efi.h>
+
+/* polling starts at the minimum delay and doubles up to the maximum */
+#define PORT_POLL_MIN_DELAY_US	1
+#define PORT_POLL_MAX_DELAY_US	10000
+
+/* for port_wait_status() callers that are only limited by an event */
+#define PORT_WAIT_NO_TIMEOUT	0
+
+/* A command exchanged through a sequence of port handshakes */
+typedef struct {
+	const CHAR16 *name;
+	UINT64 start_usec;
+	UINTN waited_usec;
+	UINTN polls;
+} PORT_TRANSACTION;
+
+VOID port_transaction_begin(PORT_TRANSACTION *transaction,
+			    const CHAR16 *name);
+/* Logs the latency of the transaction */
+VOID port_transaction_end(const PORT_TRANSACTION *transaction,
+			  EFI_STATUS status);
+
+/*
+ * Waits until (status & mask) == value on the given status port.
+ * Returns EFI_DEVICE_ERROR if all bits of error_mask are set and
+ * EFI_TIMEOUT once timeout_us passed or the deadline event, if any, is
+ * signaled. The transaction, if any, accounts the polls and delays.
+ */
+EFI_STATUS port_wait_status(UINT16 port, UINT8 mask, UINT8 value,
+			    UINT8 error_mask, UINTN timeout_us,
+			    EFI_EVENT deadline, PORT_TRANSACTION *transaction);
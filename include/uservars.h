@@ -15,21 +15,80 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "ebgenv.h"
+
+/*
+ * Optional lookup index over the user variables of one environment. A
+ * zero-initialized index is valid and gets built on first use. It has to be
+ * invalidated whenever the user variables are modified by other means than
+ * the *_indexed functions taking it.
+ */
+typedef struct {
+	uint32_t *slots;
+	uint32_t num_slots;
+	uint32_t num_vars;
+	uint32_t end;
+	bool valid;
+} USERVAR_INDEX;
+
+void bgenv_uservar_index_invalidate(USERVAR_INDEX *index);
+
 void bgenv_map_uservar(uint8_t *udata, char **key, uint64_t *type,
 		       uint8_t **val, uint32_t *record_size,
 		       uint32_t *data_size);
 
+/*
+ * The user variables of an environment take size bytes at udata. Lookups
+ * stop at the end of the list, which valid user variables always have.
+ */
 int bgenv_get_uservar(uint8_t *udata, const char *key, uint64_t *type,
 		      void *data, uint32_t maxlen);
-int bgenv_set_uservar(uint8_t *udata, const char *key, uint64_t type,
-		      const void *data, uint32_t datalen);
+int bgenv_set_uservar(uint8_t *udata, uint32_t size, const char *key,
+		      uint64_t type, const void *data, uint32_t datalen);
 
 uint8_t *bgenv_find_uservar(uint8_t *udata, const char *key);
 uint8_t *bgenv_next_uservar(uint8_t *udata);
 
-void bgenv_del_uservar(uint8_t *udata, uint8_t *var);
-uint32_t bgenv_user_free(uint8_t *udata);
+void bgenv_del_uservar(uint8_t *udata, uint32_t size, uint8_t *var);
+uint32_t bgenv_user_free(uint8_t *udata, uint32_t size);
+
+int bgenv_get_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+			      uint32_t size, const char *key, uint64_t *type,
+			      void *data, uint32_t maxlen);
+int bgenv_set_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+			      uint32_t size, const char *key, uint64_t type,
+			      const void *data, uint32_t datalen);
+uint8_t *bgenv_find_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+				    uint32_t size, const char *key);
+void bgenv_del_uservar_indexed(USERVAR_INDEX *index, uint8_t *udata,
+			       uint32_t size, uint8_t *var);
+uint32_t bgenv_user_free_indexed(USERVAR_INDEX *index, uint8_t *udata,
+				 uint32_t size);
+/*
+ * Called by bgenv_set_uservars_many for each range of the user variables
+ * right before it is modified.
+ */
+typedef void (*uservar_mark_fn)(void *ctx, uint32_t offset, uint32_t len);
+
+int bgenv_set_uservars_many(USERVAR_INDEX *index, uint8_t *udata,
+			    uint32_t size, const ebg_kv_t *kvs, size_t count,
+			    uservar_mark_fn mark, void *ctx);
+
+/*
+ * With EBG_OPT_DEFERRED_COMPACTION, deleted and resized variables leave
+ * records marked as USERVAR_TYPE_DELETED behind. They are dropped by
+ * bgenv_compact_uservars, which is done automatically when space runs out.
+ */
+uint8_t *bgenv_find_deleted_uservar(uint8_t *udata);
+void bgenv_compact_uservars(USERVAR_INDEX *index, uint8_t *udata);
+/* Bytes taken by such records, they are free once compacted. */
+uint32_t bgenv_user_deleted(uint8_t *udata, uint32_t size);
+
+bool bgenv_validate_uservars(uint8_t *udata, uint32_t size);
 
-bool bgenv_validate_uservars(uint8_t *udata);
+void bgenv_uservar_iter_init(ebg_env_iter_t *it, const uint8_t *udata,
+			     uint32_t size, const char *prefix);
+bool bgenv_uservar_iter_next(ebg_env_iter_t *it, ebg_kv_t *kv);
@@ -20,9 +20,16 @@
 
 #define MAX_INFO_SIZE 1024
 
+/*
+ * Volumes are opened and their labels are read on first use only, see
+ * volume_root() and volume_label().
+ */
 typedef struct _VOLUME_DESC {
+	EFI_HANDLE handle;
 	EFI_DEVICE_PATH *devpath;
 	BOOLEAN onbootmedium;
+	BOOLEAN open_failed;
+	BOOLEAN labels_read;
 	CHAR16 *fslabel;
 	CHAR16 *fscustomlabel;
 	EFI_FILE_HANDLE root;
@@ -35,6 +42,8 @@ extern CHAR16 *boot_medium_path;
 typedef enum { DOSFSLABEL, CUSTOMLABEL, NOLABEL } LABELMODE;
 
 EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count);
+EFI_FILE_HANDLE volume_root(VOLUME_DESC *volume);
+const CHAR16 *volume_label(VOLUME_DESC *volume, LABELMODE mode);
 EFI_STATUS close_volumes(VOLUME_DESC *volumes, UINTN count);
 EFI_DEVICE_PATH *FileDevicePathFromConfig(EFI_HANDLE device,
 					  CHAR16 *payloadpath);
@@ -18,18 +18,43 @@
 
 typedef EFI_STATUS (*WATCHDOG_PROBE)(EFI_PCI_IO *, UINT16, UINT16, UINTN);
 
+#define WATCHDOG_PCI_ANY_ID	0xffff
+
+typedef struct _WATCHDOG_PCI_ID {
+	UINT16 vendor_id;
+	UINT16 device_id;
+} WATCHDOG_PCI_ID;
+
+#define WATCHDOG_PCI_DEVICE(_vendor, _device)                                  \
+	{.vendor_id = (_vendor), .device_id = (_device)}
+
+#define WATCHDOG_NAME_LEN	16
+
+/*
+ * PCI drivers are probed for matching devices only, their table ends with
+ * a zero vendor ID. Platform drivers have no table and are probed exactly
+ * once, before any PCI driver, with a NULL pci_io. The name identifies the
+ * driver in the hint persisted for the next boot.
+ */
 typedef struct _WATCHDOG_DRIVER {
+	const CHAR8 *name;
 	WATCHDOG_PROBE probe;
+	const WATCHDOG_PCI_ID *pci_ids;
 	struct _WATCHDOG_DRIVER *next;
 } WATCHDOG_DRIVER;
 
 VOID register_watchdog(WATCHDOG_DRIVER *driver);
 
-#define WATCHDOG_REGISTER(_func)                                               \
-	static WATCHDOG_DRIVER this_driver = {.probe = _func};                 \
+#define WATCHDOG_REGISTER_PCI(_name, _func, _pci_ids)                          \
+	static WATCHDOG_DRIVER this_driver = {.name = (const CHAR8 *)_name,    \
+					      .probe = _func,                  \
+					      .pci_ids = _pci_ids};            \
 	static void __attribute__((constructor)) register_driver(void)         \
 	{                                                                      \
 		register_watchdog(&this_driver);                               \
 	}
 
+#define WATCHDOG_REGISTER_PLATFORM(_name, _func)                               \
+	WATCHDOG_REGISTER_PCI(_name, _func, NULL)
+
 EFI_STATUS probe_watchdogs(UINTN timeout);
@@ -0,0 +1,146 @@
+/*
+ * EFI Boot Guard, unified kernel stub
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "kernel-stub.h"
+
+#define LZ4_MIN_MATCH	4
+
+static BOOLEAN lz4_read_length(const UINT8 **src, const UINT8 *src_end,
+			       UINTN *length)
+{
+	UINT8 byte;
+
+	do {
+		if (*src >= src_end) {
+			return FALSE;
+		}
+		byte = *(*src)++;
+		if (byte > (UINTN) -1 - *length) {
+			return FALSE;
+		}
+		*length += byte;
+	} while (byte == 255);
+
+	return TRUE;
+}
+
+/*
+ * Decodes an LZ4 block until the output buffer is full. Unless only a prefix
+ * of the data is requested, the input has to be consumed completely then.
+ */
+static EFI_STATUS lz4_decompress(const UINT8 *src, UINTN src_size,
+				 UINT8 *dst, UINTN dst_size, BOOLEAN partial)
+{
+	const UINT8 *src_end = src + src_size;
+	UINT8 *out = dst, *dst_end = dst + dst_size;
+	UINTN length, offset;
+	UINT8 token;
+
+	while (src < src_end && out < dst_end) {
+		token = *src++;
+
+		length = token >> 4;
+		if (length == 15 && !lz4_read_length(&src, src_end, &length)) {
+			return EFI_LOAD_ERROR;
+		}
+		if (length > (UINTN) (src_end - src)) {
+			return EFI_LOAD_ERROR;
+		}
+		if (length > (UINTN) (dst_end - out)) {
+			if (!partial) {
+				return EFI_LOAD_ERROR;
+			}
+			length = dst_end - out;
+		}
+		CopyMem(out, (VOID *) src, length);
+		out += length;
+		src += length;
+
+		/* The last sequence consists of literals only. */
+		if (src == src_end || out == dst_end) {
+			break;
+		}
+
+		if (src_end - src < 2) {
+			return EFI_LOAD_ERROR;
+		}
+		offset = src[0] | (src[1] << 8);
+		src += 2;
+		if (offset == 0 || offset > (UINTN) (out - dst)) {
+			return EFI_LOAD_ERROR;
+		}
+
+		length = token & 0xf;
+		if (length == 15 && !lz4_read_length(&src, src_end, &length)) {
+			return EFI_LOAD_ERROR;
+		}
+		length += LZ4_MIN_MATCH;
+		if (length > (UINTN) (dst_end - out)) {
+			if (!partial) {
+				return EFI_LOAD_ERROR;
+			}
+			length = dst_end - out;
+		}
+		if (offset >= length) {
+			CopyMem(out, out - offset, length);
+			out += length;
+		} else {
+			/* Overlapping match, repeats the last offset bytes. */
+			for (; length > 0; length--, out++) {
+				*out = *(out - offset);
+			}
+		}
+	}
+
+	if (out != dst_end || (!partial && src != src_end)) {
+		return EFI_LOAD_ERROR;
+	}
+	return EFI_SUCCESS;
+}
+
+const COMPRESSED_SECTION *get_compressed_section(const VOID *data,
+						 UINTN size)
+{
+	const COMPRESSED_SECTION *section = data;
+
+	if (size < sizeof(*section) ||
+	    CompareMem(section->Magic, COMPRESSED_SECTION_MAGIC,
+		       sizeof(section->Magic)) != 0 ||
+	    section->CompressedSize > size - sizeof(*section)) {
+		return NULL;
+	}
+	return section;
+}
+
+/*
+ * Decompresses the first buffer_size bytes of the section. Passing the full
+ * UncompressedSize also validates that the payload ends there.
+ */
+EFI_STATUS decompress_section(const COMPRESSED_SECTION *section,
+			      VOID *buffer, UINTN buffer_size)
+{
+	if (buffer_size > section->UncompressedSize) {
+		return EFI_INVALID_PARAMETER;
+	}
+
+	switch (section->Algorithm) {
+	case COMPRESSION_LZ4:
+		return lz4_decompress((const UINT8 *) (section + 1),
+				      section->CompressedSize, buffer,
+				      buffer_size,
+				      buffer_size < section->UncompressedSize);
+	default:
+		return EFI_UNSUPPORTED;
+	}
+}
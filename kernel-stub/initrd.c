@@ -31,6 +31,7 @@ typedef struct {
 	EFI_LOAD_FILE_PROTOCOL protocol;
 	const void *addr;
 	UINTN size;
+	const COMPRESSED_SECTION *compressed;
 } INITRD_LOADER;
 
 #ifndef EfiLoadFile2Protocol
@@ -69,6 +70,7 @@ static EFIAPI EFI_STATUS initrd_load_file(EFI_LOAD_FILE_PROTOCOL *this,
 					  VOID *buffer)
 {
 	const INITRD_LOADER *loader = (INITRD_LOADER *) this;
+	EFI_STATUS status;
 
 	if (!loader || !file_path || !buffer_size) {
 		return EFI_INVALID_PARAMETER;
@@ -81,7 +83,16 @@ static EFIAPI EFI_STATUS initrd_load_file(EFI_LOAD_FILE_PROTOCOL *this,
 		return EFI_BUFFER_TOO_SMALL;
 	}
 
-	CopyMem(buffer, (VOID*)loader->addr, loader->size);
+	if (loader->compressed) {
+		status = decompress_section(loader->compressed, buffer,
+					    loader->size);
+		if (EFI_ERROR(status)) {
+			ERROR(L"Could not decompress initrd (%r)\n", status);
+			return status;
+		}
+	} else {
+		CopyMem(buffer, (VOID*)loader->addr, loader->size);
+	}
 	*buffer_size = loader->size;
 
 	return EFI_SUCCESS;
@@ -95,6 +106,12 @@ VOID install_initrd_loader(VOID *initrd, UINTN initrd_size)
 	initrd_loader.addr = initrd;
 	initrd_loader.size = initrd_size;
 
+	/* Compressed initrds are unpacked directly into the kernel's buffer. */
+	initrd_loader.compressed = get_compressed_section(initrd, initrd_size);
+	if (initrd_loader.compressed) {
+		initrd_loader.size = initrd_loader.compressed->UncompressedSize;
+	}
+
 	status = BS->InstallMultipleProtocolInterfaces(
 			&initrd_handle, &DevicePathProtocol,
 			&initrd_device_path, &EfiLoadFile2Protocol,
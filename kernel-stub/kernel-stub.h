@@ -20,3 +20,21 @@ EFI_STATUS replace_fdt(const VOID *fdt);
 
 VOID install_initrd_loader(VOID *initrd, UINTN initrd_size);
 VOID uninstall_initrd_loader(VOID);
+
+#define COMPRESSED_SECTION_MAGIC	"EBGZ"
+
+#define COMPRESSION_LZ4			1
+
+/* Header preceding the payload of compressed sections */
+typedef struct {
+	CHAR8 Magic[4];
+	UINT8 Algorithm;
+	UINT8 Reserved[3];
+	UINT32 CompressedSize;
+	UINT32 UncompressedSize;
+} __attribute__((packed)) COMPRESSED_SECTION;
+
+const COMPRESSED_SECTION *get_compressed_section(const VOID *data,
+						 UINTN size);
+EFI_STATUS decompress_section(const COMPRESSED_SECTION *section,
+			      VOID *buffer, UINTN buffer_size);
@@ -53,10 +53,16 @@ typedef struct {
 	CHAR8 Name[8];
 	UINT32 VirtualSize;
 	UINT32 VirtualAddress;
-	UINT8 Ignore[24];
+	UINT32 SizeOfRawData;
+	UINT8 Ignore[16];
+	UINT32 Characteristics;
 } __attribute__((packed)) SECTION;
 
+#define IMAGE_SCN_MEM_EXECUTE	0x20000000
+#define IMAGE_SCN_MEM_WRITE	0x80000000
+
 static EFI_LOADED_IMAGE kernel_image;
+static UINT8 kernel_headers[EFI_PAGE_SIZE];
 
 static EFI_PHYSICAL_ADDRESS align_addr(EFI_PHYSICAL_ADDRESS ptr,
 				       EFI_PHYSICAL_ADDRESS align)
@@ -78,6 +84,50 @@ static const SECTION *get_sections(const PE_HEADER *pe_header)
 				  pe_header->Coff.SizeOfOptionalHeader);
 }
 
+/*
+ * The kernel can run from where the firmware loaded its section if that is
+ * executable, writable, covers the complete kernel image and happens to be
+ * aligned as the kernel requires.
+ */
+static BOOLEAN can_run_in_place(const SECTION *kernel_section,
+				const VOID *kernel_source,
+				const PE_HEADER *pe_header)
+{
+	const UINT32 chars = IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_WRITE;
+
+	return (kernel_section->Characteristics & chars) == chars &&
+		kernel_section->VirtualSize >= pe_header->Opt.SizeOfImage &&
+		align_addr((uintptr_t) kernel_source,
+			   pe_header->Opt.SectionAlignment) ==
+			(uintptr_t) kernel_source;
+}
+
+/*
+ * Unpack the beginning of a compressed kernel so that its PE header can be
+ * evaluated before the kernel buffer is allocated.
+ */
+static const PE_HEADER *decompress_pe_header(const COMPRESSED_SECTION *kernel)
+{
+	const DOS_HEADER *dos_header = (const DOS_HEADER *) kernel_headers;
+	UINTN size = sizeof(kernel_headers);
+	EFI_STATUS status;
+
+	if (size > kernel->UncompressedSize) {
+		size = kernel->UncompressedSize;
+	}
+	if (size < sizeof(DOS_HEADER) + sizeof(PE_HEADER)) {
+		return NULL;
+	}
+
+	status = decompress_section(kernel, kernel_headers, size);
+	if (EFI_ERROR(status) ||
+	    dos_header->PEOffset > size - sizeof(PE_HEADER)) {
+		return NULL;
+	}
+
+	return get_pe_header(kernel_headers);
+}
+
 EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 {
 	const SECTION *cmdline_section = NULL;
@@ -86,7 +136,8 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	EFI_HANDLE kernel_handle = NULL;
 	BOOLEAN has_dtbs = FALSE;
 	const VOID *kernel_source;
-	EFI_PHYSICAL_ADDRESS kernel_buffer;
+	const COMPRESSED_SECTION *compressed_kernel;
+	EFI_PHYSICAL_ADDRESS kernel_buffer = 0;
 	EFI_PHYSICAL_ADDRESS aligned_kernel_buffer;
 	const CHAR8 *fdt_compatible;
 	const VOID *fdt, *alt_fdt = NULL;
@@ -95,12 +146,29 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	const PE_HEADER *pe_header;
 	const SECTION *section;
 	EFI_STATUS status, cleanup_status;
-	UINTN n, kernel_pages;
+	UINTN n, kernel_pages = 0;
+	UINTN data_size;
 	BG_INTERFACE_PARAMS bg_interface_params;
+	BG_BOOT_TIMING timing;
+	UINT64 entry_usec;
 
 	this_image = image_handle;
 	InitializeLib(image_handle, system_table);
 
+	ZeroMem(&bg_interface_params, sizeof(bg_interface_params));
+	ZeroMem(&timing, sizeof(timing));
+	entry_usec = time_usec();
+	bg_interface_params.time_init_usec = entry_usec;
+	bg_interface_params.timing = &timing;
+
+	/* time from the loader handing over until this stub took control */
+	timing.phases[0].start_usec = get_interface_time(L"LoaderTimeExecUSec");
+	if (timing.phases[0].start_usec && entry_usec) {
+		timing.phases[0].name = L"StartImage";
+		timing.phases[0].end_usec = entry_usec;
+		timing.count++;
+	}
+
 #if !defined(SILENT_BOOT)
 	PrintC(EFI_CYAN, L"Unified kernel stub (EFI Boot Guard %s)\n",
 	       L"" EFIBOOTGUARD_VERSION);
@@ -151,26 +219,58 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	}
 
 	if (initrd_section) {
+		boot_phase_begin(&timing, L"initrd");
 		install_initrd_loader(
 			(UINT8 *) stub_image->ImageBase +
 			initrd_section->VirtualAddress,
 			initrd_section->VirtualSize);
+		boot_phase_end(&timing);
+	}
+
+	kernel_source = (UINT8 *) stub_image->ImageBase +
+		kernel_section->VirtualAddress;
+
+	compressed_kernel = get_compressed_section(kernel_source,
+						   kernel_section->VirtualSize);
+	if (compressed_kernel) {
+		pe_header = decompress_pe_header(compressed_kernel);
+		if (!pe_header) {
+			ERROR(L"Invalid compressed kernel image\n");
+			status = EFI_LOAD_ERROR;
+			goto cleanup_initrd;
+		}
+	} else {
+		pe_header = get_pe_header(kernel_source);
+	}
+
+	if (!compressed_kernel &&
+	    can_run_in_place(kernel_section, kernel_source, pe_header)) {
+		boot_phase_begin(&timing, L"kernel_in_place");
+		kernel_image.ImageBase = (VOID *) kernel_source;
+		kernel_image.ImageSize = pe_header->Opt.SizeOfImage;
+
+		/* Only .bss needs to be cleared, the rest is in place. */
+		data_size = kernel_section->SizeOfRawData;
+		if (data_size < kernel_image.ImageSize) {
+			SetMem((UINT8 *) kernel_image.ImageBase + data_size,
+			       kernel_image.ImageSize - data_size, 0);
+		}
+		boot_phase_end(&timing);
+		goto register_kernel;
 	}
 
 	/*
 	 * Allocate new home for the kernel image. This is needed because
 	 *  - its section is either not executable or not writable
 	 *  - section alignment in virtual memory may not fit
+	 *  - it is compressed
 	 *
 	 * The new buffer size is based from SizeOfImage, aligned according to
 	 * the kernels SectionAlignment. As SectionAlignment may be larger than
 	 * the page size, over-allocate in order to adjust the base as needed.
 	 */
-	kernel_source = (UINT8 *) stub_image->ImageBase +
-		kernel_section->VirtualAddress;
-
-	pe_header = get_pe_header(kernel_source);
-
+	boot_phase_begin(&timing, compressed_kernel ? L"kernel_decompress" :
+						      L"kernel_copy");
 	kernel_pages = EFI_SIZE_TO_PAGES(pe_header->Opt.SizeOfImage +
 					 pe_header->Opt.SectionAlignment);
 	status = BS->AllocatePages(AllocateAnyPages, EfiLoaderData,
@@ -189,13 +289,31 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	}
 
 	kernel_image.ImageBase = (VOID *) (uintptr_t) aligned_kernel_buffer;
-	kernel_image.ImageSize = kernel_section->VirtualSize;
+	kernel_image.ImageSize = compressed_kernel ?
+		compressed_kernel->UncompressedSize : kernel_section->VirtualSize;
+	if (kernel_image.ImageSize > pe_header->Opt.SizeOfImage) {
+		kernel_image.ImageSize = pe_header->Opt.SizeOfImage;
+	}
 
-	CopyMem(kernel_image.ImageBase, (VOID*)kernel_source, kernel_image.ImageSize);
+	if (compressed_kernel) {
+		status = decompress_section(compressed_kernel,
+					    kernel_image.ImageBase,
+					    kernel_image.ImageSize);
+		if (EFI_ERROR(status)) {
+			ERROR(L"Could not decompress kernel image (%r)\n",
+			      status);
+			goto cleanup_buffer;
+		}
+	} else {
+		CopyMem(kernel_image.ImageBase, (VOID*)kernel_source,
+			kernel_image.ImageSize);
+	}
 	/* Clear the rest so that .bss is definitely zero. */
 	SetMem((UINT8 *) kernel_image.ImageBase + kernel_image.ImageSize,
 	       pe_header->Opt.SizeOfImage - kernel_image.ImageSize, 0);
+	boot_phase_end(&timing);
 
+register_kernel:
 	status = BS->InstallMultipleProtocolInterfaces(
 			&kernel_handle, &LoadedImageProtocol, &kernel_image,
 			NULL);
@@ -205,10 +323,12 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	}
 
 	if (alt_fdt) {
+		boot_phase_begin(&timing, L"fdt");
 		status = replace_fdt(alt_fdt);
 		if (EFI_ERROR(status)) {
 			goto cleanup_protocols;
 		}
+		boot_phase_end(&timing);
 		INFO(L"Using matched embedded device tree\n");
 	} else if (fdt_compatible) {
 		if (has_dtbs) {
@@ -220,11 +340,14 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	UINT16 *boot_medium_uuidstr =
 		disk_get_part_uuid(stub_image->DeviceHandle);
 	bg_interface_params.loader_device_part_uuid = boot_medium_uuidstr;
+	bg_interface_params.time_exec_usec = time_usec();
 	status = set_bg_interface_vars(&bg_interface_params);
 	if (EFI_ERROR(status)) {
 		WARNING(L"Could not set interface vars (%r)\n", status);
 	}
-	FreePool(boot_medium_uuidstr);
+	if (boot_medium_uuidstr) {
+		FreePool(boot_medium_uuidstr);
+	}
 
 	kernel_entry = (EFI_IMAGE_ENTRY_POINT)
 		((UINT8 *) kernel_image.ImageBase +
@@ -243,7 +366,9 @@ cleanup_protocols:
 		}
 	}
 cleanup_buffer:
-	BS->FreePages(kernel_buffer, kernel_pages);
+	if (kernel_pages > 0) {
+		BS->FreePages(kernel_buffer, kernel_pages);
+	}
 cleanup_initrd:
 	uninstall_initrd_loader();
 
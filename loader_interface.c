@@ -23,25 +23,219 @@ EFI_GUID vendor_guid = {0x4a67b082,
 			0x41cf,
 			{0xb6, 0xc7, 0x44, 0x0b, 0x29, 0xbb, 0x8c, 0x4f}};
 
+#define INTERFACE_VAR_ATTRIBS                                                  \
+	(EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+/* space for one "name=start:end" entry of the phase list */
+#define BOOT_PHASE_ENTRY_LEN 64
+
+static BOOLEAN interface_var_exists(CHAR16 *name)
+{
+	UINTN readsize = 0;
+
+	return RT->GetVariable(name, &vendor_guid, NULL, &readsize, NULL) !=
+	       EFI_NOT_FOUND;
+}
+
+static EFI_STATUS set_interface_string(CHAR16 *name, const CHAR16 *value)
+{
+	return RT->SetVariable(name, &vendor_guid, INTERFACE_VAR_ATTRIBS,
+			       StrLen(value) * sizeof(CHAR16), (VOID *)value);
+}
+
+static EFI_STATUS set_interface_time(CHAR16 *name, UINT64 usec)
+{
+	CHAR16 buffer[21];
+
+	if (usec == 0 || interface_var_exists(name)) {
+		return EFI_SUCCESS;
+	}
+	SPrint(buffer, sizeof(buffer), L"%ld", usec);
+	return set_interface_string(name, buffer);
+}
+
+/*
+ * Appends the finished phases to those exported by previous stages, as a
+ * space-separated list of "name=start:end" entries.
+ */
+static EFI_STATUS append_boot_phases(const BG_BOOT_TIMING *timing)
+{
+	CHAR16 *previous, *buffer, *pos;
+	UINTN size = 0, bufsize;
+	EFI_STATUS status;
+
+	previous = LibGetVariableAndSize(L"LoaderTimePhasesUSec", &vendor_guid,
+					 &size);
+	if (!previous) {
+		size = 0;
+	}
+	bufsize = size + timing->count * BOOT_PHASE_ENTRY_LEN * sizeof(CHAR16);
+	buffer = AllocatePool(bufsize);
+	if (buffer && previous) {
+		CopyMem(buffer, previous, size);
+	}
+	if (previous) {
+		FreePool(previous);
+	}
+	if (!buffer) {
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	pos = buffer + size / sizeof(CHAR16);
+	for (UINTN n = 0; n < timing->count; n++) {
+		const BG_BOOT_PHASE *phase = &timing->phases[n];
+
+		if (phase->end_usec == 0) {
+			continue;
+		}
+		SPrint(pos, bufsize - (pos - buffer) * sizeof(CHAR16),
+		       L"%s%s=%ld:%ld", pos == buffer ? L"" : L" ",
+		       phase->name, phase->start_usec, phase->end_usec);
+		pos += StrLen(pos);
+	}
+
+	status = RT->SetVariable(L"LoaderTimePhasesUSec", &vendor_guid,
+				 INTERFACE_VAR_ATTRIBS,
+				 (pos - buffer) * sizeof(CHAR16), buffer);
+	FreePool(buffer);
+	return status;
+}
+
 EFI_STATUS set_bg_interface_vars(const BG_INTERFACE_PARAMS *params)
 {
-	EFI_STATUS status = EFI_SUCCESS;
-	UINT32 attribs =
-		EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS;
+	EFI_STATUS status = EFI_SUCCESS, err;
 
 	// only set this if not set by a previous stage loader
-	UINTN readsize = 0;
-	if (RT->GetVariable(L"LoaderDevicePartUUID", &vendor_guid, NULL,
-			    &readsize, NULL) == EFI_NOT_FOUND) {
-		status = RT->SetVariable(
-			L"LoaderDevicePartUUID", &vendor_guid, attribs,
-			StrLen(params->loader_device_part_uuid) *
-				sizeof(UINT16),
-			params->loader_device_part_uuid);
+	if (params->loader_device_part_uuid &&
+	    !interface_var_exists(L"LoaderDevicePartUUID")) {
+		status = set_interface_string(L"LoaderDevicePartUUID",
+					      params->loader_device_part_uuid);
+	}
+
+	// timestamps refer to the first stage, phases are collected
+	err = set_interface_time(L"LoaderTimeInitUSec", params->time_init_usec);
+	if (EFI_ERROR(err)) {
+		status = err;
+	}
+	err = set_interface_time(L"LoaderTimeExecUSec", params->time_exec_usec);
+	if (EFI_ERROR(err)) {
+		status = err;
+	}
+	if (params->timing && params->timing->count > 0) {
+		err = append_boot_phases(params->timing);
+		if (EFI_ERROR(err)) {
+			status = err;
+		}
 	}
 	return status;
 }
 
+UINT64 get_interface_time(const CHAR16 *name)
+{
+	UINT64 usec = 0;
+	CHAR16 *value;
+	UINTN size;
+
+	value = LibGetVariableAndSize((CHAR16 *)name, &vendor_guid, &size);
+	if (!value) {
+		return 0;
+	}
+	for (UINTN n = 0; n < size / sizeof(CHAR16); n++) {
+		if (value[n] < L'0' || value[n] > L'9') {
+			break;
+		}
+		usec = usec * 10 + (value[n] - L'0');
+	}
+	FreePool(value);
+	return usec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static UINT64 read_ticks(VOID)
+{
+	return __builtin_ia32_rdtsc();
+}
+#elif defined(__aarch64__)
+static UINT64 read_ticks(VOID)
+{
+	UINT64 ticks;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+}
+#elif defined(__riscv) && __riscv_xlen == 64
+static UINT64 read_ticks(VOID)
+{
+	UINT64 ticks;
+
+	asm volatile("rdtime %0" : "=r"(ticks));
+	return ticks;
+}
+#else
+static UINT64 read_ticks(VOID)
+{
+	return 0;
+}
+#endif
+
+static UINT64 ticks_freq(VOID)
+{
+	static UINT64 freq;
+	UINT64 start;
+
+	if (freq) {
+		return freq;
+	}
+#if defined(__aarch64__)
+	asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+	if (freq) {
+		return freq;
+	}
+#endif
+	/* the counter frequency is not architecturally known, measure it */
+	start = read_ticks();
+	BS->Stall(1000);
+	freq = (read_ticks() - start) * 1000;
+	return freq;
+}
+
+UINT64 time_usec(VOID)
+{
+	UINT64 ticks = read_ticks();
+	UINT64 freq;
+
+	if (ticks == 0) {
+		return 0;
+	}
+	freq = ticks_freq();
+	if (freq == 0) {
+		return 0;
+	}
+	/* split to avoid overflowing on long uptimes */
+	return ticks / freq * 1000000 + ticks % freq * 1000000 / freq;
+}
+
+VOID boot_phase_begin(BG_BOOT_TIMING *timing, const CHAR16 *name)
+{
+	BG_BOOT_PHASE *phase;
+
+	if (timing->count >= BG_MAX_BOOT_PHASES) {
+		return;
+	}
+	phase = &timing->phases[timing->count];
+	phase->name = name;
+	phase->start_usec = time_usec();
+	phase->end_usec = 0;
+}
+
+VOID boot_phase_end(BG_BOOT_TIMING *timing)
+{
+	if (timing->count >= BG_MAX_BOOT_PHASES) {
+		return;
+	}
+	timing->phases[timing->count++].end_usec = time_usec();
+}
+
 CHAR16 *disk_get_part_uuid(EFI_HANDLE *handle)
 {
 	EFI_STATUS err;
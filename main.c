@@ -36,13 +36,19 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	BG_STATUS bg_status;
 	BG_LOADER_PARAMS bg_loader_params;
 	BG_INTERFACE_PARAMS bg_interface_params;
+	BG_BOOT_TIMING timing;
 	CHAR16 *tmp;
 
 	ZeroMem(&bg_loader_params, sizeof(bg_loader_params));
+	ZeroMem(&bg_interface_params, sizeof(bg_interface_params));
+	ZeroMem(&timing, sizeof(timing));
 
 	this_image = image_handle;
 	InitializeLib(this_image, system_table);
 
+	bg_interface_params.time_init_usec = time_usec();
+	bg_interface_params.timing = &timing;
+
 #if !defined(SILENT_BOOT)
 	(VOID) ST->ConOut->ClearScreen(ST->ConOut);
 	PrintC(EFI_CYAN, L"EFI Boot Guard %s\n", L"" EFIBOOTGUARD_VERSION);
@@ -61,14 +67,18 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	FreePool(tmp);
 	INFO(L"Boot medium: %s\n", boot_medium_path);
 
+	boot_phase_begin(&timing, L"get_volumes");
 	status = get_volumes(&volumes, &volume_count);
+	boot_phase_end(&timing);
 	if (EFI_ERROR(status)) {
 		error_exit(L"Cannot get volumes installed on system", status);
 	}
 
 	INFO(L"Loading configuration...\n");
 
+	boot_phase_begin(&timing, L"load_config");
 	bg_status = load_config(&bg_loader_params);
+	boot_phase_end(&timing);
 	if (BG_ERROR(bg_status)) {
 		switch (bg_status) {
 		case BG_CONFIG_ERROR:
@@ -98,7 +108,9 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	}
 
 #if defined(HAVE_WATCHDOGS)
+	boot_phase_begin(&timing, L"probe_watchdogs");
 	status = probe_watchdogs(bg_loader_params.timeout);
+	boot_phase_end(&timing);
 	if (EFI_ERROR(status)) {
 		error_exit(L"Cannot probe watchdog", status);
 	}
@@ -110,8 +122,10 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 #endif
 
 	/* Load and start image */
+	boot_phase_begin(&timing, L"LoadImage");
 	status = BS->LoadImage(FALSE, this_image, payload_dev_path, NULL, 0,
 			       &payload_handle);
+	boot_phase_end(&timing);
 	if (EFI_ERROR(status)) {
 		if (bg_loader_params.ustate == USTATE_TESTING) {
 			/*
@@ -135,15 +149,9 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	if (!boot_medium_uuidstr) {
 		WARNING(L"Cannot get boot partition UUID\n");
 	} else {
-		bg_interface_params.loader_device_part_uuid = boot_medium_uuidstr;
-		status = set_bg_interface_vars(&bg_interface_params);
-		if (EFI_ERROR(status)) {
-			WARNING(L"Cannot set bootloader interface variables (%r)\n",
-				status);
-		}
 		INFO(L"LoaderDevicePartUUID=%s\n", boot_medium_uuidstr);
-		FreePool(boot_medium_uuidstr);
 	}
+	bg_interface_params.loader_device_part_uuid = boot_medium_uuidstr;
 	FreePool(payload_dev_path);
 	FreePool(boot_medium_path);
 
@@ -168,5 +176,16 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 
 	BS->Stall(1000 * 1000 * ENV_BOOT_DELAY);
 
+	/* export as late as possible to cover the whole loader runtime */
+	bg_interface_params.time_exec_usec = time_usec();
+	status = set_bg_interface_vars(&bg_interface_params);
+	if (EFI_ERROR(status)) {
+		WARNING(L"Cannot set bootloader interface variables (%r)\n",
+			status);
+	}
+	if (boot_medium_uuidstr) {
+		FreePool(boot_medium_uuidstr);
+	}
+
 	return BS->StartImage(payload_handle, NULL, NULL);
 }
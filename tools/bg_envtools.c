@@ -15,6 +15,7 @@
 
 #include <sys/stat.h>
 #include "env_config_file.h"
+#include "env_layout.h"
 #include "version.h"
 
 #include "bg_envtools.h"
@@ -71,6 +72,10 @@ error_t parse_common_opt(int key, const char *arg, bool compat_mode,
 		found = true;
 		arguments->search_all_devices = true;
 		break;
+	case 'C':
+		found = true;
+		arguments->probe_cache = true;
+		break;
 	case 'f':
 		found = true;
 		free(arguments->envfilepath);
@@ -107,14 +112,15 @@ error_t parse_common_opt(int key, const char *arg, bool compat_mode,
 			fprintf(stderr, "Invalid number specified for -p.\n");
 			return 1;
 		}
-		if (i >= 0 && i < ENV_NUM_CONFIG_PARTS) {
+		/* the actual number is known once the partitions are found */
+		if (i >= 0 && i < ENV_V2_MAX_CONFIG_PARTS) {
 			arguments->which_part = i;
 			arguments->part_specified = true;
 		} else {
 			fprintf(stderr,
 				"Selected partition out of range. Valid range: "
 				"0..%d.\n",
-				ENV_NUM_CONFIG_PARTS - 1);
+				ENV_V2_MAX_CONFIG_PARTS - 1);
 			return 1;
 		}
 		break;
@@ -136,22 +142,21 @@ error_t parse_common_opt(int key, const char *arg, bool compat_mode,
 	return 0;
 }
 
-bool get_env(const char *configfilepath, BG_ENVDATA *data)
+BG_ENVDATA *get_env(const char *configfilepath, ENV_LAYOUT *layout)
 {
+	BG_ENVDATA *data;
 	FILE *config;
-	bool result = true;
+	int fd;
 
 	if (!(config = open_config_file(configfilepath, "rb"))) {
-		return false;
+		return NULL;
 	}
 
-	if (!(fread(data, sizeof(BG_ENVDATA), 1, config) == 1)) {
+	fd = fileno(config);
+	data = env_layout_read(env_layout_fd_pread, &fd, layout);
+	if (!data) {
 		VERBOSE(stderr, "Error reading environment data from %s\n",
 			configfilepath);
-		if (feof(config)) {
-			VERBOSE(stderr, "End of file encountered.\n");
-		}
-		result = false;
 	}
 
 	if (fclose(config)) {
@@ -159,13 +164,17 @@ bool get_env(const char *configfilepath, BG_ENVDATA *data)
 			"Error closing environment file after reading.\n");
 	};
 
-	if (result == false) {
-		return false;
+	if (!data) {
+		return NULL;
 	}
 
 	/* enforce NULL-termination of strings */
 	data->kernelfile[ENV_STRING_LENGTH - 1] = 0;
 	data->kernelparams[ENV_STRING_LENGTH - 1] = 0;
 
-	return validate_envdata(data);
+	if (!validate_envdata(data, env_layout_userdata_size(layout))) {
+		free(data);
+		return NULL;
+	}
+	return data;
 }
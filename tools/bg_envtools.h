@@ -37,6 +37,8 @@
 	      "zero is selected.")                                             \
 	, OPT("all", 'A', 0, 0,                                                \
 	      "search on all devices instead of root device only")             \
+	, OPT("probe-cache", 'C', 0, 0,                                        \
+	      "reuse the config partitions found by a previous call")          \
 	, OPT("verbose", 'v', 0, 0, "Be verbose")                              \
 	, OPT("version", 'V', 0, 0, "Print version")
 
@@ -50,6 +52,8 @@ struct arguments_common {
 	bool part_specified;
 	/* inspect all devices for bootenvs instead of current root only */
 	bool search_all_devices;
+	/* use the persistent probe cache */
+	bool probe_cache;
 };
 
 int parse_int(const char *arg);
@@ -60,6 +64,10 @@ uint8_t str2ustate(const char *str);
 error_t parse_common_opt(int key, const char *arg, bool compat_mode,
 			 struct arguments_common *arguments);
 
-bool get_env(const char *configfilepath, BG_ENVDATA *data);
+/*
+ * Read and validate an environment file. The returned environment is sized
+ * by the layout of the file and must be freed by the caller.
+ */
+BG_ENVDATA *get_env(const char *configfilepath, ENV_LAYOUT *layout);
 
 #endif
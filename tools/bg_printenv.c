@@ -13,6 +13,7 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include "env_layout.h"
 #include "uservars.h"
 
 #include "bg_envtools.h"
@@ -32,6 +33,8 @@ static struct argp_option options_printenv[] = {
 	    "watchdog_timeout, ustate, user. "
 	    "If omitted, all available fields are printed."),
 	OPT("raw", 'r', 0, 0, "Raw output mode, e.g. for shell scripting"),
+	OPT("boot-timing", 'T', 0, 0,
+	    "Print the boot phase timing exported by the boot loader"),
 	{0},
 };
 
@@ -42,6 +45,7 @@ struct arguments_printenv {
 	/* a bitset to decide which fields are printed */
 	struct fields output_fields;
 	bool raw;
+	bool boot_timing;
 };
 
 const struct fields ALL_FIELDS = {1, 1, 1, 1, 1, 1, 1};
@@ -75,19 +79,20 @@ static error_t parse_output_fields(char *fields, struct fields *output_fields)
 	return 0;
 }
 
-static void dump_uservars(uint8_t *udata, bool raw)
+static void dump_uservars(uint8_t *udata, uint32_t size, bool raw)
 {
-	char *key, *value;
+	ebg_env_iter_t it;
+	ebg_kv_t kv;
+	const char *value;
 	uint64_t type;
-	uint32_t rsize, dsize;
 	uint64_t val_unum;
 	int64_t val_snum;
 
-	while (*udata) {
-		bgenv_map_uservar(udata, &key, &type, (uint8_t **)&value,
-				  &rsize, &dsize);
-		fprintf(stdout, "%s", key);
-		type &= USERVAR_STANDARD_TYPE_MASK;
+	bgenv_uservar_iter_init(&it, udata, size, NULL);
+	while (bgenv_uservar_iter_next(&it, &kv)) {
+		value = (const char *)kv.value;
+		fprintf(stdout, "%s", kv.key);
+		type = kv.type & USERVAR_STANDARD_TYPE_MASK;
 		if (type == USERVAR_TYPE_STRING_ASCII) {
 			fprintf(stdout, raw ? "=%s\n" : " = %s\n", value);
 		} else if (type >= USERVAR_TYPE_UINT8 &&
@@ -140,12 +145,11 @@ static void dump_uservars(uint8_t *udata, bool raw)
 				fprintf(stdout, " ( Type is not printable )\n");
 			}
 		}
-
-		udata = bgenv_next_uservar(udata);
 	}
 }
 
-void dump_env(BG_ENVDATA *env, const struct fields *output_fields, bool raw)
+void dump_env(BG_ENVDATA *env, uint32_t userdata_size,
+	      const struct fields *output_fields, bool raw)
 {
 	char buffer[ENV_STRING_LENGTH];
 	if (!raw) {
@@ -205,7 +209,7 @@ void dump_env(BG_ENVDATA *env, const struct fields *output_fields, bool raw)
 			fprintf(stdout, "\n");
 			fprintf(stdout, "user variables:\n");
 		}
-		dump_uservars(env->userdata, raw);
+		dump_uservars(env->userdata, userdata_size, raw);
 	}
 	if (!raw) {
 		fprintf(stdout, "\n\n");
@@ -214,19 +218,19 @@ void dump_env(BG_ENVDATA *env, const struct fields *output_fields, bool raw)
 
 void dump_envs(const struct fields *output_fields, bool raw)
 {
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+	for (uint32_t i = 0; i < bgenv_num_config_parts(); i++) {
 		if (!raw) {
 			fprintf(stdout, "\n----------------------------\n");
-			fprintf(stdout, " Config Partition #%d ", i);
+			fprintf(stdout, " Config Partition #%u ", i);
 		}
 		BGENV *env = bgenv_open_by_index(i);
 		if (!env) {
 			fprintf(stderr, "Error, could not read environment "
-					"for index %d\n",
+					"for index %u\n",
 				i);
 			return;
 		}
-		dump_env(env->data, output_fields, raw);
+		dump_env(env->data, env->userdata_size, output_fields, raw);
 		bgenv_close(env);
 	}
 }
@@ -238,7 +242,7 @@ static void dump_latest_env(const struct fields *output_fields, bool raw)
 		fprintf(stderr, "Failed to retrieve latest environment.\n");
 		return;
 	}
-	dump_env(env->data, output_fields, raw);
+	dump_env(env->data, env->userdata_size, output_fields, raw);
 	bgenv_close(env);
 }
 
@@ -250,19 +254,21 @@ static void dump_env_by_index(uint32_t index, struct fields output_fields,
 		fprintf(stderr, "Failed to retrieve latest environment.\n");
 		return;
 	}
-	dump_env(env->data, &output_fields, raw);
+	dump_env(env->data, env->userdata_size, &output_fields, raw);
 	bgenv_close(env);
 }
 
 static int printenv_from_file(const char *envfilepath,
 			      const struct fields *output_fields, bool raw)
 {
-	int success = 0;
-	BG_ENVDATA data;
+	ENV_LAYOUT layout;
+	BG_ENVDATA *data;
 
-	success = get_env(envfilepath, &data);
-	if (success) {
-		dump_env(&data, output_fields, raw);
+	data = get_env(envfilepath, &layout);
+	if (data) {
+		dump_env(data, env_layout_userdata_size(&layout),
+			 output_fields, raw);
+		free(data);
 		return 0;
 	} else {
 		fprintf(stderr, "Error reading environment file.\n");
@@ -270,6 +276,119 @@ static int printenv_from_file(const char *envfilepath,
 	}
 }
 
+#define EFIVARS_PATH "/sys/firmware/efi/efivars"
+#define LOADER_VENDOR_GUID "4a67b082-0a4c-41cf-b6c7-440b29bb8c4f"
+
+/*
+ * Reads a boot loader interface variable from efivarfs and converts its
+ * UTF-16 value to ASCII. Returns NULL if the variable is not set.
+ */
+static char *read_loader_var(const char *name)
+{
+	uint8_t buffer[8192];
+	char *path, *value;
+	ssize_t size;
+	int fd;
+
+	if (asprintf(&path, EFIVARS_PATH "/%s-" LOADER_VENDOR_GUID, name) < 0) {
+		return NULL;
+	}
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0) {
+		return NULL;
+	}
+	size = read(fd, buffer, sizeof(buffer));
+	close(fd);
+	/* skip the 32 bit attributes preceding the data */
+	if (size < (ssize_t)sizeof(uint32_t)) {
+		return NULL;
+	}
+	size = (size - sizeof(uint32_t)) / 2;
+
+	value = malloc(size + 1);
+	if (!value) {
+		return NULL;
+	}
+	for (ssize_t i = 0; i < size; i++) {
+		uint16_t c = buffer[sizeof(uint32_t) + 2 * i] |
+			     buffer[sizeof(uint32_t) + 2 * i + 1] << 8;
+
+		if (c == 0) {
+			size = i;
+			break;
+		}
+		value[i] = c < 0x80 ? c : '?';
+	}
+	value[size] = '\0';
+	return value;
+}
+
+static unsigned long long read_loader_time(const char *name)
+{
+	unsigned long long usec = 0;
+	char *value = read_loader_var(name);
+
+	if (value) {
+		usec = strtoull(value, NULL, 10);
+		free(value);
+	}
+	return usec;
+}
+
+static int dump_boot_timing(bool raw)
+{
+	unsigned long long init, exec, start, end;
+	char *phases, *entry, *next, *name;
+	int len;
+
+	init = read_loader_time("LoaderTimeInitUSec");
+	exec = read_loader_time("LoaderTimeExecUSec");
+	phases = read_loader_var("LoaderTimePhasesUSec");
+	if (!init && !exec && !phases) {
+		fprintf(stderr, "No boot timing exported by the boot loader.\n");
+		return 1;
+	}
+
+	if (raw) {
+		fprintf(stdout, "LoaderTimeInitUSec=%llu\n", init);
+		fprintf(stdout, "LoaderTimeExecUSec=%llu\n", exec);
+	} else {
+		fprintf(stdout, "Boot loader started: %llu us\n", init);
+		fprintf(stdout, "Boot loader handed over: %llu us\n", exec);
+		if (init && exec >= init) {
+			fprintf(stdout, "Time in boot loader: %llu us\n",
+				exec - init);
+		}
+		if (phases) {
+			fprintf(stdout, "\n%-16s %12s %13s\n", "Phase",
+				"Start (us)", "Duration (us)");
+		}
+	}
+
+	next = phases;
+	while (next && (entry = strsep(&next, " "))) {
+		if (sscanf(entry, "%*[^=]=%llu:%llu%n", &start, &end, &len) !=
+			    2 ||
+		    entry[len] != '\0' || end < start) {
+			if (*entry) {
+				fprintf(stderr, "Invalid boot phase: %s\n",
+					entry);
+			}
+			continue;
+		}
+		name = strsep(&entry, "=");
+		if (raw) {
+			fprintf(stdout, "%s=%llu\n", name, end - start);
+		} else {
+			fprintf(stdout, "%-16s %12llu %13llu\n", name, start,
+				end - start);
+		}
+	}
+	free(phases);
+	return 0;
+}
+
 static error_t parse_printenv_opt(int key, char *arg, struct argp_state *state)
 {
 	struct arguments_printenv *arguments = state->input;
@@ -285,6 +404,9 @@ static error_t parse_printenv_opt(int key, char *arg, struct argp_state *state)
 	case 'r':
 		arguments->raw = true;
 		break;
+	case 'T':
+		arguments->boot_timing = true;
+		break;
 	case ARGP_KEY_ARG:
 		/* too many arguments - program terminates with call to
 		 * argp_usage with non-zero return code */
@@ -328,6 +450,15 @@ error_t bg_printenv(int argc, char **argv)
 		fprintf(stderr, "Error, only one of -c/-f/-p can be set.\n");
 		return 1;
 	}
+	if (arguments.boot_timing) {
+		/* the timing is read from the firmware, not an environment */
+		if (counter > 0) {
+			fprintf(stderr, "Error, boot-timing cannot be combined "
+					"with -c/-f/-p.\n");
+			return 1;
+		}
+		return dump_boot_timing(arguments.raw);
+	}
 	if (arguments.raw && counter != 1) {
 		/* raw mode makes only sense if applied to a single
 		 * partition */
@@ -345,9 +476,13 @@ error_t bg_printenv(int argc, char **argv)
 	}
 
 	/* not in file mode */
+	ebg_set_opt_bool(EBG_OPT_PARALLEL_PROBE, true);
 	if (arguments.common.search_all_devices) {
 		ebg_set_opt_bool(EBG_OPT_PROBE_ALL_DEVICES, true);
 	}
+	if (arguments.common.probe_cache) {
+		ebg_set_opt_bool(EBG_OPT_PROBE_CACHE, true);
+	}
 	if (arguments.common.verbosity) {
 		ebg_set_opt_bool(EBG_OPT_VERBOSE, true);
 	}
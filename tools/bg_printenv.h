@@ -31,7 +31,8 @@ struct fields {
 extern const struct fields ALL_FIELDS;
 
 void dump_envs(const struct fields *output_fields, bool raw);
-void dump_env(BG_ENVDATA *env, const struct fields *output_fields, bool raw);
+void dump_env(BG_ENVDATA *env, uint32_t userdata_size,
+	      const struct fields *output_fields, bool raw);
 
 error_t bg_printenv(int argc, char **argv);
 
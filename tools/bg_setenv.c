@@ -17,6 +17,7 @@
 #include <sys/stat.h>
 
 #include "ebgenv.h"
+#include "env_layout.h"
 
 #include "bg_envtools.h"
 #include "bg_setenv.h"
@@ -42,6 +43,10 @@ static struct argp_option options_setenv[] = {
 	    "use this option multiple times."),
 	OPT("in_progress", 'i', "IN_PROGRESS", 0,
 	    "Set in_progress variable to simulate a running update process."),
+	OPT("layout", 'L', "PARTS:USERVAR_SIZE", 0,
+	    "Write the environment file in the self-describing layout for "
+	    "PARTS config partitions and USERVAR_SIZE bytes of user "
+	    "variables. Requires --filepath."),
 	{0},
 };
 
@@ -54,6 +59,9 @@ struct arguments_setenv {
 	/* whether to keep existing entries in BGENV before applying new
 	 * settings */
 	bool preserve_env;
+	/* layout of the environment file, taken from the existing file when
+	 * preserving and not specified */
+	ENV_LAYOUT layout;
 };
 
 typedef enum { ENV_TASK_SET, ENV_TASK_DEL } BGENV_TASK;
@@ -113,17 +121,35 @@ newaction_nomem:
 	return ENOMEM;
 }
 
+static void journal_log_action(const struct env_action *action)
+{
+	switch (action->task) {
+	case ENV_TASK_SET:
+		VERBOSE(stdout, "Task = SET, key = %s, type = %llu, val = %s\n",
+			action->key, (long long unsigned int)action->type,
+			(char *)action->data);
+		break;
+	case ENV_TASK_DEL:
+		VERBOSE(stdout, "Task = DEL, key = %s\n", action->key);
+		break;
+	}
+}
+
+static bool journal_is_ustate_action(const struct env_action *action)
+{
+	return action->task == ENV_TASK_SET &&
+	       strcmp(action->key, "ustate") == 0;
+}
+
 static void journal_process_action(BGENV *env, struct env_action *action)
 {
 	ebgenv_t e;
 	memset(&e, 0, sizeof(ebgenv_t));
 
+	journal_log_action(action);
 	switch (action->task) {
 	case ENV_TASK_SET:
-		VERBOSE(stdout, "Task = SET, key = %s, type = %llu, val = %s\n",
-			action->key, (long long unsigned int)action->type,
-			(char *)action->data);
-		if (strcmp(action->key, "ustate") == 0) {
+		if (journal_is_ustate_action(action)) {
 			const char *arg;
 			int ustate;
 			int ret;
@@ -145,12 +171,73 @@ static void journal_process_action(BGENV *env, struct env_action *action)
 			  strlen((char *)action->data) + 1);
 		break;
 	case ENV_TASK_DEL:
-		VERBOSE(stdout, "Task = DEL, key = %s\n", action->key);
 		bgenv_set(env, action->key, action->type, "", 1);
 		break;
 	}
 }
 
+/*
+ * Apply a sequence of actions at once. If that fails, fall back to single
+ * actions so that the valid ones are still applied.
+ */
+static void journal_process_batch(BGENV *env, struct env_action **actions,
+				  size_t count)
+{
+	ebg_kv_t *kvs;
+	size_t n;
+
+	if (count == 0) {
+		return;
+	}
+	kvs = calloc(count, sizeof(ebg_kv_t));
+	if (kvs) {
+		for (n = 0; n < count; n++) {
+			kvs[n].key = actions[n]->key;
+			kvs[n].type = actions[n]->type;
+			if (actions[n]->task == ENV_TASK_DEL) {
+				kvs[n].value = (const uint8_t *)"";
+				kvs[n].datalen = 1;
+			} else {
+				kvs[n].value = actions[n]->data;
+				kvs[n].datalen =
+					strlen((char *)actions[n]->data) + 1;
+			}
+		}
+		if (bgenv_set_many(env, kvs, count) == 0) {
+			for (n = 0; n < count; n++) {
+				journal_log_action(actions[n]);
+			}
+			free(kvs);
+			return;
+		}
+		free(kvs);
+	}
+	for (n = 0; n < count; n++) {
+		journal_process_action(env, actions[n]);
+	}
+}
+
+static bool parse_layout(const char *arg, ENV_LAYOUT *layout)
+{
+	unsigned long parts, size;
+	char *end;
+
+	errno = 0;
+	parts = strtoul(arg, &end, 10);
+	if (errno || *end != ':') {
+		return false;
+	}
+	size = strtoul(end + 1, &end, 10);
+	if (errno || *end || parts < 1 || parts > ENV_V2_MAX_CONFIG_PARTS ||
+	    size < ENV_V2_MIN_USERVARS || size > ENV_V2_MAX_USERVARS) {
+		return false;
+	}
+	layout->version = ENV_LAYOUT_V2;
+	layout->num_config_parts = parts;
+	layout->userdata_size = size;
+	return true;
+}
+
 static error_t set_uservars(char *arg)
 {
 	const char *key, *value;
@@ -295,6 +382,16 @@ static error_t parse_setenv_opt(int key, char *arg, struct argp_state *state)
 	case 'P':
 		arguments->preserve_env = true;
 		break;
+	case 'L':
+		if (!parse_layout(arg, &arguments->layout)) {
+			fprintf(stderr,
+				"Invalid layout, expected PARTS:USERVAR_SIZE "
+				"with 1 to %d partitions and %d to %d bytes.\n",
+				ENV_V2_MAX_CONFIG_PARTS, ENV_V2_MIN_USERVARS,
+				ENV_V2_MAX_USERVARS);
+			return 1;
+		}
+		break;
 	case ARGP_KEY_ARG:
 		/* too many arguments - program terminates with call to
 		 * argp_usage with non-zero return code */
@@ -312,47 +409,96 @@ static error_t parse_setenv_opt(int key, char *arg, struct argp_state *state)
 
 static void update_environment(BGENV *env, bool verbosity)
 {
+	struct env_action **batch = NULL;
+	struct env_action *action;
+	size_t num_actions = 0, batch_size = 0;
+
 	if (verbosity) {
 		fprintf(stdout, "Processing journal...\n");
 	}
 
-	while (!STAILQ_EMPTY(&head)) {
-		struct env_action *action = STAILQ_FIRST(&head);
+	STAILQ_FOREACH(action, &head, journal) {
+		num_actions++;
+	}
+	if (num_actions) {
+		batch = calloc(num_actions, sizeof(*batch));
+	}
+
+	/* ustate changes may affect all environments, keep them in order */
+	STAILQ_FOREACH(action, &head, journal) {
+		if (!batch || journal_is_ustate_action(action)) {
+			journal_process_batch(env, batch, batch_size);
+			batch_size = 0;
+			journal_process_action(env, action);
+			continue;
+		}
+		batch[batch_size++] = action;
+	}
+	journal_process_batch(env, batch, batch_size);
+	free(batch);
 
-		journal_process_action(env, action);
+	while (!STAILQ_EMPTY(&head)) {
+		action = STAILQ_FIRST(&head);
 		STAILQ_REMOVE_HEAD(&head, journal);
 		journal_free_action(action);
 	}
 
-	env->data->crc32 =
-		bgenv_crc32(0, env->data,
-			    sizeof(BG_ENVDATA) - sizeof(env->data->crc32));
+	bgenv_compact(env);
+	bgenv_crc_update(env);
 
 }
 
 static int dumpenv_to_file(const char *envfilepath, bool verbosity,
-			   bool preserve_env)
+			   bool preserve_env, const ENV_LAYOUT *layout)
 {
 	/* execute journal and write to file */
 	int result = 0;
-	BGENV env;
-	BG_ENVDATA data;
+	BGENV env, stored = {0};
+	ENV_LAYOUT file_layout = {0};
+	uint8_t *buf;
+	size_t size;
 
 	memset(&env, 0, sizeof(BGENV));
-	memset(&data, 0, sizeof(BG_ENVDATA));
-	env.data = &data;
+	if (preserve_env) {
+		stored.data = get_env(envfilepath, &file_layout);
+		if (!stored.data) {
+			return 1;
+		}
+		stored.userdata_size = env_layout_userdata_size(&file_layout);
+	}
+	if (layout->version != ENV_LAYOUT_LEGACY) {
+		file_layout = *layout;
+	}
 
-	if (preserve_env && !get_env(envfilepath, &data)) {
+	/* room for the user variables of both the old and the new layout */
+	env.userdata_size = env_layout_userdata_size(&file_layout);
+	if (env.userdata_size < stored.userdata_size) {
+		env.userdata_size = stored.userdata_size;
+	}
+	env.data = env_data_alloc(env.userdata_size);
+	if (!env.data) {
+		free(stored.data);
 		return 1;
 	}
+	if (stored.data) {
+		bgenv_copy(&env, &stored);
+		free(stored.data);
+	}
 
 	update_environment(&env, verbosity);
 	if (verbosity) {
-		dump_env(env.data, &ALL_FIELDS, false);
+		dump_env(env.data, env.userdata_size, &ALL_FIELDS, false);
+	}
+	buf = env_layout_encode(env.data, env.userdata_size, &file_layout,
+				&size);
+	free(env.data);
+	if (!buf) {
+		fprintf(stderr, "User variables do not fit into the layout.\n");
+		return 1;
 	}
 	FILE *of = fopen(envfilepath, "wb");
 	if (of) {
-		if (fwrite(&data, sizeof(BG_ENVDATA), 1, of) != 1) {
+		if (fwrite(buf, size, 1, of) != 1) {
 			fprintf(stderr,
 				"Error writing to output file: %s\n",
 				strerror(errno));
@@ -369,6 +515,7 @@ static int dumpenv_to_file(const char *envfilepath, bool verbosity,
 			envfilepath, strerror(errno));
 		result = 1;
 	}
+	free(buf);
 
 	return result;
 }
@@ -407,6 +554,12 @@ error_t bg_setenv(int argc, char **argv)
 		return 1;
 	}
 
+	if (arguments.layout.version != ENV_LAYOUT_LEGACY &&
+	    !arguments.common.envfilepath) {
+		fprintf(stderr, "Error, --layout requires --filepath.\n");
+		return 1;
+	}
+
 	int result = 0;
 
 	/* arguments are parsed, journal is filled */
@@ -415,15 +568,20 @@ error_t bg_setenv(int argc, char **argv)
 	if (arguments.common.envfilepath) {
 		result = dumpenv_to_file(arguments.common.envfilepath,
 					 arguments.common.verbosity,
-					 arguments.preserve_env);
+					 arguments.preserve_env,
+					 &arguments.layout);
 		free(arguments.common.envfilepath);
 		return result;
 	}
 
 	/* not in file mode */
+	ebg_set_opt_bool(EBG_OPT_PARALLEL_PROBE, true);
 	if (arguments.common.search_all_devices) {
 		ebg_set_opt_bool(EBG_OPT_PROBE_ALL_DEVICES, true);
 	}
+	if (arguments.common.probe_cache) {
+		ebg_set_opt_bool(EBG_OPT_PROBE_CACHE, true);
+	}
 	if (arguments.common.verbosity) {
 		ebg_set_opt_bool(EBG_OPT_VERBOSE, true);
 	}
@@ -470,8 +628,14 @@ error_t bg_setenv(int argc, char **argv)
 			goto cleanup;
 		}
 
-		memcpy((char *)env_new->data, (char *)env_current->data,
-		       sizeof(BG_ENVDATA));
+		/* the environments may have different layouts */
+		if (!bgenv_copy(env_new, env_current)) {
+			fprintf(stderr, "Latest environment does not fit into "
+					"the oldest one.\n");
+			bgenv_close(env_current);
+			result = 1;
+			goto cleanup;
+		}
 		env_new->data->revision = env_current->data->revision + 1;
 
 		bgenv_close(env_current);
@@ -497,7 +661,8 @@ error_t bg_setenv(int argc, char **argv)
 	if (arguments.common.verbosity) {
 		fprintf(stdout, "New environment data:\n");
 		fprintf(stdout, "---------------------\n");
-		dump_env(env_new->data, &ALL_FIELDS, false);
+		dump_env(env_new->data, env_new->userdata_size, &ALL_FIELDS,
+			 false);
 	}
 	if (!bgenv_write(env_new)) {
 		fprintf(stderr, "Error storing environment.\n");
@@ -17,8 +17,10 @@
  */
 
 #include "ebgpart.h"
+#include <stddef.h>
 #include <sys/sysmacros.h>
 #include "fat.h"
+#include "env_api_crc32.h"
 
 static PedDevice *first_device = NULL;
 static PedDisk g_ped_dummy_disk;
@@ -26,11 +28,19 @@ static char buffer[37];
 
 static bool verbosity = false;
 
+/* prefix of the sysfs and dev directories, only changed by tests */
+static const char *sysroot = "";
+
 void ebgpart_beverbose(bool v)
 {
 	verbosity = v;
 }
 
+void ebgpart_set_sysroot(const char *root)
+{
+	sysroot = root ? root : "";
+}
+
 static void add_block_dev(PedDevice *dev)
 {
 	if (!first_device) {
@@ -94,36 +104,15 @@ static int check_GPT_FAT_entry(int fd, const struct EFIpartitionentry *e)
 	}
 	VERBOSE(stdout, "GPT Partition has a FAT/NTFS GUID\n");
 
-	/* Save current file offset */
-	off64_t curr = lseek64(fd, 0, SEEK_CUR);
-	if (curr == -1) {
-		VERBOSE(stderr, "Error getting current seek position: %s\n",
-			strerror(errno));
-		return -1;
-	}
-
-	/* seek to partition start */
-	off64_t offset_start = (off64_t)e->start_LBA * LB_SIZE;
-	if (lseek64(fd, offset_start, SEEK_SET) == -1) {
-		VERBOSE(stderr, "Error seeking to partition start: %s\n",
-			strerror(errno));
-		return -1;
-	}
-
-	/* read FAT header */
+	/* read FAT header at partition start */
 	struct fat_boot_sector header;
-	if (read(fd, &header, sizeof(header)) != sizeof(header)) {
+	off64_t offset_start = (off64_t)e->start_LBA * LB_SIZE;
+	if (pread64(fd, &header, sizeof(header), offset_start) !=
+	    sizeof(header)) {
 		VERBOSE(stderr, "Error reading FAT header: %s\n",
 			strerror(errno));
 		return -1;
 	}
-
-	/* restore pos */
-	if (lseek64(fd, curr, SEEK_SET) == -1) {
-		VERBOSE(stderr, "Error restoring seek position (%s)",
-			strerror(errno));
-		return -1;
-	}
 	return determine_FAT_bits(&header, verbosity);
 }
 
@@ -148,41 +137,89 @@ static inline EbgFileSystemType fat_size_to_fs_type(int fat_size)
 	}
 }
 
-static void read_GPT_entries(int fd, uint64_t table_LBA, uint32_t num,
-			     PedDevice *dev)
+/* Upper bound for the partition entry array, the spec requires 16 KiB */
+#define GPT_MAX_ENTRY_ARRAY_SIZE (1024 * 1024)
+
+static bool check_GPT_header(struct EFIHeader *hdr, uint64_t lba)
 {
-	off64_t offset;
-	struct EFIpartitionentry e;
-	PedPartition *tmpp;
+	uint32_t crc32 = hdr->header_crc32;
+	bool valid;
 
-	offset = LB_SIZE * table_LBA;
-	if (lseek64(fd, offset, SEEK_SET) != offset) {
-		VERBOSE(stderr, "Error seeking EFI partition table\n");
-		return;
+	if (memcmp(hdr->signature, "EFI PART", 8) != 0 ||
+	    hdr->header_size < offsetof(struct EFIHeader, reserved2) ||
+	    hdr->header_size > LB_SIZE || hdr->this_LBA != lba) {
+		return false;
+	}
+	hdr->header_crc32 = 0;
+	valid = bgenv_crc32(0, hdr, hdr->header_size) == crc32;
+	hdr->header_crc32 = crc32;
+	return valid;
+}
+
+/* Read the partition entry array, returns NULL if it is not intact. */
+static uint8_t *read_GPT_table(int fd, const struct EFIHeader *hdr)
+{
+	uint32_t num = hdr->partitions;
+	uint32_t entry_size = hdr->partitionentrysize;
+	uint8_t *table;
+
+	if (entry_size < sizeof(struct EFIpartitionentry) ||
+	    entry_size % 8 != 0 ||
+	    (uint64_t)num * entry_size > GPT_MAX_ENTRY_ARRAY_SIZE) {
+		VERBOSE(stderr, "Invalid EFI partition table geometry\n");
+		return NULL;
+	}
+
+	/* read the whole entry array in one go, whole sectors only */
+	size_t array_size = (size_t)num * entry_size;
+	size_t read_size = (array_size + LB_SIZE - 1) & ~(size_t)(LB_SIZE - 1);
+	if (read_size == 0 ||
+	    posix_memalign((void **)&table, LB_SIZE, read_size) != 0) {
+		VERBOSE(stderr, "Out of memory\n");
+		return NULL;
 	}
+	off64_t offset = LB_SIZE * (off64_t)hdr->partitiontable_LBA;
+	if (pread64(fd, table, read_size, offset) != (ssize_t)read_size) {
+		VERBOSE(stderr, "Error reading EFI partition table\n");
+		VERBOSE(stderr, "(%s)\n", strerror(errno));
+		free(table);
+		return NULL;
+	}
+	if (bgenv_crc32(0, table, array_size) != hdr->partitiontable_CRC32) {
+		VERBOSE(stderr, "EFI partition table CRC mismatch\n");
+		free(table);
+		return NULL;
+	}
+	return table;
+}
 
+static void read_GPT_entries(int fd, const struct EFIHeader *hdr,
+			     const uint8_t *table, PedDevice *dev)
+{
+	const struct EFIpartitionentry *e;
 	PedPartition **list_end = &dev->part_list;
+	PedPartition *tmpp;
 
-	for (uint32_t i = 0; i < num; i++) {
-		if (read(fd, &e, sizeof(e)) != sizeof(e)) {
-			VERBOSE(stderr, "Error reading partition entry\n");
-			VERBOSE(stderr, "(%s)\n", strerror(errno));
-			return;
-		}
-		if ((*((uint64_t *)&e.type_GUID[0]) == 0) &&
-		    (*((uint64_t *)&e.type_GUID[8]) == 0)) {
-			return;
+	for (uint32_t i = 0; i < hdr->partitions; i++) {
+		e = (const struct EFIpartitionentry *)(table +
+						       (size_t)i *
+						       hdr->partitionentrysize);
+		if ((*((const uint64_t *)&e->type_GUID[0]) == 0) &&
+		    (*((const uint64_t *)&e->type_GUID[8]) == 0)) {
+			break;
 		}
-		VERBOSE(stdout, "%u: %s\n", i, GUID_to_str(e.type_GUID));
+		VERBOSE(stdout, "%u: %s\n", i, GUID_to_str(e->type_GUID));
 
 		tmpp = calloc(1, sizeof(PedPartition));
 		if (!tmpp) {
 			VERBOSE(stderr, "Out of memory\n");
-			return;
+			break;
 		}
 		tmpp->num = i + 1;
+		(void)snprintf(tmpp->uuid, sizeof(tmpp->uuid), "%s",
+			       GUID_to_str(e->partition_GUID));
 
-		int result = check_GPT_FAT_entry(fd, &e);
+		int result = check_GPT_FAT_entry(fd, e);
 		if (result < 0) {
 			VERBOSE(stderr, "%u: I/O error, skipping device\n", i);
 			free(tmpp);
@@ -196,6 +233,48 @@ static void read_GPT_entries(int fd, uint64_t table_LBA, uint32_t num,
 	}
 }
 
+/*
+ * Read the partitions from the primary GPT whose header is passed in hdr. If
+ * its header or entry array is damaged, the backup GPT is used instead. That
+ * is found via the primary header, or at the end of the device if the
+ * primary header itself cannot be trusted.
+ */
+static void read_GPT(int fd, struct EFIHeader *hdr, uint64_t hdr_LBA,
+		     PedDevice *dev)
+{
+	uint8_t *table = NULL;
+	uint64_t backup_LBA;
+	off64_t size;
+
+	if (check_GPT_header(hdr, hdr_LBA)) {
+		table = read_GPT_table(fd, hdr);
+		backup_LBA = hdr->backup_LBA;
+	} else {
+		VERBOSE(stderr, "Invalid primary GPT header\n");
+		size = lseek64(fd, 0, SEEK_END);
+		backup_LBA = size >= LB_SIZE ? size / LB_SIZE - 1 : 0;
+	}
+
+	if (!table) {
+		VERBOSE(stdout, "Using backup GPT header at LBA %llu\n",
+			(unsigned long long)backup_LBA);
+		memset(hdr, 0, sizeof(*hdr));
+		off64_t offset = LB_SIZE * (off64_t)backup_LBA;
+		if (pread64(fd, hdr, LB_SIZE, offset) != LB_SIZE ||
+		    !check_GPT_header(hdr, backup_LBA)) {
+			VERBOSE(stderr, "Invalid backup GPT header\n");
+			return;
+		}
+		table = read_GPT_table(fd, hdr);
+		if (!table) {
+			return;
+		}
+	}
+
+	read_GPT_entries(fd, hdr, table, dev);
+	free(table);
+}
+
 static void scanLogicalVolumes(int fd, off64_t extended_start_LBA,
 			       struct Masterbootrecord *ebr, int i,
 			       PedPartition *partition, int lognum)
@@ -206,14 +285,9 @@ static void scanLogicalVolumes(int fd, off64_t extended_start_LBA,
 	if (extended_start_LBA == 0) {
 		extended_start_LBA = offset;
 	}
-	VERBOSE(stdout, "Seeking to LBA %llu\n", (unsigned long long)offset);
-	off64_t res = lseek64(fd, offset * LB_SIZE, SEEK_SET);
-	if (res == -1) {
-		VERBOSE(stderr, "(%s)\n", strerror(errno));
-		return;
-	}
-	VERBOSE(stdout, "Seek returned %lld\n", (signed long long)res);
-	if (read(fd, &next_ebr, sizeof(next_ebr)) != sizeof(next_ebr)) {
+	VERBOSE(stdout, "Reading EBR at LBA %llu\n", (unsigned long long)offset);
+	if (pread64(fd, &next_ebr, sizeof(next_ebr), offset * LB_SIZE) !=
+	    sizeof(next_ebr)) {
 		VERBOSE(stderr, "Error reading next EBR (%s)\n",
 			strerror(errno));
 		return;
@@ -271,6 +345,7 @@ static bool check_partition_table(PedDevice *dev)
 		return false;
 	}
 	int numpartitions = 0;
+	bool is_gpt = false;
 	PedPartition **list_end = &dev->part_list;
 	PedPartition *tmp = NULL;
 	for (int i = 0; i < 4; i++) {
@@ -282,18 +357,13 @@ static bool check_partition_table(PedDevice *dev)
 			mbr.parttable[i].partition_type);
 		uint8_t t = mbr.parttable[i].partition_type;
 		if (t == MBR_TYPE_GPT) {
+			is_gpt = true;
 			VERBOSE(stdout, "GPT header at %X\n",
 				mbr.parttable[i].start_LBA);
 			off64_t offset = LB_SIZE *
 			    (off64_t)mbr.parttable[i].start_LBA;
-			if (lseek64(fd, offset, SEEK_SET) != offset) {
-				VERBOSE(stderr, "Error seeking EFI Header\n.");
-				VERBOSE(stderr, "(%s)", strerror(errno));
-				close(fd);
-				return false;
-			}
 			struct EFIHeader efihdr;
-			if (read(fd, &efihdr, sizeof(efihdr)) !=
+			if (pread64(fd, &efihdr, sizeof(efihdr), offset) !=
 			    sizeof(efihdr)) {
 				close(fd);
 				VERBOSE(stderr, "Error reading EFI Header\n.");
@@ -309,8 +379,7 @@ static bool check_partition_table(PedDevice *dev)
 				efihdr.partitions);
 			VERBOSE(stdout, "Partition Table @ LBA %llu\n",
 				(unsigned long long)efihdr.partitiontable_LBA);
-			read_GPT_entries(fd, efihdr.partitiontable_LBA,
-					 efihdr.partitions, dev);
+			read_GPT(fd, &efihdr, mbr.parttable[i].start_LBA, dev);
 			break;
 		}
 		tmp = calloc(1, sizeof(PedPartition));
@@ -345,6 +414,15 @@ static bool check_partition_table(PedDevice *dev)
 	if (numpartitions == 0) {
 		return false;
 	}
+	if (!is_gpt) {
+		/* PARTUUID of MBR partitions: disk signature and number */
+		uint32_t signature;
+		memcpy(&signature, mbr.devsignature, sizeof(signature));
+		for (tmp = dev->part_list; tmp; tmp = tmp->next) {
+			(void)snprintf(tmp->uuid, sizeof(tmp->uuid),
+				       "%08X-%02X", signature, tmp->num);
+		}
+	}
 	return true;
 }
 
@@ -353,9 +431,12 @@ static int scan_devdir(unsigned int fmajor, unsigned int fminor, char *fullname,
 {
 	int result = -1;
 
-	DIR *devdir = opendir(DEVDIR);
+	char dirname[DEV_FILENAME_LEN];
+	(void)snprintf(dirname, sizeof(dirname), "%s%s", sysroot, DEVDIR);
+
+	DIR *devdir = opendir(dirname);
 	if (!devdir) {
-		VERBOSE(stderr, "Failed to open %s\n", DEVDIR);
+		VERBOSE(stderr, "Failed to open %s\n", dirname);
 		return result;
 	}
 	while (true) {
@@ -363,8 +444,12 @@ static int scan_devdir(unsigned int fmajor, unsigned int fminor, char *fullname,
 		if (!devfile) {
 			break;
 		}
-		(void)snprintf(fullname, maxlen, "%s/%s", DEVDIR,
-			       devfile->d_name);
+		if ((unsigned int)snprintf(fullname, maxlen, "%s/%s", dirname,
+					   devfile->d_name) >= maxlen) {
+			VERBOSE(stderr, "Skipping %s, path too long\n",
+				devfile->d_name);
+			continue;
+		}
 		struct stat statbuf;
 		if (stat(fullname, &statbuf) == -1) {
 			VERBOSE(stderr, "stat failed on %s\n", fullname);
@@ -372,7 +457,6 @@ static int scan_devdir(unsigned int fmajor, unsigned int fminor, char *fullname,
 		}
 		if (major(statbuf.st_rdev) == fmajor &&
 		    minor(statbuf.st_rdev) == fminor) {
-			VERBOSE(stdout, "Node found: %s\n", fullname);
 			result = 0;
 			break;
 		}
@@ -382,6 +466,113 @@ static int scan_devdir(unsigned int fmajor, unsigned int fminor, char *fullname,
 	return result;
 }
 
+/*
+ * Read the value of a KEY=value line from a sysfs uevent file.
+ */
+static bool read_uevent_value(const char *filename, const char *key,
+			      char *value, size_t maxlen)
+{
+	size_t keylen = strlen(key);
+	char line[DEV_FILENAME_LEN + 16];
+	bool found = false;
+
+	FILE *fh = fopen(filename, "r");
+	if (!fh) {
+		return false;
+	}
+	while (fgets(line, sizeof(line), fh)) {
+		if (strncmp(line, key, keylen) != 0 || line[keylen] != '=') {
+			continue;
+		}
+		line[strcspn(line, "\n")] = 0;
+		/* a truncated value would name the wrong device */
+		if ((size_t)snprintf(value, maxlen, "%s", line + keylen + 1) <
+		    maxlen) {
+			found = value[0] != 0;
+		}
+		break;
+	}
+	(void)fclose(fh);
+	return found;
+}
+
+/*
+ * The kernel reports the node name of each block device in its uevent
+ * file, so the node can be located without scanning the dev directory.
+ */
+static int resolve_devnode(const char *sysdir, char *fullname,
+			   unsigned int maxlen)
+{
+	char filename[DEV_FILENAME_LEN + 16];
+	char devname[DEV_FILENAME_LEN];
+	struct stat statbuf;
+
+	(void)snprintf(filename, sizeof(filename), "%s/uevent", sysdir);
+	if (!read_uevent_value(filename, "DEVNAME", devname,
+			       sizeof(devname))) {
+		return -1;
+	}
+	(void)snprintf(fullname, maxlen, "%s%s/%s", sysroot, DEVDIR, devname);
+	if (stat(fullname, &statbuf) == -1) {
+		VERBOSE(stderr, "Node %s not found\n", fullname);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Assign the device nodes of the partitions found in the partition table,
+ * using the partition numbers the kernel reports for the subdirectories of
+ * /sys/block/<disk>. Partitions which cannot be resolved keep a NULL path.
+ */
+static void resolve_partition_nodes(PedDevice *dev, const char *devname)
+{
+	char dirname[DEV_FILENAME_LEN + 16];
+	char filename[2 * DEV_FILENAME_LEN + 48];
+	char partdir[2 * DEV_FILENAME_LEN + 32];
+	char fullname[DEV_FILENAME_LEN + 16];
+	const struct dirent *entry;
+
+	(void)snprintf(dirname, sizeof(dirname), "%s%s/%s", sysroot,
+		       SYSBLOCKDIR, devname);
+	DIR *sysdevdir = opendir(dirname);
+	if (!sysdevdir) {
+		return;
+	}
+	while ((entry = readdir(sysdevdir))) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		(void)snprintf(partdir, sizeof(partdir), "%s/%s", dirname,
+			       entry->d_name);
+		(void)snprintf(filename, sizeof(filename), "%s/partition",
+			       partdir);
+		FILE *fh = fopen(filename, "r");
+		if (!fh) {
+			continue;
+		}
+		unsigned int partnum;
+		int res = fscanf(fh, "%u", &partnum);
+		(void)fclose(fh);
+		if (res != 1) {
+			continue;
+		}
+		PedPartition *part = dev->part_list;
+		while (part && part->num != partnum) {
+			part = part->next;
+		}
+		if (!part || part->path) {
+			continue;
+		}
+		if (resolve_devnode(partdir, fullname, sizeof(fullname)) != 0) {
+			continue;
+		}
+		part->path = strdup(fullname);
+		VERBOSE(stdout, "Partition %u: %s\n", partnum, fullname);
+	}
+	closedir(sysdevdir);
+}
+
 static int get_major_minor(const char *filename, unsigned int *major,
 			   unsigned int *minor)
 {
@@ -401,14 +592,50 @@ static int get_major_minor(const char *filename, unsigned int *major,
 	return 0;
 }
 
+bool ebgpart_read_disk_id(const char *path, char *id, size_t maxlen)
+{
+	struct Masterbootrecord mbr;
+	struct EFIHeader efihdr;
+	uint32_t signature;
+	bool valid;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	/* the GPT header occupies one sector, even if the struct is larger */
+	memset(&efihdr, 0, sizeof(efihdr));
+	valid = pread64(fd, &mbr, sizeof(mbr), 0) == sizeof(mbr) &&
+		pread64(fd, &efihdr, LB_SIZE, LB_SIZE) == LB_SIZE;
+	close(fd);
+	if (!valid || mbr.mbrsignature != 0xaa55) {
+		return false;
+	}
+	if (mbr.parttable[0].partition_type == MBR_TYPE_GPT &&
+	    memcmp(efihdr.signature, "EFI PART", 8) == 0) {
+		/* the CRC of the entry array covers all partition GUIDs */
+		(void)snprintf(id, maxlen, "gpt:%s:%08X",
+			       GUID_to_str(efihdr.GUID),
+			       efihdr.partitiontable_CRC32);
+	} else {
+		memcpy(&signature, mbr.devsignature, sizeof(signature));
+		(void)snprintf(id, maxlen, "mbr:%08X:%08X", signature,
+			       bgenv_crc32(0, mbr.parttable,
+					   sizeof(mbr.parttable)));
+	}
+	return true;
+}
+
 void ped_device_probe_all(const char *rootdev)
 {
 	const struct dirent *sysblockfile = NULL;
 	char fullname[DEV_FILENAME_LEN+16];
+	char sysdir[DEV_FILENAME_LEN+16];
 
-	DIR *sysblockdir = opendir(SYSBLOCKDIR);
+	(void)snprintf(sysdir, sizeof(sysdir), "%s%s", sysroot, SYSBLOCKDIR);
+	DIR *sysblockdir = opendir(sysdir);
 	if (!sysblockdir) {
-		VERBOSE(stderr, "Could not open %s\n", SYSBLOCKDIR);
+		VERBOSE(stderr, "Could not open %s\n", sysdir);
 		return;
 	}
 
@@ -427,8 +654,8 @@ void ped_device_probe_all(const char *rootdev)
 			devname = sysblockfile->d_name;
 		}
 
-		(void)snprintf(fullname, sizeof(fullname), "/sys/block/%s/dev",
-			       devname);
+		(void)snprintf(fullname, sizeof(fullname), "%s%s/%s/dev",
+			       sysroot, SYSBLOCKDIR, devname);
 		/* Get major and minor revision from /sys/block/sdX/dev */
 		unsigned int fmajor, fminor;
 		if (get_major_minor(fullname, &fmajor, &fminor) < 0) {
@@ -437,18 +664,25 @@ void ped_device_probe_all(const char *rootdev)
 		VERBOSE(stdout,
 			"Trying device with: Major = %u, Minor = %u, (%s)\n",
 			fmajor, fminor, fullname);
-		/* Check if this file is really in the dev directory */
-		(void)snprintf(fullname, sizeof(fullname), "%s/%s", DEVDIR,
-			       devname);
-		struct stat statbuf;
-		if (stat(fullname, &statbuf) == -1) {
-			/* Node with same name not found in /dev, thus search
-			* for node with identical Major and Minor revision */
-			if (scan_devdir(fmajor, fminor, fullname,
-					sizeof(fullname)) != 0) {
-				continue;
+		/* Ask the kernel for the node name of this device */
+		(void)snprintf(sysdir, sizeof(sysdir), "%s%s/%u:%u", sysroot,
+			       SYSDEVBLOCKDIR, fmajor, fminor);
+		if (resolve_devnode(sysdir, fullname, sizeof(fullname)) != 0) {
+			/* Check if this file is really in the dev directory */
+			(void)snprintf(fullname, sizeof(fullname), "%s%s/%s",
+				       sysroot, DEVDIR, devname);
+			struct stat statbuf;
+			if (stat(fullname, &statbuf) == -1) {
+				/* Node with same name not found in /dev, thus
+				 * search for node with identical Major and
+				 * Minor revision */
+				if (scan_devdir(fmajor, fminor, fullname,
+						sizeof(fullname)) != 0) {
+					continue;
+				}
 			}
 		}
+		VERBOSE(stdout, "Node found: %s\n", fullname);
 		/* This is a block device, so add it to the list*/
 		PedDevice *dev = calloc(1 ,sizeof(PedDevice));
 		if (!dev) {
@@ -463,6 +697,7 @@ void ped_device_probe_all(const char *rootdev)
 			goto pedprobe_error;
 		}
 		if (check_partition_table(dev)) {
+			resolve_partition_nodes(dev, devname);
 			add_block_dev(dev);
 			continue;
 		}
@@ -477,6 +712,7 @@ pedprobe_error:
 
 static inline void ped_partition_destroy(PedPartition *p)
 {
+	free(p->path);
 	free(p);
 }
 
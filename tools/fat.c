@@ -11,9 +11,14 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <linux/types.h>
 #include <linux/byteorder/little_endian.h>
@@ -185,3 +190,369 @@ int determine_FAT_bits(const struct fat_boot_sector *sector, bool verbosity)
 		return (total_clusters > MAX_FAT12) ? 16 : 12;
 	}
 }
+
+static int fat_read_volume(int fd, struct fat_volume *vol, bool verbosity)
+{
+	struct fat_boot_sector sector;
+	struct fat_bios_param_block bpb;
+	u32 fat_length, total_sectors, rootdir_sectors, data_start;
+
+	if (pread64(fd, &sector, sizeof(sector), 0) != sizeof(sector)) {
+		return errno ? -errno : -EIO;
+	}
+	vol->fat_bits = determine_FAT_bits(&sector, verbosity);
+	if (vol->fat_bits <= 0) {
+		return -EINVAL;
+	}
+	fat_read_bpb(NULL, &sector, 1, &bpb);
+
+	fat_length = bpb.fat_fat_length ? bpb.fat_fat_length : bpb.fat32_length;
+	total_sectors = bpb.fat_sectors ? bpb.fat_sectors : bpb.fat_total_sect;
+	rootdir_sectors = bpb.fat_dir_entries * sizeof(struct msdos_dir_entry) /
+			  bpb.fat_sector_size;
+	if (vol->fat_bits != 32 &&
+	    (rootdir_sectors == 0 ||
+	     bpb.fat_dir_entries * sizeof(struct msdos_dir_entry) %
+		     bpb.fat_sector_size)) {
+		if (verbosity) {
+			fprintf(stderr, "bogus number of root entries %u\n",
+				(unsigned)bpb.fat_dir_entries);
+		}
+		return -EINVAL;
+	}
+	data_start = bpb.fat_reserved + bpb.fat_fats * fat_length +
+		     rootdir_sectors;
+	if (total_sectors <= data_start) {
+		if (verbosity) {
+			fprintf(stderr, "bogus number of total sectors %u\n",
+				(unsigned)total_sectors);
+		}
+		return -EINVAL;
+	}
+
+	vol->fd = fd;
+	vol->sector_size = bpb.fat_sector_size;
+	vol->cluster_size = bpb.fat_sector_size * bpb.fat_sec_per_clus;
+	vol->fat_start = (off64_t)bpb.fat_reserved * bpb.fat_sector_size;
+	vol->root_start = vol->fat_start +
+			  (off64_t)bpb.fat_fats * fat_length *
+				  bpb.fat_sector_size;
+	vol->root_entries = bpb.fat_dir_entries;
+	vol->root_cluster = bpb.fat32_root_cluster;
+	vol->data_start = (off64_t)data_start * bpb.fat_sector_size;
+	/* clusters are numbered starting at 2 */
+	vol->max_cluster =
+		(total_sectors - data_start) / bpb.fat_sec_per_clus + 1;
+	return 0;
+}
+
+static bool fat_cluster_valid(const struct fat_volume *vol, u32 cluster)
+{
+	return cluster >= 2 && cluster <= vol->max_cluster;
+}
+
+static off64_t fat_cluster_offset(const struct fat_volume *vol, u32 cluster)
+{
+	return vol->data_start + (off64_t)(cluster - 2) * vol->cluster_size;
+}
+
+/*
+ * Looks up the successor of cluster in the first FAT. Returns 0 if the chain
+ * ends here, the next cluster number if valid, and -1 on any error.
+ */
+static int64_t fat_next_cluster(const struct fat_volume *vol, u32 cluster)
+{
+	u8 entry[4];
+	off64_t offset;
+	u32 next, eoc;
+
+	switch (vol->fat_bits) {
+	case 12:
+		offset = cluster + cluster / 2;
+		if (pread64(vol->fd, entry, 2, vol->fat_start + offset) != 2) {
+			return -1;
+		}
+		next = get_unaligned_le16(entry);
+		next = (cluster & 1) ? next >> 4 : next & 0xfff;
+		eoc = 0xff8;
+		break;
+	case 16:
+		offset = (off64_t)cluster * 2;
+		if (pread64(vol->fd, entry, 2, vol->fat_start + offset) != 2) {
+			return -1;
+		}
+		next = get_unaligned_le16(entry);
+		eoc = 0xfff8;
+		break;
+	default:
+		offset = (off64_t)cluster * 4;
+		if (pread64(vol->fd, entry, 4, vol->fat_start + offset) != 4) {
+			return -1;
+		}
+		next = get_unaligned_le32(entry) & 0x0fffffff;
+		eoc = 0x0ffffff8;
+		break;
+	}
+	if (next >= eoc) {
+		return 0;
+	}
+	if (!fat_cluster_valid(vol, next)) {
+		return -1;
+	}
+	return next;
+}
+
+static bool fat_name_to_83(const char *filename, char name[MSDOS_NAME])
+{
+	const char *dot = strrchr(filename, '.');
+	size_t base_len = dot ? (size_t)(dot - filename) : strlen(filename);
+	size_t ext_len = dot ? strlen(dot + 1) : 0;
+
+	if (base_len == 0 || base_len > 8 || ext_len > 3) {
+		return false;
+	}
+	memset(name, ' ', MSDOS_NAME);
+	for (size_t i = 0; i < base_len; i++) {
+		name[i] = toupper((unsigned char)filename[i]);
+	}
+	for (size_t i = 0; i < ext_len; i++) {
+		name[8 + i] = toupper((unsigned char)dot[1 + i]);
+	}
+	return true;
+}
+
+/*
+ * Scans a chunk of directory entries. Returns 1 if name was found, -1 if the
+ * end-of-directory marker was hit and 0 if scanning shall continue.
+ */
+static int fat_scan_dir(const u8 *buf, size_t len, const char *name,
+			struct msdos_dir_entry *dirent)
+{
+	for (size_t pos = 0; pos + sizeof(*dirent) <= len;
+	     pos += sizeof(*dirent)) {
+		const struct msdos_dir_entry *de =
+			(const struct msdos_dir_entry *)(buf + pos);
+
+		if (de->name[0] == 0) {
+			return -1;
+		}
+		if (de->name[0] == DELETED_FLAG || de->attr == ATTR_EXT ||
+		    (de->attr & (ATTR_VOLUME | ATTR_DIR))) {
+			continue;
+		}
+		if (memcmp(de->name, name, MSDOS_NAME) == 0) {
+			memcpy(dirent, de, sizeof(*dirent));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int fat_find_root_dirent(const struct fat_volume *vol, const char *name,
+				struct msdos_dir_entry *dirent)
+{
+	size_t chunk = vol->fat_bits == 32 ? vol->cluster_size
+					   : vol->sector_size;
+	int result = -ENOENT;
+	u8 *buf;
+
+	buf = malloc(chunk);
+	if (!buf) {
+		return -ENOMEM;
+	}
+	if (vol->fat_bits == 32) {
+		int64_t cluster = vol->root_cluster;
+		u32 visited = 0;
+
+		if (!fat_cluster_valid(vol, cluster)) {
+			result = -EINVAL;
+			goto out;
+		}
+		while (cluster > 0 && visited++ < vol->max_cluster) {
+			int found;
+
+			if (pread64(vol->fd, buf, chunk,
+				    fat_cluster_offset(vol, cluster)) !=
+			    (ssize_t)chunk) {
+				result = -EIO;
+				goto out;
+			}
+			found = fat_scan_dir(buf, chunk, name, dirent);
+			if (found) {
+				result = found > 0 ? 0 : -ENOENT;
+				goto out;
+			}
+			cluster = fat_next_cluster(vol, cluster);
+		}
+		if (cluster < 0) {
+			result = -EIO;
+		}
+	} else {
+		off64_t end = vol->root_start + (off64_t)vol->root_entries *
+							sizeof(*dirent);
+
+		for (off64_t pos = vol->root_start; pos < end; pos += chunk) {
+			int found;
+
+			if (pread64(vol->fd, buf, chunk, pos) != (ssize_t)chunk) {
+				result = -EIO;
+				goto out;
+			}
+			found = fat_scan_dir(buf, chunk, name, dirent);
+			if (found) {
+				result = found > 0 ? 0 : -ENOENT;
+				goto out;
+			}
+		}
+	}
+out:
+	free(buf);
+	return result;
+}
+
+int fat_file_open(const char *devpath, const char *filename, bool writable,
+		  struct fat_file *file, bool verbosity)
+{
+	struct msdos_dir_entry dirent;
+	char name[MSDOS_NAME];
+	int64_t cluster;
+	int fd, result;
+
+	memset(file, 0, sizeof(*file));
+	file->vol.fd = -1;
+
+	if (!fat_name_to_83(filename, name)) {
+		return -EINVAL;
+	}
+	fd = open(devpath, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	if (fd < 0) {
+		return -errno;
+	}
+	result = fat_read_volume(fd, &file->vol, verbosity);
+	if (result) {
+		close(fd);
+		return result;
+	}
+	result = fat_find_root_dirent(&file->vol, name, &dirent);
+	if (result) {
+		goto error;
+	}
+
+	file->size = le32_to_cpu(dirent.size);
+	file->num_clusters = (file->size + file->vol.cluster_size - 1) /
+			     file->vol.cluster_size;
+	if (file->num_clusters == 0) {
+		return 0;
+	}
+	file->clusters = calloc(file->num_clusters, sizeof(uint32_t));
+	if (!file->clusters) {
+		result = -ENOMEM;
+		goto error;
+	}
+	cluster = le16_to_cpu(dirent.start);
+	if (file->vol.fat_bits == 32) {
+		cluster |= (u32)le16_to_cpu(dirent.starthi) << 16;
+	}
+	for (u32 n = 0; n < file->num_clusters; n++) {
+		if (!fat_cluster_valid(&file->vol, cluster)) {
+			if (verbosity) {
+				fprintf(stderr,
+					"Broken cluster chain for %s on %s\n",
+					filename, devpath);
+			}
+			result = -EIO;
+			goto error;
+		}
+		file->clusters[n] = cluster;
+		if (n + 1 < file->num_clusters) {
+			cluster = fat_next_cluster(&file->vol, cluster);
+		}
+	}
+	return 0;
+
+error:
+	fat_file_close(file);
+	return result;
+}
+
+static ssize_t fat_file_io(const struct fat_file *file, void *buf,
+			   size_t count, off64_t offset, bool write)
+{
+	const struct fat_volume *vol = &file->vol;
+	size_t done = 0;
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((uint64_t)offset >= file->size) {
+		count = 0;
+	} else if (count > (uint64_t)(file->size - offset)) {
+		count = file->size - offset;
+	}
+	while (done < count) {
+		u32 index = (offset + done) / vol->cluster_size;
+		u32 within = (offset + done) % vol->cluster_size;
+		u32 run = 1;
+		size_t len;
+		ssize_t ret;
+
+		/* merge physically contiguous clusters into one request */
+		while (index + run < file->num_clusters &&
+		       file->clusters[index + run] ==
+			       file->clusters[index] + run) {
+			run++;
+		}
+		len = (size_t)run * vol->cluster_size - within;
+		if (len > count - done) {
+			len = count - done;
+		}
+		off64_t pos = fat_cluster_offset(vol, file->clusters[index]) +
+			      within;
+		if (write) {
+			ret = pwrite64(vol->fd, (const u8 *)buf + done, len,
+				       pos);
+		} else {
+			ret = pread64(vol->fd, (u8 *)buf + done, len, pos);
+		}
+		if (ret < 0) {
+			return -1;
+		}
+		if (ret == 0) {
+			break;
+		}
+		done += ret;
+	}
+	return done;
+}
+
+ssize_t fat_file_pread(const struct fat_file *file, void *buf, size_t count,
+		       off64_t offset)
+{
+	return fat_file_io(file, buf, count, offset, false);
+}
+
+ssize_t fat_file_pwrite(const struct fat_file *file, const void *buf,
+			size_t count, off64_t offset)
+{
+	if (offset < 0 || (uint64_t)offset + count > file->size) {
+		errno = ENOSPC;
+		return -1;
+	}
+	return fat_file_io(file, (void *)buf, count, offset, true);
+}
+
+int fat_file_sync(const struct fat_file *file)
+{
+	return fdatasync(file->vol.fd);
+}
+
+void fat_file_close(struct fat_file *file)
+{
+	free(file->clusters);
+	file->clusters = NULL;
+	if (file->vol.fd >= 0) {
+		close(file->vol.fd);
+		file->vol.fd = -1;
+	}
+}
@@ -12,6 +12,8 @@
  */
 #pragma once
 
+#include <stdint.h>
+#include <sys/types.h>
 #include <linux/msdos_fs.h>
 #include "ebgpart.h"
 
@@ -23,3 +25,62 @@
  * occurs during the determination process, the function returns a value less than or equal to 0.
  */
 int determine_FAT_bits(const struct fat_boot_sector *sector, bool verbosity);
+
+/**
+ * Geometry of a FAT volume as needed to access it without mounting it.
+ * All offsets are in bytes relative to the start of the volume.
+ */
+struct fat_volume {
+	int fd;
+	int fat_bits;
+	uint32_t sector_size;
+	uint32_t cluster_size;
+	off64_t fat_start;
+	off64_t root_start;	/* FAT12/16 only */
+	uint32_t root_entries;	/* FAT12/16 only */
+	uint32_t root_cluster;	/* FAT32 only */
+	off64_t data_start;
+	uint32_t max_cluster;
+};
+
+/**
+ * A regular file in the root directory of a FAT volume, resolved to the
+ * list of its clusters.
+ */
+struct fat_file {
+	struct fat_volume vol;
+	uint32_t size;
+	uint32_t num_clusters;
+	uint32_t *clusters;
+};
+
+/**
+ * Opens the file filename (8.3 name) in the root directory of the FAT
+ * volume on devpath without mounting it. The volume is opened read-write if
+ * writable is set. Returns 0 on success, a negative errno code otherwise.
+ */
+int fat_file_open(const char *devpath, const char *filename, bool writable,
+		  struct fat_file *file, bool verbosity);
+
+/**
+ * Reads up to count bytes at offset from the file. Returns the number of
+ * bytes read or -1 on error.
+ */
+ssize_t fat_file_pread(const struct fat_file *file, void *buf, size_t count,
+		       off64_t offset);
+
+/**
+ * Overwrites count bytes at offset within the allocated clusters of the
+ * file. Neither the file size nor the cluster chain is changed, so writes
+ * beyond the end of the file fail with ENOSPC. Returns the number of bytes
+ * written or -1 on error.
+ */
+ssize_t fat_file_pwrite(const struct fat_file *file, const void *buf,
+			size_t count, off64_t offset);
+
+/**
+ * Flushes written data to the device.
+ */
+int fat_file_sync(const struct fat_file *file);
+
+void fat_file_close(struct fat_file *file);
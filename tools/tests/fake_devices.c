@@ -12,7 +12,13 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
 #include <env_api.h>
 #include <env_config_file.h>
 #include <env_config_partitions.h>
@@ -78,6 +84,7 @@ static void remove_fake_partitions(int n)
 	PedPartition *next;
 	while(pp) {
 		next = pp->next;
+		free(pp->path);
 		free(pp);
 		pp = next;
 	}
@@ -106,3 +113,122 @@ PedDevice *ped_device_get_next_custom_fake(const PedDevice *dev)
 
 	return dev->next;
 }
+
+static void write_fake_file(const char *root, const char *name,
+			    const void *data, size_t len)
+{
+	char *path;
+	FILE *f;
+
+	if (asprintf(&path, "%s/%s", root, name) == -1) {
+		exit(1);
+	}
+	f = fopen(path, "w");
+	if (!f || (len && fwrite(data, len, 1, f) != 1)) {
+		exit(1);
+	}
+	fclose(f);
+	free(path);
+}
+
+static void make_fake_dir(const char *root, const char *name)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/%s", root, name) == -1) {
+		exit(1);
+	}
+	if (mkdir(path, 0755) && errno != EEXIST) {
+		exit(1);
+	}
+	free(path);
+}
+
+static void add_fake_sysfs_node(const char *root, const char *sysdir,
+				const char *devname, bool with_uevent)
+{
+	char name[256];
+	char buf[256];
+
+	make_fake_dir(root, sysdir);
+	if (!with_uevent) {
+		return;
+	}
+	(void)snprintf(name, sizeof(name), "%s/uevent", sysdir);
+	(void)snprintf(buf, sizeof(buf), "MAJOR=250\nDEVNAME=%s\n", devname);
+	write_fake_file(root, name, buf, strlen(buf));
+}
+
+/*
+ * Create a sysfs and dev directory layout below a temporary directory,
+ * for use with ebgpart_set_sysroot. Each disk vd<i> (250:<16*i>) has one
+ * FAT16 partition and is named fakedisk<i> in dev, so that its node
+ * cannot be found by name. num_nodes unrelated nodes are added to dev.
+ */
+char *create_fake_sysfs(int num_disks, int num_nodes, bool with_uevent)
+{
+	struct Masterbootrecord mbr;
+	char name[256];
+	char buf[64];
+	char *root;
+
+	root = strdup("/tmp/fake_sysfs.XXXXXX");
+	if (!root || !mkdtemp(root)) {
+		exit(1);
+	}
+	make_fake_dir(root, "sys");
+	make_fake_dir(root, "sys/block");
+	make_fake_dir(root, "sys/dev");
+	make_fake_dir(root, "sys/dev/block");
+	make_fake_dir(root, "dev");
+
+	memset(&mbr, 0, sizeof(mbr));
+	mbr.parttable[0].partition_type = MBR_TYPE_FAT16;
+	mbr.parttable[0].start_LBA = 2048;
+	mbr.mbrsignature = 0xaa55;
+
+	for (int i = 0; i < num_disks; i++) {
+		(void)snprintf(name, sizeof(name), "sys/block/vd%d", i);
+		make_fake_dir(root, name);
+		(void)snprintf(name, sizeof(name), "sys/block/vd%d/dev", i);
+		(void)snprintf(buf, sizeof(buf), "250:%d\n", 16 * i);
+		write_fake_file(root, name, buf, strlen(buf));
+
+		(void)snprintf(name, sizeof(name), "sys/dev/block/250:%d",
+			       16 * i);
+		(void)snprintf(buf, sizeof(buf), "fakedisk%d", i);
+		add_fake_sysfs_node(root, name, buf, with_uevent);
+
+		(void)snprintf(name, sizeof(name), "sys/block/vd%d/vd%d1", i,
+			       i);
+		(void)snprintf(buf, sizeof(buf), "fakedisk%dp1", i);
+		add_fake_sysfs_node(root, name, buf, with_uevent);
+		(void)snprintf(name, sizeof(name),
+			       "sys/block/vd%d/vd%d1/partition", i, i);
+		write_fake_file(root, name, "1\n", 2);
+
+		(void)snprintf(name, sizeof(name), "dev/fakedisk%d", i);
+		write_fake_file(root, name, &mbr, sizeof(mbr));
+		(void)snprintf(name, sizeof(name), "dev/fakedisk%dp1", i);
+		write_fake_file(root, name, NULL, 0);
+	}
+	for (int i = 0; i < num_nodes; i++) {
+		(void)snprintf(name, sizeof(name), "dev/node%d", i);
+		write_fake_file(root, name, NULL, 0);
+	}
+	return root;
+}
+
+static int remove_fake_entry(const char *path,
+			     const struct stat __attribute__((unused)) *sb,
+			     int __attribute__((unused)) flag,
+			     struct FTW __attribute__((unused)) *ftwbuf)
+{
+	return remove(path);
+}
+
+void remove_fake_sysfs(char *root)
+{
+	(void)nftw(root, remove_fake_entry, 16, FTW_DEPTH | FTW_PHYS);
+	free(root);
+}
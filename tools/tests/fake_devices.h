@@ -24,3 +24,6 @@ void add_fake_partition(int devnum);
 void free_fake_devices(void);
 
 PedDevice *ped_device_get_next_custom_fake(const PedDevice *dev);
+
+char *create_fake_sysfs(int num_disks, int num_nodes, bool with_uevent);
+void remove_fake_sysfs(char *root);
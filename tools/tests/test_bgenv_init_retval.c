@@ -24,16 +24,18 @@ DEFINE_FFF_GLOBALS;
 
 static char *devpath = "/dev/nobrain";
 
-bool read_env(CONFIG_PART *part, BG_ENVDATA *env);
+bool read_env(CONFIG_PART *part, BG_ENVDATA **env);
 char *get_rootdev_from_efi(void);
 
 Suite *env_api_fat_suite(void);
-bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart, bool probe_all);
-bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env);
+bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart, uint32_t *count,
+					 bool probe_all);
+bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA **env);
 
 Suite *ebg_test_suite(void);
 
-bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart, bool probe_all)
+bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart, uint32_t *count,
+					 bool probe_all)
 {
 	char *rootdev = NULL;
 	if (!probe_all) {
@@ -42,21 +44,23 @@ bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart, bool probe_all)
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
 		cfgpart[i].devpath = strdup(devpath);
 	}
+	*count = ENV_NUM_CONFIG_PARTS;
 	free(rootdev);
 	return true;
 }
 
-bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env)
+bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA **env)
 {
 	if (!env) {
 		return false;
 	}
-	memset(env, 0, sizeof(BG_ENVDATA));
-	return true;
+	*env = calloc(1, sizeof(BG_ENVDATA));
+	return *env != NULL;
 }
 
-FAKE_VALUE_FUNC(bool, probe_config_partitions, CONFIG_PART *, bool);
-FAKE_VALUE_FUNC(bool, read_env, CONFIG_PART *, BG_ENVDATA *);
+FAKE_VALUE_FUNC(bool, probe_config_partitions, CONFIG_PART *, uint32_t *,
+		bool);
+FAKE_VALUE_FUNC(bool, read_env, CONFIG_PART *, BG_ENVDATA **);
 FAKE_VALUE_FUNC(char *, get_rootdev_from_efi);
 
 START_TEST(env_api_fat_test_bgenv_init_retval)
@@ -0,0 +1,254 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <check.h>
+#include <fff.h>
+
+#include <env_api.h>
+#include <env_api_crc32.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+#define BENCH_ROUNDS 200
+
+static const BGENV_CRC32_IMPL *reference_impl(void)
+{
+	/* the plain table lookup is the last fallback */
+	return &bgenv_crc32_impls[bgenv_crc32_num_impls - 1];
+}
+
+START_TEST(crc32_known_value)
+{
+	const char *str = "123456789";
+
+	ck_assert_uint_eq(bgenv_crc32(0, str, strlen(str)), 0xCBF43926);
+	ck_assert_uint_eq(bgenv_crc32(0, str, 0), 0);
+	/* chaining must yield the same result */
+	ck_assert_uint_eq(bgenv_crc32(bgenv_crc32(0, str, 4), str + 4, 5),
+			  0xCBF43926);
+}
+END_TEST
+
+START_TEST(crc32_variants_bit_exact)
+{
+	const BGENV_CRC32_IMPL *ref = reference_impl();
+	static uint8_t buf[4096 + 16];
+
+	srand(42);
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = rand();
+	}
+
+	for (size_t i = 0; i < bgenv_crc32_num_impls; i++) {
+		const BGENV_CRC32_IMPL *impl = &bgenv_crc32_impls[i];
+
+		if (!impl->supported()) {
+			continue;
+		}
+		for (size_t offs = 0; offs < 16; offs++) {
+			for (size_t len = 0; len <= 4096;
+			     len += len < 256 ? 1 : 61) {
+				uint32_t crc = rand();
+
+				ck_assert_msg(impl->update(crc, buf + offs,
+							   len) ==
+						      ref->update(crc,
+								  buf + offs,
+								  len),
+					      "%s differs at offset %zu, "
+					      "length %zu",
+					      impl->name, offs, len);
+			}
+		}
+	}
+}
+END_TEST
+
+START_TEST(crc32_combine)
+{
+	static uint8_t buf[1024];
+
+	srand(7);
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = rand();
+	}
+	for (size_t len1 = 0; len1 <= sizeof(buf); len1 += 97) {
+		size_t len2 = sizeof(buf) - len1;
+
+		ck_assert_uint_eq(bgenv_crc32_combine(
+					  bgenv_crc32(0, buf, len1),
+					  bgenv_crc32(0, buf + len1, len2),
+					  len2),
+				  bgenv_crc32(0, buf, sizeof(buf)));
+	}
+}
+END_TEST
+
+START_TEST(crc32_incremental_update)
+{
+	BG_ENVDATA *data = calloc(1, sizeof(BG_ENVDATA));
+	BGENV env = {.data = data, .userdata_size = ENV_MEM_USERVARS};
+	char key[16], value[64];
+
+	ck_assert(data != NULL);
+	ebg_set_opt_bool(EBG_OPT_CRC_CROSS_CHECK, false);
+	/* the first update establishes a valid CRC to patch */
+	bgenv_crc_update(&env);
+	ck_assert(env.crc.tracking);
+
+	srand(13);
+	for (int round = 0; round < 200; round++) {
+		for (int n = rand() % 4; n >= 0; n--) {
+			snprintf(key, sizeof(key), "var%d", rand() % 12);
+			snprintf(value, sizeof(value), "%0*d",
+				 rand() % 40 + 1, rand());
+			switch (rand() % 4) {
+			case 0:
+				bgenv_set(&env, "kernelparams", 0, value,
+					  strlen(value) + 1);
+				break;
+			case 1:
+				snprintf(value, sizeof(value), "%d",
+					 rand() % 100);
+				bgenv_set(&env, "revision", 0, value,
+					  strlen(value) + 1);
+				break;
+			case 2:
+				bgenv_set(&env, key, USERVAR_TYPE_DELETED, "",
+					  1);
+				break;
+			default:
+				bgenv_set(&env, key, USERVAR_TYPE_DEFAULT,
+					  value, strlen(value) + 1);
+				break;
+			}
+		}
+		bgenv_crc_update(&env);
+		ck_assert_uint_eq(data->crc32,
+				  bgenv_crc32(0, data,
+					      sizeof(BG_ENVDATA) -
+						      sizeof(data->crc32)));
+	}
+	free(data);
+}
+END_TEST
+
+START_TEST(crc32_batch_update)
+{
+	BG_ENVDATA *data = calloc(1, sizeof(BG_ENVDATA));
+	BGENV env = {.data = data, .userdata_size = ENV_MEM_USERVARS};
+	uint64_t type = USERVAR_TYPE_DEFAULT;
+	char keys[3][16], values[3][16];
+
+	ck_assert(data != NULL);
+	ebg_set_opt_bool(EBG_OPT_CRC_CROSS_CHECK, false);
+	for (int n = 0; n < 50; n++) {
+		snprintf(keys[0], sizeof(keys[0]), "var%d", n);
+		snprintf(values[0], sizeof(values[0]), "%08d", n);
+		bgenv_set(&env, keys[0], type, values[0],
+			  strlen(values[0]) + 1);
+	}
+	bgenv_crc_update(&env);
+
+	/* values of the same size only touch their records */
+	for (int n = 0; n < 3; n++) {
+		snprintf(keys[n], sizeof(keys[n]), "var%d", n * 20);
+		snprintf(values[n], sizeof(values[n]), "%08d", n + 100);
+	}
+	const ebg_kv_t kvs[] = {
+		{keys[0], type, (uint8_t *)values[0], 9},
+		{keys[1], type, (uint8_t *)values[1], 9},
+		{keys[2], type, (uint8_t *)values[2], 9},
+	};
+	ck_assert_int_eq(bgenv_set_many(&env, kvs, 3), 0);
+	ck_assert(!env.crc.full);
+	ck_assert_uint_eq(env.crc.num_ranges, 3);
+	for (uint32_t i = 0; i < env.crc.num_ranges; i++) {
+		const BGENV_CRC_RANGE *r = &env.crc.ranges[i];
+
+		ck_assert_uint_le(r->end - r->start, 9);
+	}
+	bgenv_crc_update(&env);
+	ck_assert_uint_eq(data->crc32,
+			  bgenv_crc32(0, data,
+				      sizeof(BG_ENVDATA) - sizeof(data->crc32)));
+
+	/* deleting a variable moves everything behind it */
+	const ebg_kv_t del[] = {
+		{"var10", USERVAR_TYPE_DELETED, (uint8_t *)"", 1},
+	};
+	ck_assert_int_eq(bgenv_set_many(&env, del, 1), 0);
+	bgenv_crc_update(&env);
+	ck_assert_uint_eq(data->crc32,
+			  bgenv_crc32(0, data,
+				      sizeof(BG_ENVDATA) - sizeof(data->crc32)));
+	free(data);
+}
+END_TEST
+
+START_TEST(crc32_benchmark)
+{
+	BG_ENVDATA *data = malloc(sizeof(BG_ENVDATA));
+
+	ck_assert(data != NULL);
+	memset(data, 0x5A, sizeof(BG_ENVDATA));
+
+	for (size_t i = 0; i < bgenv_crc32_num_impls; i++) {
+		const BGENV_CRC32_IMPL *impl = &bgenv_crc32_impls[i];
+		struct timespec start, end;
+		uint32_t crc = 0;
+		double secs;
+
+		if (!impl->supported()) {
+			printf("crc32 %-12s: not supported\n", impl->name);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int n = 0; n < BENCH_ROUNDS; n++) {
+			crc = impl->update(crc, (const uint8_t *)data,
+					   sizeof(BG_ENVDATA));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		secs = (end.tv_sec - start.tv_sec) +
+		       (end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("crc32 %-12s: %10.1f MB/s (crc %08x)\n", impl->name,
+		       secs > 0 ? (double)sizeof(BG_ENVDATA) * BENCH_ROUNDS /
+					  secs / 1e6
+				: 0.0,
+		       crc);
+	}
+	free(data);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("crc32");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, crc32_known_value);
+	tcase_add_test(tc_core, crc32_variants_bit_exact);
+	tcase_add_test(tc_core, crc32_combine);
+	tcase_add_test(tc_core, crc32_incremental_update);
+	tcase_add_test(tc_core, crc32_batch_update);
+	tcase_add_test(tc_core, crc32_benchmark);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,343 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include <fff.h>
+#include <ebgenv.h>
+#include <env_api.h>
+#include <env_config_partitions.h>
+#include <env_layout.h>
+#include <test-interface.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+#define NUM_READERS 8
+
+static BG_ENVDATA disk[ENV_V2_MAX_CONFIG_PARTS];
+static uint32_t disk_parts;
+static ENV_LAYOUT disk_layout;
+
+bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart, uint32_t *count,
+					 bool probe_all);
+bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA **env);
+bool write_env_custom_fake(CONFIG_PART *cp, const BG_ENVDATA *env);
+
+FAKE_VALUE_FUNC(bool, probe_config_partitions, CONFIG_PART *, uint32_t *,
+		bool);
+FAKE_VALUE_FUNC(bool, read_env, CONFIG_PART *, BG_ENVDATA **);
+FAKE_VALUE_FUNC(bool, write_env, CONFIG_PART *, const BG_ENVDATA *);
+
+bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart, uint32_t *count,
+					 bool probe_all)
+{
+	for (uint32_t i = 0; i < disk_parts; i++) {
+		if (asprintf(&cfgpart[i].devpath, "/dev/fake%u", i) < 0) {
+			return false;
+		}
+	}
+	*count = disk_parts;
+	return true;
+}
+
+static int part_index(CONFIG_PART *cp)
+{
+	return cp->devpath[strlen(cp->devpath) - 1] - '0';
+}
+
+static bool copy_from_disk(CONFIG_PART *cp, BG_ENVDATA **env)
+{
+	uint32_t size = env_layout_userdata_size(&disk_layout);
+	BG_ENVDATA *src = &disk[part_index(cp)];
+
+	*env = env_data_alloc(size);
+	if (!*env) {
+		return false;
+	}
+	memcpy(*env, src, ENV_FIXED_SIZE + size);
+	env_data_set_crc32(*env, size,
+			   bgenv_crc32(0, *env, ENV_FIXED_SIZE + size));
+	cp->layout = disk_layout;
+	return true;
+}
+
+bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA **env)
+{
+	return copy_from_disk(cp, env);
+}
+
+bool write_env_custom_fake(CONFIG_PART *cp, const BG_ENVDATA *env)
+{
+	uint32_t size = env_layout_userdata_size(&cp->layout);
+
+	memcpy(&disk[part_index(cp)], env, ENV_DATA_SIZE(size));
+	return true;
+}
+
+static void init_disk(void)
+{
+	memset(disk, 0, sizeof(disk));
+	memset(&disk_layout, 0, sizeof(disk_layout));
+	disk_parts = ENV_NUM_CONFIG_PARTS;
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		disk[i].revision = i + 1;
+		disk[i].crc32 = bgenv_crc32(0, &disk[i],
+					    sizeof(BG_ENVDATA) -
+						    sizeof(disk[i].crc32));
+	}
+
+	RESET_FAKE(probe_config_partitions);
+	RESET_FAKE(read_env);
+	RESET_FAKE(write_env);
+	probe_config_partitions_fake.custom_fake =
+		probe_config_partitions_custom_fake;
+	read_env_fake.custom_fake = read_env_custom_fake;
+	write_env_fake.custom_fake = write_env_custom_fake;
+}
+
+static void *reader(void *arg)
+{
+	ebg_ctx_t *ctx = arg;
+	char buffer[ENV_STRING_LENGTH + 1];
+	intptr_t failed = 0;
+
+	for (int n = 0; n < 100; n++) {
+		ebgenv_t e = {};
+
+		if (ebg_env_open_current_ctx(&e, ctx, true) != 0) {
+			return (void *)1;
+		}
+		if (ebg_env_get(&e, "myvar", buffer) != 0 ||
+		    strcmp(buffer, "value") != 0) {
+			failed = 1;
+		}
+		ebg_env_close(&e);
+	}
+	return (void *)failed;
+}
+
+START_TEST(ebg_ctx_readers_and_writer)
+{
+	pthread_t threads[NUM_READERS];
+	char buffer[ENV_STRING_LENGTH + 1];
+	ebgenv_t e = {};
+	ebg_ctx_t *ctx;
+	void *failed;
+	int ret;
+
+	init_disk();
+
+	ctx = ebg_ctx_new();
+	ck_assert_ptr_nonnull(ctx);
+	ck_assert_int_eq(probe_config_partitions_fake.call_count, 1);
+	ck_assert_int_eq(read_env_fake.call_count, ENV_NUM_CONFIG_PARTS);
+
+	/* a writer updates the latest environment */
+	ck_assert_int_eq(ebg_env_open_current_ctx(&e, ctx, false), 0);
+	ck_assert_int_eq(ebg_env_set(&e, "myvar", "value"), 0);
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+	ck_assert_int_eq(write_env_fake.call_count, 1);
+	ck_assert_int_eq(disk[ENV_NUM_CONFIG_PARTS - 1].crc32,
+			 bgenv_crc32(0, &disk[ENV_NUM_CONFIG_PARTS - 1],
+				     sizeof(BG_ENVDATA) - sizeof(uint32_t)));
+
+	/* read-only handles cannot modify anything */
+	ck_assert_int_eq(ebg_env_open_current_ctx(&e, ctx, true), 0);
+	ck_assert_int_eq(ebg_env_set(&e, "myvar", "other"), -EPERM);
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+	ck_assert_int_eq(write_env_fake.call_count, 1);
+
+	/* readers run in parallel, nothing is probed again */
+	for (int i = 0; i < NUM_READERS; i++) {
+		ck_assert_int_eq(pthread_create(&threads[i], NULL, reader,
+						ctx), 0);
+	}
+	for (int i = 0; i < NUM_READERS; i++) {
+		pthread_join(threads[i], &failed);
+		ck_assert_ptr_null(failed);
+	}
+	ck_assert_int_eq(probe_config_partitions_fake.call_count, 1);
+	ck_assert_int_eq(read_env_fake.call_count, ENV_NUM_CONFIG_PARTS);
+
+	/* changes by others become visible on reload only */
+	memset(disk[ENV_NUM_CONFIG_PARTS - 1].userdata, 0, ENV_MEM_USERVARS);
+	ck_assert_int_eq(ebg_ctx_reload(ctx), 0);
+	ck_assert_int_eq(ebg_env_open_current_ctx(&e, ctx, true), 0);
+	ret = ebg_env_get_ex(&e, "myvar", NULL, (uint8_t *)buffer,
+			     sizeof(buffer));
+	ck_assert_int_eq(ret, -ENOENT);
+	ebg_env_close(&e);
+
+	ebg_ctx_free(ctx);
+}
+END_TEST
+
+static int readers_active, readers_max;
+
+static bool read_env_slow_fake(CONFIG_PART *cp, BG_ENVDATA **env)
+{
+	bool result;
+
+	int active = __atomic_add_fetch(&readers_active, 1, __ATOMIC_SEQ_CST);
+	int max = __atomic_load_n(&readers_max, __ATOMIC_SEQ_CST);
+
+	while (active > max &&
+	       !__atomic_compare_exchange_n(&readers_max, &max, active, false,
+					    __ATOMIC_SEQ_CST,
+					    __ATOMIC_SEQ_CST)) {
+	}
+	/* a slow device */
+	usleep(100000);
+	result = copy_from_disk(cp, env);
+	__atomic_sub_fetch(&readers_active, 1, __ATOMIC_SEQ_CST);
+	return result;
+}
+
+START_TEST(ebg_ctx_parallel_read)
+{
+	ebgenv_t e = {};
+	ebg_ctx_t *ctx;
+	char buffer[ENV_STRING_LENGTH + 1];
+	char expected[16];
+
+	init_disk();
+	read_env_fake.custom_fake = read_env_slow_fake;
+	readers_active = 0;
+	readers_max = 0;
+
+	ebg_set_opt_bool(EBG_OPT_PARALLEL_PROBE, true);
+	ctx = ebg_ctx_new();
+	ebg_set_opt_bool(EBG_OPT_PARALLEL_PROBE, false);
+	ck_assert_ptr_nonnull(ctx);
+	if (ENV_NUM_CONFIG_PARTS > 1) {
+		ck_assert_int_gt(readers_max, 1);
+	}
+
+	/* every environment ended up in its own slot */
+	ck_assert_int_eq(ebg_env_open_current_ctx(&e, ctx, true), 0);
+	ck_assert_int_eq(ebg_env_get(&e, "revision", buffer), 0);
+	snprintf(expected, sizeof(expected), "%d", ENV_NUM_CONFIG_PARTS);
+	ck_assert_str_eq(buffer, expected);
+	ebg_env_close(&e);
+
+	ebg_ctx_free(ctx);
+}
+END_TEST
+
+START_TEST(ebg_ctx_readonly_setglobalstate)
+{
+	BG_ENVDATA before[ENV_NUM_CONFIG_PARTS];
+	ebgenv_t e = {};
+	ebg_ctx_t *ctx;
+
+	init_disk();
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		disk[i].ustate = USTATE_TESTING;
+		disk[i].crc32 = bgenv_crc32(0, &disk[i],
+					    sizeof(BG_ENVDATA) -
+						    sizeof(disk[i].crc32));
+	}
+	memcpy(before, disk, sizeof(before));
+
+	ctx = ebg_ctx_new();
+	ck_assert_ptr_nonnull(ctx);
+
+	ck_assert_int_eq(ebg_env_open_current_ctx(&e, ctx, true), 0);
+	ck_assert_int_eq(ebg_env_setglobalstate(&e, USTATE_OK), -EPERM);
+	ck_assert_int_eq(ebg_env_setglobalstate(&e, USTATE_FAILED), -EPERM);
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+
+	/* neither the context nor the disk were touched */
+	ck_assert_int_eq(write_env_fake.call_count, 0);
+	ck_assert_int_eq(memcmp(disk, before, sizeof(before)), 0);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		ck_assert_int_eq(memcmp(ctx->envdata[i], &before[i],
+					sizeof(BG_ENVDATA)), 0);
+	}
+
+	ebg_ctx_free(ctx);
+}
+END_TEST
+
+START_TEST(ebg_ctx_layout_from_headers)
+{
+	const uint32_t num_parts = ENV_NUM_CONFIG_PARTS + 1;
+	char buffer[ENV_STRING_LENGTH + 1];
+	char expected[16];
+	ebgenv_t e = {};
+	ebg_ctx_t *ctx;
+
+	init_disk();
+	disk_parts = num_parts;
+	disk_layout.version = ENV_LAYOUT_V2;
+	disk_layout.num_config_parts = num_parts;
+	disk_layout.userdata_size = 4096;
+	for (uint32_t i = 0; i < num_parts; i++) {
+		disk[i].revision = i + 1;
+	}
+
+	/* the number of config partitions comes from the environments */
+	ctx = ebg_ctx_new();
+	ck_assert_ptr_nonnull(ctx);
+	ck_assert_uint_eq(ctx->num_parts, num_parts);
+	ck_assert_int_eq(read_env_fake.call_count, num_parts);
+
+	/* and so does the size of the user variables */
+	ck_assert_int_eq(ebg_env_open_current_ctx(&e, ctx, false), 0);
+	ck_assert_uint_eq(((BGENV *)e.bgenv)->userdata_size, 4096);
+	ck_assert_int_eq(ebg_env_get(&e, "revision", buffer), 0);
+	snprintf(expected, sizeof(expected), "%u", num_parts);
+	ck_assert_str_eq(buffer, expected);
+	ck_assert_int_eq(ebg_env_set(&e, "myvar", "value"), 0);
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+	ck_assert_int_eq(write_env_fake.call_count, 1);
+	ck_assert(bgenv_find_uservar(disk[num_parts - 1].userdata, "myvar"));
+
+	ebg_ctx_free(ctx);
+
+	/* environments disagreeing with the partitions found are rejected */
+	disk_parts = ENV_NUM_CONFIG_PARTS;
+	RESET_FAKE(read_env);
+	read_env_fake.custom_fake = read_env_custom_fake;
+	ck_assert_ptr_null(ebg_ctx_new());
+}
+END_TEST
+
+START_TEST(ebg_ctx_new_fails)
+{
+	init_disk();
+	probe_config_partitions_fake.custom_fake = NULL;
+	probe_config_partitions_fake.return_val = false;
+
+	ck_assert_ptr_null(ebg_ctx_new());
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("ebg_ctx");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, ebg_ctx_readers_and_writer);
+	tcase_add_test(tc_core, ebg_ctx_parallel_read);
+	tcase_add_test(tc_core, ebg_ctx_readonly_setglobalstate);
+	tcase_add_test(tc_core, ebg_ctx_layout_from_headers);
+	tcase_add_test(tc_core, ebg_ctx_new_fails);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -77,11 +77,20 @@ int __wrap_bgenv_set(BGENV *env, char *key, uint64_t type, void *buffer,
 	return __real_bgenv_set(env, key, type, buffer, len);
 }
 
-/* These variables substitute weakened symbols in the ebgenv library code
- * so that all environment functions use these as data sources
+static CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
+static BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
+static BG_ENVDATA *envdata_ptrs[ENV_NUM_CONFIG_PARTS];
+
+/* This context substitutes the weakened default context of the ebgenv
+ * library so that all environment functions use the arrays above as data
+ * sources
  */
-CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
-BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
+EBG_CONTEXT bgenv_default_ctx = {
+	.parts = config_parts,
+	.envdata = envdata_ptrs,
+	.num_parts = ENV_NUM_CONFIG_PARTS,
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+};
 
 static void
 init_test()
@@ -89,6 +98,9 @@ init_test()
 	bgenv = bgenv_;
 	memset(config_parts, 0, sizeof(config_parts));
 	memset(envdata, 0, sizeof(envdata));
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		envdata_ptrs[i] = &envdata[i];
+	}
 }
 
 START_TEST(ebgenv_api_ebg_env_options)
@@ -272,6 +284,7 @@ START_TEST(ebgenv_api_ebg_env_get)
 	ck_assert(e.bgenv != NULL);
 
 	((BGENV *)e.bgenv)->data = (BG_ENVDATA *)calloc(1, sizeof(BG_ENVDATA));
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
 	ck_assert(((BGENV *)e.bgenv)->data != NULL);
 
 	bgenv.get_call_count = 0;
@@ -304,6 +317,7 @@ START_TEST(ebgenv_api_ebg_env_set)
 	ck_assert(e.bgenv != NULL);
 
 	((BGENV *)e.bgenv)->data = (BG_ENVDATA *)calloc(1, sizeof(BG_ENVDATA));
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
 	ck_assert(((BGENV *)e.bgenv)->data != NULL);
 
 	(void)ebg_env_set(&e, "kernelfile", value);
@@ -338,6 +352,7 @@ START_TEST(ebgenv_api_ebg_env_set_ex)
 	ck_assert(e.bgenv != NULL);
 
 	((BGENV *)e.bgenv)->data = (BG_ENVDATA *)calloc(1, sizeof(BG_ENVDATA));
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
 	ck_assert(((BGENV *)e.bgenv)->data != NULL);
 
 	bgenv.set_call_count = 0;
@@ -356,6 +371,75 @@ START_TEST(ebgenv_api_ebg_env_set_ex)
 }
 END_TEST
 
+START_TEST(ebgenv_api_ebg_env_set_many)
+{
+	ebgenv_t e = { };
+	uint64_t type = USERVAR_TYPE_STRING_ASCII;
+	char buffer[ENV_STRING_LENGTH + 1];
+	uint32_t crc;
+	int ret;
+
+	init_test();
+
+	e.bgenv = (BGENV *)calloc(1, sizeof(BGENV));
+	ck_assert(e.bgenv != NULL);
+	((BGENV *)e.bgenv)->data = &envdata[0];
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
+
+	(void)ebg_env_set_ex(&e, "a", type, (uint8_t *)"1", 2);
+	(void)ebg_env_set_ex(&e, "b", type, (uint8_t *)"2", 2);
+	(void)ebg_env_set_ex(&e, "c", type, (uint8_t *)"3", 2);
+
+	const ebg_kv_t kvs[] = {
+		{"b", type, (uint8_t *)"changed", 8},
+		{"c", USERVAR_TYPE_DELETED, (uint8_t *)"", 1},
+		{"d", type, (uint8_t *)"first", 6},
+		{"d", type, (uint8_t *)"last", 5},
+		{"kernelfile", type, (uint8_t *)"vmlinuz", 8},
+	};
+	ret = ebg_env_set_many(&e, kvs, sizeof(kvs) / sizeof(kvs[0]));
+	ck_assert_int_eq(ret, 0);
+
+	ret = ebg_env_get_ex(&e, "a", NULL, (uint8_t *)buffer, sizeof(buffer));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_str_eq(buffer, "1");
+	ret = ebg_env_get_ex(&e, "b", NULL, (uint8_t *)buffer, sizeof(buffer));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_str_eq(buffer, "changed");
+	ret = ebg_env_get_ex(&e, "c", NULL, (uint8_t *)buffer, sizeof(buffer));
+	ck_assert_int_eq(ret, -ENOENT);
+	ret = ebg_env_get_ex(&e, "d", NULL, (uint8_t *)buffer, sizeof(buffer));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_str_eq(buffer, "last");
+	ret = ebg_env_get(&e, "kernelfile", buffer);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_str_eq(buffer, "vmlinuz");
+
+	/* a batch which does not fit leaves the environment unchanged */
+	static uint8_t big[ENV_MEM_USERVARS];
+	const ebg_kv_t too_big[] = {
+		{"kernelfile", type, (uint8_t *)"other", 6},
+		{"e", type, (uint8_t *)"5", 2},
+		{"huge", 1ULL << 36, big, sizeof(big) - 64},
+	};
+	ret = ebg_env_set_many(&e, too_big,
+			       sizeof(too_big) / sizeof(too_big[0]));
+	ck_assert_int_eq(ret, -ENOMEM);
+	ret = ebg_env_get_ex(&e, "e", NULL, (uint8_t *)buffer, sizeof(buffer));
+	ck_assert_int_eq(ret, -ENOENT);
+	ret = ebg_env_get(&e, "kernelfile", buffer);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_str_eq(buffer, "vmlinuz");
+
+	/* the checksum is updated once, when the changes are written */
+	bgenv_write_fake.return_val = true;
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+	crc = bgenv_crc32(0, &envdata[0],
+			  sizeof(BG_ENVDATA) - sizeof(envdata[0].crc32));
+	ck_assert_int_eq(envdata[0].crc32, crc);
+}
+END_TEST
+
 START_TEST(ebgenv_api_ebg_env_get_ex)
 {
 	ebgenv_t e = { };
@@ -374,6 +458,7 @@ START_TEST(ebgenv_api_ebg_env_get_ex)
 	ck_assert(e.bgenv != NULL);
 
 	((BGENV *)e.bgenv)->data = (BG_ENVDATA *)calloc(1, sizeof(BG_ENVDATA));
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
 	ck_assert(((BGENV *)e.bgenv)->data != NULL);
 
 	bgenv.get_call_count = 0;
@@ -418,6 +503,7 @@ START_TEST(ebgenv_api_ebg_env_user_free)
 	 * user space is empty
 	 */
 	((BGENV *)e.bgenv)->data = (BG_ENVDATA *)calloc(1, sizeof(BG_ENVDATA));
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
 	ck_assert(((BGENV *)e.bgenv)->data != NULL);
 
 	ret = ebg_env_user_free(&e);
@@ -625,6 +711,7 @@ START_TEST(ebgenv_api_ebg_env_close)
 
 	void *data = calloc(1, sizeof(BG_ENVDATA));
 	((BGENV *)e.bgenv)->data = data;
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
 	bgenv_write_fake.return_val = false;
 	ret = ebg_env_close(&e);
 
@@ -635,6 +722,7 @@ START_TEST(ebgenv_api_ebg_env_close)
 	e.bgenv = calloc(1, sizeof(BGENV));
 	ck_assert(e.bgenv != NULL);
 	((BGENV *)e.bgenv)->data = data;
+	((BGENV *)e.bgenv)->userdata_size = ENV_MEM_USERVARS;
 	bgenv_write_fake.return_val = true;
 	ret = ebg_env_close(&e);
 
@@ -710,6 +798,7 @@ Suite *ebg_test_suite(void)
 	tcase_add_test(tc_core, ebgenv_api_ebg_env_get);
 	tcase_add_test(tc_core, ebgenv_api_ebg_env_set);
 	tcase_add_test(tc_core, ebgenv_api_ebg_env_set_ex);
+	tcase_add_test(tc_core, ebgenv_api_ebg_env_set_many);
 	tcase_add_test(tc_core, ebgenv_api_ebg_env_get_ex);
 	tcase_add_test(tc_core, ebgenv_api_ebg_env_user_free);
 	tcase_add_test(tc_core, ebgenv_api_ebg_env_getglobalstate);
@@ -38,8 +38,27 @@ bool write_env_custom_fake(CONFIG_PART *part, BG_ENVDATA *env)
 
 FAKE_VALUE_FUNC(bool, write_env, CONFIG_PART *, BG_ENVDATA *);
 
-CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
-BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
+static CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
+static BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
+static BG_ENVDATA *envdata_ptrs[ENV_NUM_CONFIG_PARTS];
+
+/* This context substitutes the weakened default context of the ebgenv
+ * library so that all environment functions use the arrays above as data
+ * sources
+ */
+EBG_CONTEXT bgenv_default_ctx = {
+	.parts = config_parts,
+	.envdata = envdata_ptrs,
+	.num_parts = ENV_NUM_CONFIG_PARTS,
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+};
+
+static void setup_default_ctx(void)
+{
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		envdata_ptrs[i] = &envdata[i];
+	}
+}
 
 START_TEST(ebgenv_api_internal_strXtoY)
 {
@@ -203,6 +222,7 @@ START_TEST(ebgenv_api_internal_bgenv_write)
 	if (!dummy_env->data) {
 		goto finally;
 	}
+	dummy_env->userdata_size = ENV_MEM_USERVARS;
 
 	res = bgenv_write(dummy_env);
 	ck_assert(write_env_fake.call_count == 1);
@@ -445,6 +465,7 @@ Suite *ebg_test_suite(void)
 	s = suite_create("ebgenv_api");
 
 	tc_core = tcase_create("Core");
+	tcase_add_unchecked_fixture(tc_core, setup_default_ctx, NULL);
 
 	tcase_add_test(tc_core, ebgenv_api_internal_strXtoY);
 	tcase_add_test(tc_core, ebgenv_api_internal_bgenv_str2enum);
@@ -0,0 +1,270 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <check.h>
+#include <fff.h>
+
+#include <env_api.h>
+#include <env_api_crc32.h>
+#include <ebgpart.h>
+#include <fake_devices.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+#define BENCH_DISKS 8
+#define BENCH_NODES 4000
+
+#define GPT_ENTRIES 128
+#define GPT_FAT_LBA 64
+
+/* C12A7328-F81F-11D2-BA4B-00A0C93EC93B in on-disk byte order */
+static const uint8_t guid_esp[16] = {0x28, 0x73, 0x2a, 0xc1, 0x1f, 0xf8,
+				     0xd2, 0x11, 0xba, 0x4b, 0x00, 0xa0,
+				     0xc9, 0x3e, 0xc9, 0x3b};
+/* 0FC63DAF-8483-4772-8E79-3D69D8477DE4, Linux file system */
+static const uint8_t guid_linux[16] = {0xaf, 0x3d, 0xc6, 0x0f, 0x83, 0x84,
+				       0x72, 0x47, 0x8e, 0x79, 0x3d, 0x69,
+				       0xd8, 0x47, 0x7d, 0xe4};
+/* BIOS parameter block of a FAT16 file system created by mkfs.vfat */
+static const uint8_t fat16_bpb[] = {
+	0xeb, 0x3c, 0x90, 0x6d, 0x6b, 0x66, 0x73, 0x2e, 0x66, 0x61, 0x74,
+	0x00, 0x02, 0x04, 0x04, 0x00, 0x02, 0x00, 0x02, 0x00, 0x00, 0xf8,
+	0xc8, 0x00, 0x20, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x20, 0x03, 0x00, 0x80, 0x00, 0x29, 0xe8, 0x0b, 0x4a, 0x64,
+};
+
+#define GPT_ENTRY_SECTORS \
+	(GPT_ENTRIES * sizeof(struct EFIpartitionentry) / LB_SIZE)
+#define GPT_BACKUP_LBA (GPT_FAT_LBA + 1 + GPT_ENTRY_SECTORS)
+
+#define GPT_CORRUPT_PRIMARY_TABLE 1
+#define GPT_CORRUPT_PRIMARY_HEADER 2
+#define GPT_CORRUPT_BACKUP 4
+
+static void write_gpt_header(uint8_t *img, uint64_t lba, uint64_t backup_lba,
+			     uint64_t table_lba)
+{
+	struct EFIHeader *hdr = (struct EFIHeader *)(img + lba * LB_SIZE);
+	const uint8_t *table = img + table_lba * LB_SIZE;
+
+	memcpy(hdr->signature, "EFI PART", 8);
+	hdr->header_size = offsetof(struct EFIHeader, reserved2);
+	hdr->this_LBA = lba;
+	hdr->backup_LBA = backup_lba;
+	hdr->partitiontable_LBA = table_lba;
+	hdr->partitions = GPT_ENTRIES;
+	hdr->partitionentrysize = sizeof(struct EFIpartitionentry);
+	hdr->partitiontable_CRC32 =
+	    bgenv_crc32(0, table, GPT_ENTRY_SECTORS * LB_SIZE);
+	hdr->header_crc32 = bgenv_crc32(0, hdr, hdr->header_size);
+}
+
+/*
+ * Write a GPT disk image with an ESP holding a FAT16 file system and a
+ * Linux partition to the first fake disk. The backup GPT follows the file
+ * system at the end of the image. corrupt selects GPT_CORRUPT_* damage.
+ */
+static void create_fake_gpt_disk(const char *root, unsigned int corrupt)
+{
+	static uint8_t img[(GPT_BACKUP_LBA + 1) * LB_SIZE];
+	struct Masterbootrecord *mbr = (struct Masterbootrecord *)img;
+	struct EFIpartitionentry *e =
+	    (struct EFIpartitionentry *)(img + 2 * LB_SIZE);
+	const uint64_t backup_table_lba = GPT_FAT_LBA + 1;
+	char path[512];
+	FILE *f;
+
+	memset(img, 0, sizeof(img));
+	mbr->parttable[0].partition_type = MBR_TYPE_GPT;
+	mbr->parttable[0].start_LBA = 1;
+	mbr->mbrsignature = 0xaa55;
+
+	memcpy(e[0].type_GUID, guid_esp, 16);
+	e[0].start_LBA = GPT_FAT_LBA;
+	e[0].end_LBA = GPT_FAT_LBA;
+	memcpy(e[1].type_GUID, guid_linux, 16);
+	memcpy(img + backup_table_lba * LB_SIZE, e,
+	       GPT_ENTRY_SECTORS * LB_SIZE);
+
+	write_gpt_header(img, 1, GPT_BACKUP_LBA, 2);
+	write_gpt_header(img, GPT_BACKUP_LBA, 1, backup_table_lba);
+
+	if (corrupt & GPT_CORRUPT_PRIMARY_TABLE) {
+		e[1].partition_GUID[0] ^= 1;
+	}
+	if (corrupt & GPT_CORRUPT_PRIMARY_HEADER) {
+		img[LB_SIZE + offsetof(struct EFIHeader, GUID)] ^= 1;
+	}
+	if (corrupt & GPT_CORRUPT_BACKUP) {
+		img[backup_table_lba * LB_SIZE] ^= 1;
+	}
+
+	memcpy(img + GPT_FAT_LBA * LB_SIZE, fat16_bpb, sizeof(fat16_bpb));
+	img[GPT_FAT_LBA * LB_SIZE + 510] = 0x55;
+	img[GPT_FAT_LBA * LB_SIZE + 511] = 0xaa;
+
+	(void)snprintf(path, sizeof(path), "%s/dev/fakedisk0", root);
+	f = fopen(path, "w");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fwrite(img, sizeof(img), 1, f), 1);
+	fclose(f);
+}
+
+static void check_gpt_partitions(const PedDevice *dev)
+{
+	const PedPartition *part;
+
+	ck_assert_ptr_nonnull(dev);
+	part = dev->part_list;
+	ck_assert_ptr_nonnull(part);
+	ck_assert_int_eq(part->num, 1);
+	ck_assert_int_eq(part->fs_type, FS_TYPE_FAT16);
+	ck_assert_ptr_nonnull(part->path);
+	part = part->next;
+	ck_assert_ptr_nonnull(part);
+	ck_assert_int_eq(part->num, 2);
+	ck_assert_int_eq(part->fs_type, FS_TYPE_UNKNOWN);
+	ck_assert_ptr_null(part->next);
+	ck_assert_ptr_null(ped_device_get_next(dev));
+}
+
+static int count_devices(const char *root)
+{
+	const PedDevice *dev = NULL;
+	char expected[512];
+	int n = 0;
+
+	while ((dev = ped_device_get_next(dev))) {
+		(void)snprintf(expected, sizeof(expected), "%s/dev/fakedisk",
+			       root);
+		ck_assert(strncmp(dev->path, expected, strlen(expected)) == 0);
+		ck_assert_ptr_nonnull(dev->part_list);
+		ck_assert_int_eq(dev->part_list->num, 1);
+		ck_assert_int_eq(dev->part_list->fs_type, FS_TYPE_FAT16);
+		ck_assert_ptr_nonnull(dev->part_list->path);
+		(void)snprintf(expected, sizeof(expected), "%sp1", dev->path);
+		ck_assert_str_eq(dev->part_list->path, expected);
+		n++;
+	}
+	return n;
+}
+
+START_TEST(ebgpart_sysfs_devnames)
+{
+	char *root = create_fake_sysfs(3, 100, true);
+
+	ebgpart_set_sysroot(root);
+
+	ped_device_probe_all(NULL);
+	ck_assert_int_eq(count_devices(root), 3);
+
+	/* limiting probing to a single disk */
+	ped_device_probe_all("vd1");
+	ck_assert_int_eq(count_devices(root), 1);
+
+	ebgpart_set_sysroot(NULL);
+	remove_fake_sysfs(root);
+}
+END_TEST
+
+START_TEST(ebgpart_gpt_entries)
+{
+	char *root = create_fake_sysfs(1, 0, true);
+	const PedDevice *dev;
+
+	ebgpart_set_sysroot(root);
+
+	create_fake_gpt_disk(root, 0);
+	ped_device_probe_all(NULL);
+	check_gpt_partitions(ped_device_get_next(NULL));
+
+	/* a damaged primary GPT is replaced by the backup one */
+	create_fake_gpt_disk(root, GPT_CORRUPT_PRIMARY_TABLE);
+	ped_device_probe_all(NULL);
+	check_gpt_partitions(ped_device_get_next(NULL));
+
+	create_fake_gpt_disk(root, GPT_CORRUPT_PRIMARY_HEADER);
+	ped_device_probe_all(NULL);
+	check_gpt_partitions(ped_device_get_next(NULL));
+
+	/* the partitions are ignored if both are damaged */
+	create_fake_gpt_disk(root,
+			     GPT_CORRUPT_PRIMARY_TABLE | GPT_CORRUPT_BACKUP);
+	ped_device_probe_all(NULL);
+	dev = ped_device_get_next(NULL);
+	ck_assert_ptr_nonnull(dev);
+	ck_assert_ptr_null(dev->part_list);
+	ck_assert_ptr_null(ped_device_get_next(dev));
+
+	ebgpart_set_sysroot(NULL);
+	remove_fake_sysfs(root);
+}
+END_TEST
+
+static double time_probe_all(void)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ped_device_probe_all(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) * 1e3 +
+	       (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+START_TEST(ebgpart_sysfs_benchmark)
+{
+	char *root;
+	double ms;
+
+	/* without uevent files every disk falls back to scanning dev,
+	 * which cannot match the fake nodes: this measures the scan cost */
+	root = create_fake_sysfs(BENCH_DISKS, BENCH_NODES, false);
+	ebgpart_set_sysroot(root);
+	ms = time_probe_all();
+	ck_assert_int_eq(count_devices(root), 0);
+	printf("ebgpart dev scan : %8.2f ms (%d disks, %d nodes)\n", ms,
+	       BENCH_DISKS, BENCH_NODES);
+	remove_fake_sysfs(root);
+
+	root = create_fake_sysfs(BENCH_DISKS, BENCH_NODES, true);
+	ebgpart_set_sysroot(root);
+	ms = time_probe_all();
+	ck_assert_int_eq(count_devices(root), BENCH_DISKS);
+	printf("ebgpart sysfs    : %8.2f ms (%d disks, %d nodes)\n", ms,
+	       BENCH_DISKS, BENCH_NODES);
+	remove_fake_sysfs(root);
+
+	ebgpart_set_sysroot(NULL);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("ebgpart");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, ebgpart_sysfs_devnames);
+	tcase_add_test(tc_core, ebgpart_gpt_entries);
+	tcase_add_test(tc_core, ebgpart_sysfs_benchmark);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
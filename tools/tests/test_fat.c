@@ -11,7 +11,9 @@
  * SPDX-License-Identifier:	GPL-2.0-only
  */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <check.h>
 #include <fff.h>
 
@@ -383,6 +385,134 @@ START_TEST(test_determine_FAT_bits_squashfs)
 }
 END_TEST
 
+#define IMG_SECTOR_SIZE 512
+#define IMG_SECTORS 64
+#define IMG_DATA_START (4 * IMG_SECTOR_SIZE)
+#define IMG_FILE_SIZE 1300
+
+static void fat12_set_entry(u8 *fat, u32 cluster, u16 value)
+{
+	u8 *p = fat + cluster + cluster / 2;
+
+	if (cluster & 1) {
+		p[0] = (p[0] & 0x0f) | (value << 4);
+		p[1] = value >> 4;
+	} else {
+		p[0] = value;
+		p[1] = (p[1] & 0xf0) | ((value >> 8) & 0x0f);
+	}
+}
+
+static u8 img_pattern(size_t pos)
+{
+	return (pos * 7) & 0xff;
+}
+
+/*
+ * Creates a minimal FAT12 image with one file BGENV.DAT in the root
+ * directory, spread over the non-contiguous clusters 2, 3 and 5.
+ */
+static void create_fat12_image(char *path)
+{
+	static u8 img[IMG_SECTORS * IMG_SECTOR_SIZE];
+	struct fat_boot_sector *bs = (struct fat_boot_sector *)img;
+	struct msdos_dir_entry *root;
+	u8 *fat;
+	size_t n;
+	int fd;
+
+	memset(img, 0, sizeof(img));
+	u16_to_le(IMG_SECTOR_SIZE, bs->sector_size);
+	bs->sec_per_clus = 1;
+	bs->reserved = 1;
+	bs->fats = 2;
+	u16_to_le(IMG_SECTOR_SIZE / sizeof(struct msdos_dir_entry),
+		  bs->dir_entries);
+	u16_to_le(IMG_SECTORS, bs->sectors);
+	bs->media = 0xf8;
+	bs->fat_length = 1;
+	img[510] = 0x55;
+	img[511] = 0xaa;
+
+	for (n = 1; n <= 2; n++) {
+		fat = img + n * IMG_SECTOR_SIZE;
+		fat12_set_entry(fat, 0, 0xff8);
+		fat12_set_entry(fat, 1, 0xfff);
+		fat12_set_entry(fat, 2, 3);
+		fat12_set_entry(fat, 3, 5);
+		fat12_set_entry(fat, 5, 0xfff);
+	}
+
+	root = (struct msdos_dir_entry *)(img + 3 * IMG_SECTOR_SIZE);
+	memcpy(root[0].name, "EFILABEL   ", MSDOS_NAME);
+	root[0].attr = ATTR_VOLUME;
+	memcpy(root[1].name, "BGENV   DAT", MSDOS_NAME);
+	root[1].name[0] = DELETED_FLAG;
+	memcpy(root[2].name, "BGENV   DAT", MSDOS_NAME);
+	root[2].attr = ATTR_ARCH;
+	root[2].start = 2;
+	root[2].size = IMG_FILE_SIZE;
+
+	for (n = 0; n < IMG_FILE_SIZE; n++) {
+		u32 cluster = n / IMG_SECTOR_SIZE == 2 ? 5
+						       : 2 + n / IMG_SECTOR_SIZE;
+		img[IMG_DATA_START + (cluster - 2) * IMG_SECTOR_SIZE +
+		    n % IMG_SECTOR_SIZE] = img_pattern(n);
+	}
+
+	fd = mkstemp(path);
+	ck_assert_int_ge(fd, 0);
+	ck_assert_int_eq(write(fd, img, sizeof(img)), sizeof(img));
+	close(fd);
+}
+
+START_TEST(test_fat_file_rw)
+{
+	char path[] = "/tmp/ebg-fat-XXXXXX";
+	u8 buf[IMG_FILE_SIZE + 100];
+	struct fat_file file;
+	size_t n;
+	int ret;
+
+	create_fat12_image(path);
+
+	ret = fat_file_open(path, "missing.dat", false, &file, true);
+	ck_assert_int_eq(ret, -ENOENT);
+
+	ret = fat_file_open(path, "bgenv.dat", true, &file, true);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(file.vol.fat_bits, 12);
+	ck_assert_int_eq(file.size, IMG_FILE_SIZE);
+	ck_assert_int_eq(file.num_clusters, 3);
+
+	ck_assert_int_eq(fat_file_pread(&file, buf, sizeof(buf), 0),
+			 IMG_FILE_SIZE);
+	for (n = 0; n < IMG_FILE_SIZE; n++) {
+		ck_assert_int_eq(buf[n], img_pattern(n));
+	}
+
+	/* overwrite across the gap between cluster 3 and 5 */
+	memset(buf, 0xa5, 200);
+	ck_assert_int_eq(fat_file_pwrite(&file, buf, 200, 950), 200);
+	ck_assert_int_eq(fat_file_sync(&file), 0);
+	ck_assert_int_eq(fat_file_pwrite(&file, buf, 200, IMG_FILE_SIZE - 100),
+			 -1);
+	fat_file_close(&file);
+
+	ret = fat_file_open(path, "BGENV.DAT", false, &file, true);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(fat_file_pread(&file, buf, sizeof(buf), 0),
+			 IMG_FILE_SIZE);
+	for (n = 0; n < IMG_FILE_SIZE; n++) {
+		ck_assert_int_eq(buf[n], n >= 950 && n < 1150 ? 0xa5
+							      : img_pattern(n));
+	}
+	fat_file_close(&file);
+
+	unlink(path);
+}
+END_TEST
+
 Suite *ebg_test_suite(void)
 {
 	Suite *s;
@@ -400,6 +530,7 @@ Suite *ebg_test_suite(void)
 	tcase_add_test(tc_core, test_determine_FAT_bits_32);
 	tcase_add_test(tc_core, test_determine_FAT_bits_fat16_swupdate);
 	tcase_add_test(tc_core, test_determine_FAT_bits_squashfs);
+	tcase_add_test(tc_core, test_fat_file_rw);
 
 	suite_add_tcase(s, tc_core);
 
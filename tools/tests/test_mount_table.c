@@ -0,0 +1,84 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <mntent.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <fff.h>
+
+#include <env_api.h>
+#include <env_disk_utils.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+static bool mounted_at(const char *fsname, const char *dir)
+{
+	const struct mntent *part;
+	bool found = false;
+	FILE *mtab;
+
+	mtab = setmntent("/proc/mounts", "r");
+	ck_assert_ptr_nonnull(mtab);
+	while (!found && (part = getmntent(mtab)) != NULL) {
+		found = strcmp(part->mnt_fsname, fsname) == 0 &&
+			strcmp(part->mnt_dir, dir) == 0;
+	}
+	endmntent(mtab);
+	return found;
+}
+
+START_TEST(mount_table_lookup_matches_mtab)
+{
+	const struct mntent *part;
+	char *mntpoint;
+	FILE *mtab;
+
+	ck_assert(mount_table_load());
+
+	/* every mounted device must be found in the snapshot */
+	mtab = setmntent("/proc/mounts", "r");
+	ck_assert_ptr_nonnull(mtab);
+	while ((part = getmntent(mtab)) != NULL) {
+		if (part->mnt_fsname[0] != '/') {
+			continue;
+		}
+		mntpoint = get_mountpoint(part->mnt_fsname);
+		ck_assert_ptr_nonnull(mntpoint);
+		ck_assert(mounted_at(part->mnt_fsname, mntpoint));
+		free(mntpoint);
+	}
+	endmntent(mtab);
+
+	ck_assert_ptr_null(get_mountpoint("/dev/does-not-exist"));
+
+	mount_table_free();
+
+	/* without snapshot, the table is scanned directly */
+	ck_assert_ptr_null(get_mountpoint("/dev/does-not-exist"));
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("mount_table");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, mount_table_lookup_matches_mtab);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
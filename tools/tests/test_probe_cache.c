@@ -0,0 +1,175 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_config_file.h>
+#include <env_config_partitions.h>
+#include <env_probe_cache.h>
+#include <ebgpart.h>
+#include <fake_devices.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+bool __wrap_probe_config_file(CONFIG_PART *);
+int probe_config_file_call_count;
+
+bool __wrap_probe_config_file(CONFIG_PART *cp)
+{
+	probe_config_file_call_count++;
+	cp->not_mounted = true;
+	return true;
+}
+
+FAKE_VOID_FUNC(ped_device_probe_all, const char *);
+FAKE_VALUE_FUNC(PedDevice *, ped_device_get_next, const PedDevice *);
+
+static char tmpdir[] = "/tmp/probe_cache.XXXXXX";
+
+static void write_disk(const char *path, uint8_t type)
+{
+	struct Masterbootrecord mbr;
+	FILE *f;
+
+	memset(&mbr, 0, sizeof(mbr));
+	memcpy(mbr.devsignature, "\x78\x56\x34\x12", 4);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		mbr.parttable[i].partition_type = type;
+		mbr.parttable[i].start_LBA = 2048 * (i + 1);
+	}
+	mbr.mbrsignature = 0xaa55;
+
+	f = fopen(path, "w");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fwrite(&mbr, sizeof(mbr), 1, f), 1);
+	/* the GPT header sector */
+	ck_assert_int_eq(fwrite(&mbr, sizeof(mbr), 1, f), 1);
+	fclose(f);
+}
+
+static void free_parts(CONFIG_PART *parts, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		free(parts[i].devpath);
+		free(parts[i].mountpoint);
+	}
+	memset(parts, 0, sizeof(CONFIG_PART) * count);
+}
+
+START_TEST(probe_cache_reuse_and_revalidate)
+{
+	CONFIG_PART parts[ENV_V2_MAX_CONFIG_PARTS];
+	char cachefile[64], diskpath[64], partpath[64];
+	PedPartition *part;
+	uint32_t count;
+	int i = 0;
+
+	ck_assert_ptr_nonnull(mkdtemp(tmpdir));
+	(void)snprintf(cachefile, sizeof(cachefile), "%s/cache", tmpdir);
+	(void)snprintf(diskpath, sizeof(diskpath), "%s/disk", tmpdir);
+	write_disk(diskpath, MBR_TYPE_FAT16);
+
+	RESET_FAKE(ped_device_probe_all);
+	RESET_FAKE(ped_device_get_next);
+	ped_device_get_next_fake.custom_fake = ped_device_get_next_custom_fake;
+
+	allocate_fake_devices(1);
+	free(fake_devices[0].path);
+	fake_devices[0].path = strdup(diskpath);
+	for (i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		add_fake_partition(0);
+	}
+	for (part = fake_devices[0].part_list, i = 1; part;
+	     part = part->next, i++) {
+		(void)snprintf(partpath, sizeof(partpath), "%s/disk%d", tmpdir,
+			       i);
+		fclose(fopen(partpath, "w"));
+		part->path = strdup(partpath);
+		(void)snprintf(part->uuid, sizeof(part->uuid), "12345678-%02X",
+			       i);
+	}
+
+	ebgenv_opts.probe_cache = true;
+	probe_cache_file = cachefile;
+	memset(parts, 0, sizeof(parts));
+	probe_config_file_call_count = 0;
+
+	/* the first probe populates the cache */
+	ck_assert(probe_config_partitions(parts, &count, true));
+	ck_assert_uint_eq(count, ENV_NUM_CONFIG_PARTS);
+	ck_assert_int_eq(probe_config_file_call_count, ENV_NUM_CONFIG_PARTS);
+	ck_assert_int_eq(access(cachefile, R_OK), 0);
+	free_parts(parts, count);
+
+	/* the second one is served from it */
+	ck_assert(probe_config_partitions(parts, &count, true));
+	ck_assert_uint_eq(count, ENV_NUM_CONFIG_PARTS);
+	ck_assert_int_eq(probe_config_file_call_count, ENV_NUM_CONFIG_PARTS);
+	ck_assert_int_eq(ped_device_probe_all_fake.call_count, 1);
+	for (part = fake_devices[0].part_list, i = 0; part;
+	     part = part->next, i++) {
+		ck_assert_str_eq(parts[i].devpath, part->path);
+		ck_assert(parts[i].not_mounted);
+	}
+	free_parts(parts, count);
+
+	/* a different search scope is not served from the cache */
+	ck_assert(probe_config_partitions(parts, &count, false));
+	ck_assert_int_eq(ped_device_probe_all_fake.call_count, 2);
+	free_parts(parts, count);
+
+	/* neither is a changed partition table */
+	ck_assert(probe_config_partitions(parts, &count, true));
+	free_parts(parts, count);
+	write_disk(diskpath, MBR_TYPE_FAT32);
+	ck_assert(probe_config_partitions(parts, &count, true));
+	ck_assert_int_eq(ped_device_probe_all_fake.call_count, 4);
+	free_parts(parts, count);
+
+	/* dropping a used cache forces a full probe */
+	ck_assert(probe_config_partitions(parts, &count, true));
+	ck_assert_int_eq(ped_device_probe_all_fake.call_count, 4);
+	ck_assert(probe_cache_invalidate());
+	ck_assert_int_ne(access(cachefile, F_OK), 0);
+	ck_assert(!probe_cache_invalidate());
+	free_parts(parts, count);
+
+	ebgenv_opts.probe_cache = false;
+	free_fake_devices();
+	for (i = 1; i <= ENV_NUM_CONFIG_PARTS; i++) {
+		(void)snprintf(partpath, sizeof(partpath), "%s/disk%d", tmpdir,
+			       i);
+		unlink(partpath);
+	}
+	unlink(diskpath);
+	rmdir(tmpdir);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("probe_cache");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, probe_cache_reuse_and_revalidate);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -24,6 +24,9 @@
 #include <stdio.h>
 #include <env_disk_utils.h>
 #include <fake_devices.h>
+#include <fat.h>
+#include <linux_util.h>
+#include <unistd.h>
 
 DEFINE_FFF_GLOBALS;
 
@@ -135,6 +138,7 @@ void delete_temp_files(void)
 FAKE_VOID_FUNC(ped_device_probe_all, const char *);
 FAKE_VALUE_FUNC(PedDevice *, ped_device_get_next, const PedDevice *);
 FAKE_VALUE_FUNC(char *, get_mountpoint, const char *);
+FAKE_VALUE_FUNC(bool, mount_partition, CONFIG_PART *);
 
 START_TEST(env_api_fat_test_probe_config_file)
 {
@@ -172,6 +176,86 @@ START_TEST(env_api_fat_test_probe_config_file)
 }
 END_TEST
 
+#define IMG_SECTOR_SIZE 512
+#define IMG_SECTORS 64
+
+static inline void u16_to_le(u16 value, __u8 out[2])
+{
+	out[0] = value & 0xff;
+	out[1] = value >> 8;
+}
+
+/*
+ * Creates a minimal FAT12 image, optionally with an empty BGENV.DAT in the
+ * root directory, or an image without any filesystem.
+ */
+static void create_image(char *path, bool formatted, bool with_env)
+{
+	static u8 img[IMG_SECTORS * IMG_SECTOR_SIZE];
+	struct fat_boot_sector *bs = (struct fat_boot_sector *)img;
+	struct msdos_dir_entry *root;
+	int fd;
+
+	memset(img, 0, sizeof(img));
+	if (formatted) {
+		u16_to_le(IMG_SECTOR_SIZE, bs->sector_size);
+		bs->sec_per_clus = 1;
+		bs->reserved = 1;
+		bs->fats = 2;
+		u16_to_le(IMG_SECTOR_SIZE / sizeof(struct msdos_dir_entry),
+			  bs->dir_entries);
+		u16_to_le(IMG_SECTORS, bs->sectors);
+		bs->media = 0xf8;
+		bs->fat_length = 1;
+		img[510] = 0x55;
+		img[511] = 0xaa;
+	}
+	if (with_env) {
+		root = (struct msdos_dir_entry *)(img + 3 * IMG_SECTOR_SIZE);
+		memcpy(root[0].name, "BGENV   DAT", MSDOS_NAME);
+		root[0].attr = ATTR_ARCH;
+	}
+
+	fd = mkstemp(path);
+	ck_assert_int_ge(fd, 0);
+	ck_assert_int_eq(write(fd, img, sizeof(img)), sizeof(img));
+	close(fd);
+}
+
+START_TEST(env_api_fat_test_probe_unmounted)
+{
+	char path[] = "/tmp/ebg-probe-XXXXXX";
+	CONFIG_PART part;
+
+	RESET_FAKE(get_mountpoint);
+	RESET_FAKE(mount_partition);
+
+	/* found directly on the device, no mounting */
+	create_image(path, true, true);
+	memset(&part, 0, sizeof(part));
+	part.devpath = path;
+	ck_assert(probe_config_file(&part) == true);
+	ck_assert(part.not_mounted == true);
+	ck_assert_ptr_null(part.mountpoint);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	unlink(path);
+
+	/* a FAT volume without environment is not mounted either */
+	strcpy(path, "/tmp/ebg-probe-XXXXXX");
+	create_image(path, true, false);
+	ck_assert(probe_config_file(&part) == false);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	unlink(path);
+
+	/* mounting remains the fallback for anything else */
+	strcpy(path, "/tmp/ebg-probe-XXXXXX");
+	create_image(path, false, false);
+	ck_assert(probe_config_file(&part) == false);
+	ck_assert_int_eq(mount_partition_fake.call_count, 1);
+	unlink(path);
+}
+END_TEST
+
 Suite *ebg_test_suite(void)
 {
 	Suite *s;
@@ -181,6 +265,7 @@ Suite *ebg_test_suite(void)
 
 	tc_core = tcase_create("Core");
 	tcase_add_test(tc_core, env_api_fat_test_probe_config_file);
+	tcase_add_test(tc_core, env_api_fat_test_probe_unmounted);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -24,19 +24,19 @@ DEFINE_FFF_GLOBALS;
 
 Suite *ebg_test_suite(void);
 
-bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env);
-bool read_env(CONFIG_PART *part, BG_ENVDATA *env);
+bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA **env);
+bool read_env(CONFIG_PART *part, BG_ENVDATA **env);
 
-bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env)
+bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA **env)
 {
 	if (!env) {
 		return false;
 	}
-	memset(env, 0, sizeof(BG_ENVDATA));
-	return true;
+	*env = calloc(1, sizeof(BG_ENVDATA));
+	return *env != NULL;
 }
 
-FAKE_VALUE_FUNC(bool, read_env, CONFIG_PART *, BG_ENVDATA *);
+FAKE_VALUE_FUNC(bool, read_env, CONFIG_PART *, BG_ENVDATA **);
 FAKE_VOID_FUNC(ped_device_probe_all, const char *);
 FAKE_VALUE_FUNC(PedDevice *, ped_device_get_next, const PedDevice *);
 
@@ -23,12 +23,6 @@ DEFINE_FFF_GLOBALS;
 
 Suite *ebg_test_suite(void);
 
-/* These variables substitute weakened symbols in the ebgenv library code
- * so that all environment functions use these as data sources
- */
-CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
-BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
-
 START_TEST(bgenv_get_from_manipulated)
 {
 	const char *key = "mykey";
@@ -39,8 +33,8 @@ START_TEST(bgenv_get_from_manipulated)
 	{
 		const char *value = "dummy";
 		size_t value_len = strlen(value);
-		bgenv_set_uservar(data.userdata, key, usertype, value,
-				  value_len);
+		bgenv_set_uservar(data.userdata, ENV_MEM_USERVARS, key,
+				  usertype, value, value_len);
 		/* get position of payload size */
 		char *var_key = (char *)bgenv_find_uservar(data.userdata, key);
 		uint32_t *payload_size =
@@ -74,11 +68,14 @@ START_TEST(bgenv_get_from_manipulated)
 	}
 
 	/* load our manipulated BGENV */
-	memset(&data, 0, sizeof(data));
-	bool result = get_env(configfilepath, &data);
+	ENV_LAYOUT layout;
+	BG_ENVDATA *loaded = get_env(configfilepath, &layout);
 
 	/* ensure that we did not write invalid data */
-	BGENV bgenv = {.desc = configfilepath, .data = &data};
+	memset(&data, 0, sizeof(data));
+	BGENV bgenv = {.desc = configfilepath,
+		       .data = loaded ? loaded : &data,
+		       .userdata_size = ENV_MEM_USERVARS};
 	ebgenv_t e = {.bgenv = &bgenv};
 	char out[16];
 	memset(out, 0, sizeof(out));
@@ -90,13 +87,209 @@ START_TEST(bgenv_get_from_manipulated)
 	ck_assert_str_eq(out, empty_str);
 
 	/* assert that get_env reports an error */
-	ck_assert_int_eq(result, false);
+	ck_assert_ptr_null(loaded);
 
 	/* clean up */
 	unlink(configfilepath);
 }
 END_TEST
 
+START_TEST(bgenv_uservar_index_consistent)
+{
+	static BG_ENVDATA plain, indexed;
+	USERVAR_INDEX index = {0};
+	char key[32], value[64];
+
+	memset(&plain, 0, sizeof(plain));
+	memset(&indexed, 0, sizeof(indexed));
+	srand(1);
+
+	/* mix inserts, resizing updates and deletes on both copies */
+	for (int n = 0; n < 2000; n++) {
+		int op = rand() % 4;
+		uint32_t len = 1 + rand() % sizeof(value);
+		uint64_t type = op == 3 ? USERVAR_TYPE_DELETED
+					: USERVAR_TYPE_STRING_ASCII;
+		int ret_plain, ret_indexed;
+
+		snprintf(key, sizeof(key), "key%d", rand() % 200);
+		memset(value, 'a' + n % 26, len);
+
+		ret_plain = bgenv_set_uservar(plain.userdata, ENV_MEM_USERVARS,
+					      key, type, value, len);
+		ret_indexed = bgenv_set_uservar_indexed(
+			&index, indexed.userdata, ENV_MEM_USERVARS, key, type,
+			value, len);
+		ck_assert_int_eq(ret_plain, ret_indexed);
+		ck_assert(memcmp(plain.userdata, indexed.userdata,
+				 ENV_MEM_USERVARS) == 0);
+		ck_assert_int_eq(bgenv_user_free(plain.userdata,
+						 ENV_MEM_USERVARS),
+				 bgenv_user_free_indexed(&index,
+							 indexed.userdata,
+							 ENV_MEM_USERVARS));
+	}
+	ck_assert_ptr_nonnull(index.slots);
+
+	for (int k = 0; k < 200; k++) {
+		uint8_t *var_plain, *var_indexed;
+
+		snprintf(key, sizeof(key), "key%d", k);
+		var_plain = bgenv_find_uservar(plain.userdata, key);
+		var_indexed = bgenv_find_uservar_indexed(
+			&index, indexed.userdata, ENV_MEM_USERVARS, key);
+		if (var_plain) {
+			ck_assert_ptr_eq(var_indexed, indexed.userdata +
+				(var_plain - plain.userdata));
+		} else {
+			ck_assert_ptr_null(var_indexed);
+		}
+	}
+
+	bgenv_uservar_index_invalidate(&index);
+}
+END_TEST
+
+START_TEST(bgenv_uservar_deferred_compaction)
+{
+	static BG_ENVDATA eager, deferred;
+	USERVAR_INDEX index = {0};
+	char key[32], value[1024];
+
+	memset(&eager, 0, sizeof(eager));
+	memset(&deferred, 0, sizeof(deferred));
+	srand(2);
+
+	/* large values make the deferred copy run out of space */
+	for (int n = 0; n < 2000; n++) {
+		int op = rand() % 4;
+		uint32_t len = 1 + rand() % sizeof(value);
+		uint64_t type = op == 3 ? USERVAR_TYPE_DELETED
+					: USERVAR_TYPE_STRING_ASCII;
+		uint8_t *var_eager, *var_deferred;
+		int ret_eager, ret_deferred;
+
+		snprintf(key, sizeof(key), "key%d", rand() % 100);
+		memset(value, 'a' + n % 26, len);
+
+		ebg_set_opt_bool(EBG_OPT_DEFERRED_COMPACTION, false);
+		ret_eager = bgenv_set_uservar(eager.userdata, ENV_MEM_USERVARS,
+					      key, type, value, len);
+		ebg_set_opt_bool(EBG_OPT_DEFERRED_COMPACTION, true);
+		ret_deferred = bgenv_set_uservar_indexed(
+			&index, deferred.userdata, ENV_MEM_USERVARS, key, type,
+			value, len);
+		ck_assert_int_eq(ret_eager, ret_deferred);
+
+		var_eager = bgenv_find_uservar(eager.userdata, key);
+		var_deferred = bgenv_find_uservar_indexed(
+			&index, deferred.userdata, ENV_MEM_USERVARS, key);
+		if (var_eager) {
+			uint32_t size_eager, size_deferred;
+
+			ck_assert_ptr_nonnull(var_deferred);
+			bgenv_map_uservar(var_eager, NULL, NULL, NULL,
+					  &size_eager, NULL);
+			bgenv_map_uservar(var_deferred, NULL, NULL, NULL,
+					  &size_deferred, NULL);
+			ck_assert_int_eq(size_eager, size_deferred);
+			ck_assert(memcmp(var_eager, var_deferred,
+					 size_eager) == 0);
+		} else {
+			ck_assert_ptr_null(var_deferred);
+		}
+		ck_assert_int_le(bgenv_user_free_indexed(&index,
+							 deferred.userdata,
+							 ENV_MEM_USERVARS),
+				 bgenv_user_free(eager.userdata,
+						 ENV_MEM_USERVARS));
+		/* deleted records count as free */
+		ck_assert_int_eq(bgenv_user_free_indexed(&index,
+							 deferred.userdata,
+							 ENV_MEM_USERVARS) +
+					 bgenv_user_deleted(deferred.userdata,
+							    ENV_MEM_USERVARS),
+				 bgenv_user_free(eager.userdata,
+						 ENV_MEM_USERVARS));
+	}
+
+	/* compaction keeps the order of the remaining variables */
+	ck_assert_ptr_nonnull(bgenv_find_deleted_uservar(deferred.userdata));
+	bgenv_compact_uservars(&index, deferred.userdata);
+	ck_assert_ptr_null(bgenv_find_deleted_uservar(deferred.userdata));
+	ck_assert(memcmp(eager.userdata, deferred.userdata,
+			 ENV_MEM_USERVARS) == 0);
+
+	ebg_set_opt_bool(EBG_OPT_DEFERRED_COMPACTION, false);
+	bgenv_uservar_index_invalidate(&index);
+}
+END_TEST
+
+START_TEST(bgenv_uservar_iterate)
+{
+	static BG_ENVDATA data;
+	BGENV bgenv = {.data = &data, .userdata_size = ENV_MEM_USERVARS};
+	ebgenv_t e = {.bgenv = &bgenv};
+	ebg_env_iter_t it;
+	ebg_kv_t kv;
+	char key[32];
+	int count;
+
+	memset(&data, 0, sizeof(data));
+	for (int n = 0; n < 100; n++) {
+		snprintf(key, sizeof(key), "%s.%d", n % 2 ? "update" : "other",
+			 n);
+		ck_assert_int_eq(bgenv_set_uservar(data.userdata,
+						   ENV_MEM_USERVARS, key,
+						   USERVAR_TYPE_UINT32, &n,
+						   sizeof(n)), 0);
+	}
+	bgenv_set_uservar(data.userdata, ENV_MEM_USERVARS, "update.1",
+			  USERVAR_TYPE_DELETED, "", 1);
+
+	ck_assert_int_eq(ebg_env_iter_begin(&e, &it), 0);
+	for (count = 0; ebg_env_iter_next(&it, &kv); count++) {
+		ck_assert_int_eq(kv.datalen, sizeof(int));
+		ck_assert_int_eq(kv.type, USERVAR_TYPE_UINT32);
+		/* values are not copied */
+		ck_assert(kv.value > data.userdata &&
+			  kv.value < data.userdata + ENV_MEM_USERVARS);
+	}
+	ck_assert_int_eq(count, 99);
+
+	ck_assert_int_eq(ebg_env_iter_begin_prefix(&e, &it, "update."), 0);
+	for (count = 0; ebg_env_iter_next(&it, &kv); count++) {
+		int n;
+
+		memcpy(&n, kv.value, sizeof(n));
+		ck_assert_int_eq(n % 2, 1);
+		ck_assert_int_ne(n, 1);
+		ck_assert(strncmp(kv.key, "update.", 7) == 0);
+	}
+	ck_assert_int_eq(count, 49);
+
+	ck_assert_int_eq(ebg_env_iter_begin_prefix(&e, &it, "none"), 0);
+	ck_assert(!ebg_env_iter_next(&it, &kv));
+
+	/* corrupt record sizes end the iteration */
+	uint8_t *len = data.userdata + strlen("other.0") + 1;
+	const uint32_t corrupt[] = {UINT32_MAX - strlen("other.0"),
+				    ENV_MEM_USERVARS};
+	for (size_t i = 0; i < sizeof(corrupt) / sizeof(corrupt[0]); i++) {
+		memcpy(len, &corrupt[i], sizeof(corrupt[i]));
+		ck_assert_int_eq(ebg_env_iter_begin(&e, &it), 0);
+		ck_assert(!ebg_env_iter_next(&it, &kv));
+		ck_assert(!ebg_env_iter_next(&it, &kv));
+	}
+
+	e.bgenv = NULL;
+	ck_assert_int_eq(ebg_env_iter_begin(&e, &it), EIO);
+	ck_assert(!ebg_env_iter_next(&it, &kv));
+	ck_assert_int_eq(ebg_env_iter_begin(NULL, &it), EINVAL);
+	ck_assert(!ebg_env_iter_next(&it, &kv));
+}
+END_TEST
+
 Suite *ebg_test_suite(void)
 {
 	Suite *s;
@@ -107,6 +300,9 @@ Suite *ebg_test_suite(void)
 	tc_core = tcase_create("Core");
 
 	tcase_add_test(tc_core, bgenv_get_from_manipulated);
+	tcase_add_test(tc_core, bgenv_uservar_index_consistent);
+	tcase_add_test(tc_core, bgenv_uservar_deferred_compaction);
+	tcase_add_test(tc_core, bgenv_uservar_iterate);
 
 	suite_add_tcase(s, tc_core);
 
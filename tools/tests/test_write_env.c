@@ -0,0 +1,267 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) Siemens AG, 2026
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <check.h>
+#include <fff.h>
+
+#include <env_api.h>
+#include <env_layout.h>
+#include <test-interface.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+ssize_t __wrap_pwrite64(int fd, const void *buf, size_t count, off64_t offset);
+ssize_t __real_pwrite64(int fd, const void *buf, size_t count, off64_t offset);
+
+static size_t bytes_written;
+static int pwrite_calls;
+
+ssize_t __wrap_pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+	bytes_written += count;
+	pwrite_calls++;
+	return __real_pwrite64(fd, buf, count, offset);
+}
+
+static void read_envfile(const char *path, BG_ENVDATA *env)
+{
+	FILE *f = fopen(path, "rb");
+
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fread(env, sizeof(*env), 1, f), 1);
+	fclose(f);
+}
+
+START_TEST(write_env_in_place)
+{
+	char dir[] = "/tmp/write_env.XXXXXX";
+	CONFIG_PART part = {0};
+	static BG_ENVDATA env, stored;
+	struct stat before, after;
+	char path[64];
+	FILE *f;
+
+	ck_assert_ptr_nonnull(mkdtemp(dir));
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, FAT_ENV_FILENAME);
+	part.devpath = "/dev/fake";
+	part.mountpoint = dir;
+
+	memset(&env, 0, sizeof(env));
+	env.revision = 1;
+	env.crc32 = bgenv_crc32(0, &env, sizeof(env) - sizeof(env.crc32));
+	f = fopen(path, "wb");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fwrite(&env, sizeof(env), 1, f), 1);
+	fclose(f);
+	ck_assert_int_eq(stat(path, &before), 0);
+
+	ebgenv_opts.inplace_write = true;
+
+	/* a single changed member results in one small write */
+	env.revision = 2;
+	env.userdata[60000] = 0x42;
+	env.crc32 = bgenv_crc32(0, &env, sizeof(env) - sizeof(env.crc32));
+	bytes_written = 0;
+	pwrite_calls = 0;
+	ck_assert(write_env(&part, &env));
+	read_envfile(path, &stored);
+	ck_assert(memcmp(&env, &stored, sizeof(env)) == 0);
+	ck_assert_int_eq(pwrite_calls, 3);
+	ck_assert_uint_lt(bytes_written, 16);
+
+	/* the file was neither replaced nor truncated */
+	ck_assert_int_eq(stat(path, &after), 0);
+	ck_assert_uint_eq(before.st_ino, after.st_ino);
+	ck_assert_int_eq(after.st_size, sizeof(BG_ENVDATA));
+
+	/* unchanged contents are not written at all */
+	bytes_written = 0;
+	ck_assert(write_env(&part, &env));
+	ck_assert_uint_eq(bytes_written, 0);
+
+	/* a file of unexpected size is rewritten completely */
+	ck_assert_int_eq(truncate(path, 16), 0);
+	ck_assert(write_env(&part, &env));
+	read_envfile(path, &stored);
+	ck_assert(memcmp(&env, &stored, sizeof(env)) == 0);
+
+	ebgenv_opts.inplace_write = false;
+	unlink(path);
+	rmdir(dir);
+}
+END_TEST
+
+START_TEST(write_env_layout_v2)
+{
+	char dir[] = "/tmp/write_env.XXXXXX";
+	ENV_LAYOUT layout = {
+		.version = ENV_LAYOUT_V2,
+		.num_config_parts = ENV_NUM_CONFIG_PARTS,
+		.userdata_size = 4096,
+	};
+	const size_t file_size = ENV_V2_FILE_SIZE(sizeof(BG_ENVHDR), 4096);
+	CONFIG_PART part = {0};
+	static BG_ENVDATA env;
+	BG_ENVDATA *stored, *reread;
+	struct stat st;
+	char path[64];
+	uint32_t crc32;
+	uint8_t *buf;
+	size_t size;
+	FILE *f;
+
+	ck_assert_ptr_nonnull(mkdtemp(dir));
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, FAT_ENV_FILENAME);
+	part.devpath = "/dev/fake";
+	part.mountpoint = dir;
+
+	memset(&env, 0, sizeof(env));
+	env.revision = 7;
+	buf = env_layout_encode(&env, ENV_MEM_USERVARS, &layout, &size);
+	ck_assert_ptr_nonnull(buf);
+	ck_assert_uint_eq(size, file_size);
+	f = fopen(path, "wb");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fwrite(buf, size, 1, f), 1);
+	fclose(f);
+	free(buf);
+
+	/* the layout is taken from the file */
+	ck_assert(read_env(&part, &stored));
+	ck_assert_int_eq(part.layout.version, ENV_LAYOUT_V2);
+	ck_assert_int_eq(part.layout.num_config_parts, ENV_NUM_CONFIG_PARTS);
+	ck_assert_int_eq(part.layout.userdata_size, 4096);
+	ck_assert_int_eq(stored->revision, 7);
+
+	/* and kept when writing back */
+	stored->revision = 8;
+	env_data_set_crc32(stored, 4096,
+			   bgenv_crc32(0, stored, ENV_FIXED_SIZE + 4096));
+	ck_assert(write_env(&part, stored));
+	ck_assert_int_eq(stat(path, &st), 0);
+	ck_assert_int_eq(st.st_size, file_size);
+	ck_assert(read_env(&part, &reread));
+	ck_assert(memcmp(reread, stored, ENV_DATA_SIZE(4096)) == 0);
+	free(reread);
+	free(stored);
+
+	/* user variables must fit into the file */
+	env.userdata[4096] = 1;
+	ck_assert_ptr_null(
+		env_layout_encode(&env, ENV_MEM_USERVARS, &layout, &size));
+
+	/* the fixed header is checked on its own */
+	buf = malloc(file_size);
+	ck_assert_ptr_nonnull(buf);
+	f = fopen(path, "r+b");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fread(buf, file_size, 1, f), 1);
+	((BG_ENVHDR *)buf)->fixed_crc32 ^= 1;
+	crc32 = bgenv_crc32(0, buf, file_size - sizeof(crc32));
+	memcpy(buf + file_size - sizeof(crc32), &crc32, sizeof(crc32));
+	rewind(f);
+	ck_assert_int_eq(fwrite(buf, file_size, 1, f), 1);
+	fclose(f);
+	free(buf);
+	ck_assert(!read_env(&part, &stored));
+	ck_assert_ptr_null(stored);
+
+	/* a damaged file is rejected */
+	f = fopen(path, "r+b");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fseek(f, sizeof(BG_ENVHDR), SEEK_SET), 0);
+	ck_assert_int_eq(fputc('x', f), 'x');
+	fclose(f);
+	ck_assert(!read_env(&part, &stored));
+
+	unlink(path);
+	rmdir(dir);
+}
+END_TEST
+
+START_TEST(write_env_layout_large)
+{
+	char dir[] = "/tmp/write_env.XXXXXX";
+	const uint32_t userdata_size = 4 * ENV_MEM_USERVARS;
+	ENV_LAYOUT layout = {
+		.version = ENV_LAYOUT_V2,
+		.num_config_parts = ENV_NUM_CONFIG_PARTS + 1,
+		.userdata_size = userdata_size,
+	};
+	CONFIG_PART part = {0};
+	BG_ENVDATA *env, *stored;
+	char path[64];
+	uint8_t *udata;
+	uint8_t *buf;
+	size_t size;
+	FILE *f;
+
+	ck_assert_ptr_nonnull(mkdtemp(dir));
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, FAT_ENV_FILENAME);
+	part.devpath = "/dev/fake";
+	part.mountpoint = dir;
+
+	/* user variables beyond the compiled-in default size */
+	env = env_data_alloc(userdata_size);
+	ck_assert_ptr_nonnull(env);
+	env->revision = 3;
+	udata = env->userdata;
+	udata[userdata_size - 1] = 0x42;
+	buf = env_layout_encode(env, userdata_size, &layout, &size);
+	ck_assert_ptr_nonnull(buf);
+	ck_assert_uint_eq(size, ENV_V2_FILE_SIZE(sizeof(BG_ENVHDR),
+						 userdata_size));
+	f = fopen(path, "wb");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_int_eq(fwrite(buf, size, 1, f), 1);
+	fclose(f);
+	free(buf);
+
+	/* are read completely, whatever the number of config partitions */
+	ck_assert(read_env(&part, &stored));
+	ck_assert_int_eq(part.layout.num_config_parts,
+			 ENV_NUM_CONFIG_PARTS + 1);
+	ck_assert_int_eq(part.layout.userdata_size, userdata_size);
+	ck_assert_int_eq(stored->revision, 3);
+	udata = stored->userdata;
+	ck_assert_int_eq(udata[userdata_size - 1], 0x42);
+	ck_assert_uint_eq(env_data_crc32(stored, userdata_size),
+			  bgenv_crc32(0, stored,
+				      ENV_FIXED_SIZE + userdata_size));
+
+	free(stored);
+	free(env);
+	unlink(path);
+	rmdir(dir);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("write_env");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, write_env_in_place);
+	tcase_add_test(tc_core, write_env_layout_v2);
+	tcase_add_test(tc_core, write_env_layout_large);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
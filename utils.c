@@ -93,8 +93,6 @@ EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count)
 	UINTN handleCount = 0;
 	UINTN index, rootCount = 0, bootCount = 0;
 
-	EFI_FILE_HANDLE tmp;
-
 	if (!volumes || !count) {
 		ERROR(L"Invalid volume enumeration.\n");
 		return EFI_INVALID_PARAMETER;
@@ -108,30 +106,19 @@ EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count)
 	}
 	INFO(L"Found %d handles for file IO\n\n", handleCount);
 
-	*volumes = (VOLUME_DESC *)AllocatePool(sizeof(VOLUME_DESC) * handleCount);
+	*volumes = (VOLUME_DESC *)AllocateZeroPool(sizeof(VOLUME_DESC) *
+						   handleCount);
 	if (!*volumes) {
 		ERROR(L"Could not allocate memory for volume descriptors.\n");
+		FreePool(handles);
 		return EFI_OUT_OF_RESOURCES;
 	}
 
+	/*
+	 * Only sort the volumes here, boot medium first. Opening them and
+	 * reading their labels is deferred until they are actually needed.
+	 */
 	for (index = 0; index < handleCount; index++) {
-		EFI_FILE_IO_INTERFACE *fs = NULL;
-
-		status = BS->HandleProtocol(
-		    handles[index], &sfspGuid, (VOID **)&fs);
-		if (EFI_ERROR(status)) {
-			/* skip failed handle and continue enumerating */
-			ERROR(L"File IO handle %d does not support SIMPLE_FILE_SYSTEM_PROTOCOL, skipping.\n",
-			      index);
-			continue;
-		}
-		status = fs->OpenVolume(fs, &tmp);
-		if (EFI_ERROR(status)) {
-			/* skip failed handle and continue enumerating */
-			ERROR(L"Could not open file system for IO handle %d, skipping.\n",
-			      index);
-			continue;
-		}
 		EFI_DEVICE_PATH *devpath = DevicePathFromHandle(handles[index]);
 		if (devpath == NULL) {
 			ERROR(L"Could not get device path for config partition, skipping.\n");
@@ -146,16 +133,14 @@ EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count)
 			target = bootCount++;
 		}
 
-		(*volumes)[target].root = tmp;
+		ZeroMem(&(*volumes)[target], sizeof(VOLUME_DESC));
+		(*volumes)[target].handle = handles[index];
 		(*volumes)[target].devpath = devpath;
 		(*volumes)[target].onbootmedium = onbootmedium;
-		(*volumes)[target].fslabel =
-		    get_volume_label((*volumes)[target].root);
-		(*volumes)[target].fscustomlabel =
-		    get_volume_custom_label((*volumes)[target].root);
 
 		rootCount++;
 	}
+	FreePool(handles);
 
 	for (index = 0; index < rootCount; index++) {
 		INFO(L"Volume %d: ", index);
@@ -163,9 +148,7 @@ EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count)
 			INFO(L"(On boot medium) ");
 		}
 		CHAR16 *devpathstr = DevicePathToStr((*volumes)[index].devpath);
-		INFO(L"%s, LABEL=%s, CLABEL=%s\n",
-		      devpathstr, (*volumes)[index].fslabel,
-		      (*volumes)[index].fscustomlabel);
+		INFO(L"%s\n", devpathstr);
 		FreePool(devpathstr);
 	}
 
@@ -173,6 +156,59 @@ EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count)
 	return EFI_SUCCESS;
 }
 
+EFI_FILE_HANDLE volume_root(VOLUME_DESC *volume)
+{
+	EFI_GUID sfspGuid = SIMPLE_FILE_SYSTEM_PROTOCOL;
+	EFI_FILE_IO_INTERFACE *fs = NULL;
+	EFI_STATUS status;
+
+	if (volume->root || volume->open_failed) {
+		return volume->root;
+	}
+
+	status = BS->HandleProtocol(volume->handle, &sfspGuid, (VOID **)&fs);
+	if (EFI_ERROR(status)) {
+		ERROR(L"File IO handle does not support SIMPLE_FILE_SYSTEM_PROTOCOL, skipping.\n");
+		volume->open_failed = TRUE;
+		return NULL;
+	}
+	status = fs->OpenVolume(fs, &volume->root);
+	if (EFI_ERROR(status)) {
+		ERROR(L"Could not open file system for IO handle, skipping.\n");
+		volume->root = NULL;
+		volume->open_failed = TRUE;
+		return NULL;
+	}
+	return volume->root;
+}
+
+const CHAR16 *volume_label(VOLUME_DESC *volume, LABELMODE mode)
+{
+	EFI_FILE_HANDLE root;
+
+	if (!volume->labels_read) {
+		volume->labels_read = TRUE;
+		root = volume_root(volume);
+		if (root) {
+			volume->fslabel = get_volume_label(root);
+			volume->fscustomlabel = get_volume_custom_label(root);
+		}
+		CHAR16 *devpathstr = DevicePathToStr(volume->devpath);
+		INFO(L"%s, LABEL=%s, CLABEL=%s\n", devpathstr, volume->fslabel,
+		     volume->fscustomlabel);
+		FreePool(devpathstr);
+	}
+
+	switch (mode) {
+	case DOSFSLABEL:
+		return volume->fslabel;
+	case CUSTOMLABEL:
+		return volume->fscustomlabel;
+	default:
+		return NULL;
+	}
+}
+
 EFI_STATUS close_volumes(VOLUME_DESC *volumes, UINTN count)
 {
 	EFI_STATUS result = EFI_SUCCESS;
@@ -185,9 +221,8 @@ EFI_STATUS close_volumes(VOLUME_DESC *volumes, UINTN count)
 	for (i = 0; i < count; i++) {
 		EFI_STATUS status;
 
+		/* volumes that were never needed have not been opened */
 		if (!volumes[i].root) {
-			ERROR(L"Invalid handle for volume %d.\n", i);
-			result = EFI_INVALID_PARAMETER;
 			continue;
 		}
 		status = volumes[i].root->Close(volumes[i].root);
@@ -227,18 +262,7 @@ EFI_DEVICE_PATH *FileDevicePathFromConfig(EFI_HANDLE device,
 
 	if (prefixlen > 0) {
 		for (UINTN v = 0; v < volume_count; v++) {
-			const CHAR16 *src;
-			switch (lm) {
-			case DOSFSLABEL:
-				src = volumes[v].fslabel;
-				break;
-			case CUSTOMLABEL:
-				src = volumes[v].fscustomlabel;
-				break;
-			default:
-				src = NULL;
-				break;
-			}
+			const CHAR16 *src = volume_label(&volumes[v], lm);
 			if (src && (StrnCmp(src, &payloadpath[2], prefixlen) == 0)) {
 				devpath = volumes[v].devpath;
 				break;
@@ -27,6 +27,29 @@ extern const unsigned long wdfuncs_end[];
 #define PCI_GET_VENDOR_ID(id)	(UINT16)(id)
 #define PCI_GET_PRODUCT_ID(id)	(UINT16)((id) >> 16)
 
+typedef struct {
+	UINT16 vendor_id;
+	UINT16 device_id;
+	WATCHDOG_DRIVER *driver;
+} PCI_MATCH;
+
+/* Last successfully probed watchdog, tried first on the next boot */
+typedef struct {
+	CHAR8 driver[WATCHDOG_NAME_LEN];
+	UINT8 is_pci;
+	UINT8 bus;
+	UINT8 device;
+	UINT8 function;
+	UINT16 segment;
+} __attribute__((packed)) WATCHDOG_HINT;
+
+#define WATCHDOG_HINT_VAR L"EBGWatchdogHint"
+
+static EFI_GUID ebg_guid = {0x790addad,
+			    0x18c7,
+			    0x4231,
+			    {0xa0, 0x9a, 0x56, 0x39, 0xab, 0x19, 0x03, 0x14}};
+
 static WATCHDOG_DRIVER *watchdog_drivers;
 static WATCHDOG_DRIVER *last_watchdog_driver;
 
@@ -39,26 +62,174 @@ VOID register_watchdog(WATCHDOG_DRIVER *driver)
 	last_watchdog_driver = driver;
 }
 
-EFI_STATUS probe_watchdogs(UINTN timeout)
+static BOOLEAN read_hint(WATCHDOG_HINT *hint)
 {
-#if GNU_EFI_VERSION < 3000016
-	const unsigned long *entry = wdfuncs_start;
-	for (entry++; entry < wdfuncs_end; entry++) {
-		((void (*)(void))*entry)();
+	UINTN size = sizeof(*hint);
+	EFI_STATUS status;
+
+	status = RT->GetVariable(WATCHDOG_HINT_VAR, &ebg_guid, NULL, &size,
+				 hint);
+	if (EFI_ERROR(status) || size != sizeof(*hint)) {
+		return FALSE;
 	}
-#endif
-	if (watchdog_drivers == NULL) {
-		if (timeout > 0) {
-			ERROR(L"No watchdog drivers registered, but timeout is non-zero.\n");
-			return EFI_UNSUPPORTED;
+	hint->driver[WATCHDOG_NAME_LEN - 1] = '\0';
+	return TRUE;
+}
+
+static VOID store_hint(const WATCHDOG_HINT *hint)
+{
+	EFI_STATUS status;
+
+	/* size 0 deletes the variable */
+	status = RT->SetVariable(WATCHDOG_HINT_VAR, &ebg_guid,
+				 EFI_VARIABLE_NON_VOLATILE |
+					 EFI_VARIABLE_BOOTSERVICE_ACCESS,
+				 hint ? sizeof(*hint) : 0, (VOID *)hint);
+	if (EFI_ERROR(status) && status != EFI_NOT_FOUND) {
+		WARNING(L"Cannot store watchdog hint: %r\n", status);
+	}
+}
+
+static VOID set_hint_driver(WATCHDOG_HINT *hint, const WATCHDOG_DRIVER *driver)
+{
+	UINTN len = strlena(driver->name);
+
+	if (len >= WATCHDOG_NAME_LEN) {
+		len = WATCHDOG_NAME_LEN - 1;
+	}
+	ZeroMem(hint->driver, sizeof(hint->driver));
+	CopyMem(hint->driver, driver->name, len);
+}
+
+static WATCHDOG_DRIVER *find_driver(const CHAR8 *name)
+{
+	WATCHDOG_DRIVER *driver;
+
+	for (driver = watchdog_drivers; driver; driver = driver->next) {
+		if (strncmpa(driver->name, name, WATCHDOG_NAME_LEN - 1) == 0) {
+			return driver;
 		}
-		return EFI_SUCCESS;
 	}
-	if (timeout == 0) {
-		WARNING(L"Watchdog is disabled.\n");
-		return EFI_SUCCESS;
+	return NULL;
+}
+
+/*
+ * Collect the match tables of the given PCI drivers, sorted by vendor and
+ * device ID. Exact device matches sort before wildcards, drivers with the
+ * same match keep their registration order.
+ */
+static PCI_MATCH *build_pci_matches(WATCHDOG_DRIVER *drivers, BOOLEAN single,
+				    UINTN *count)
+{
+	const WATCHDOG_PCI_ID *id;
+	WATCHDOG_DRIVER *driver;
+	PCI_MATCH *matches;
+	UINTN n = 0, pos;
+
+	for (driver = drivers; driver; driver = single ? NULL : driver->next) {
+		for (id = driver->pci_ids; id && id->vendor_id; id++) {
+			n++;
+		}
+	}
+	*count = 0;
+	if (n == 0) {
+		return NULL;
 	}
+	matches = AllocatePool(n * sizeof(PCI_MATCH));
+	if (!matches) {
+		ERROR(L"Cannot allocate watchdog match table.\n");
+		return NULL;
+	}
+
+	for (driver = drivers; driver; driver = single ? NULL : driver->next) {
+		for (id = driver->pci_ids; id && id->vendor_id; id++) {
+			for (pos = *count; pos > 0; pos--) {
+				const PCI_MATCH *prev = &matches[pos - 1];
+
+				if (prev->vendor_id < id->vendor_id ||
+				    (prev->vendor_id == id->vendor_id &&
+				     prev->device_id <= id->device_id)) {
+					break;
+				}
+				matches[pos] = *prev;
+			}
+			matches[pos].vendor_id = id->vendor_id;
+			matches[pos].device_id = id->device_id;
+			matches[pos].driver = driver;
+			(*count)++;
+		}
+	}
+	return matches;
+}
+
+static EFI_STATUS probe_pci_device(const PCI_MATCH *matches, UINTN count,
+				   EFI_PCI_IO *pci_io, UINT16 vendor_id,
+				   UINT16 device_id, UINTN timeout,
+				   WATCHDOG_DRIVER **found)
+{
+	EFI_STATUS status = EFI_UNSUPPORTED;
+	UINTN low = 0, high = count;
+
+	while (low < high) {
+		UINTN mid = low + (high - low) / 2;
 
+		if (matches[mid].vendor_id < vendor_id) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	for (; low < count && matches[low].vendor_id == vendor_id; low++) {
+		if (matches[low].device_id != device_id &&
+		    matches[low].device_id != WATCHDOG_PCI_ANY_ID) {
+			continue;
+		}
+		status = matches[low].driver->probe(pci_io, vendor_id,
+						    device_id, timeout);
+		if (status == EFI_SUCCESS) {
+			*found = matches[low].driver;
+			break;
+		}
+	}
+	return status;
+}
+
+static EFI_STATUS probe_platform(UINTN timeout, const WATCHDOG_DRIVER *skip,
+				 WATCHDOG_HINT *found)
+{
+	EFI_STATUS status = EFI_UNSUPPORTED;
+	WATCHDOG_DRIVER *driver;
+
+	for (driver = watchdog_drivers; driver; driver = driver->next) {
+		if (driver->pci_ids || driver == skip) {
+			continue;
+		}
+		status = driver->probe(NULL, 0, 0, timeout);
+		if (status == EFI_SUCCESS) {
+			ZeroMem(found, sizeof(*found));
+			set_hint_driver(found, driver);
+			break;
+		}
+	}
+	return status;
+}
+
+static BOOLEAN at_hint_location(const WATCHDOG_HINT *hint, UINTN segment,
+				UINTN bus, UINTN device, UINTN function)
+{
+	return segment == hint->segment && bus == hint->bus &&
+	       device == hint->device && function == hint->function;
+}
+
+/*
+ * Probe the PCI devices against the match table. Only the device at the
+ * location of the hint is probed if one is passed, the device at the
+ * location of skip is left out.
+ */
+static EFI_STATUS probe_pci(const PCI_MATCH *matches, UINTN match_count,
+			    UINTN timeout, const WATCHDOG_HINT *hint,
+			    const WATCHDOG_HINT *skip, WATCHDOG_HINT *found)
+{
 	UINTN handle_count = 0;
 	EFI_HANDLE *handle_buffer = NULL;
 	EFI_STATUS status = BS->LocateHandleBuffer(ByProtocol, &PciIoProtocol,
@@ -73,15 +244,31 @@ EFI_STATUS probe_watchdogs(UINTN timeout)
 	}
 
 	EFI_PCI_IO_PROTOCOL *pci_io;
+	WATCHDOG_DRIVER *driver;
+	UINTN segment, bus, device, function;
 	UINT32 value;
+	status = EFI_UNSUPPORTED;
 	for (UINTN index = 0; index < handle_count; index++) {
 		status = BS->OpenProtocol(handle_buffer[index], &PciIoProtocol,
 					  (VOID **)&pci_io, this_image, NULL,
 					  EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
 		if (EFI_ERROR(status)) {
 			ERROR(L"Cannot not open PciIoProtocol: %r\n", status);
-			FreePool(handle_buffer);
-			return status;
+			break;
+		}
+
+		status = pci_io->GetLocation(pci_io, &segment, &bus, &device,
+					     &function);
+		if (EFI_ERROR(status) ||
+		    (hint && !at_hint_location(hint, segment, bus, device,
+					       function)) ||
+		    (skip && at_hint_location(skip, segment, bus, device,
+					      function))) {
+			(VOID) BS->CloseProtocol(handle_buffer[index],
+						 &PciIoProtocol, this_image,
+						 NULL);
+			status = EFI_UNSUPPORTED;
+			continue;
 		}
 
 		status = pci_io->Pci.Read(pci_io, EfiPciIoWidthUint32,
@@ -96,22 +283,21 @@ EFI_STATUS probe_watchdogs(UINTN timeout)
 			continue;
 		}
 
-		WATCHDOG_DRIVER *driver = watchdog_drivers;
-		while (driver) {
-			status = driver->probe(pci_io,
-					       PCI_GET_VENDOR_ID(value),
-					       PCI_GET_PRODUCT_ID(value),
-						timeout);
-			if (status == EFI_SUCCESS) {
-				break;
-			}
-			driver = driver->next;
-		}
+		status = probe_pci_device(matches, match_count, pci_io,
+					  PCI_GET_VENDOR_ID(value),
+					  PCI_GET_PRODUCT_ID(value), timeout,
+					  &driver);
 
 		(VOID) BS->CloseProtocol(handle_buffer[index], &PciIoProtocol,
 					 this_image, NULL);
 
 		if (status == EFI_SUCCESS) {
+			set_hint_driver(found, driver);
+			found->is_pci = TRUE;
+			found->segment = segment;
+			found->bus = bus;
+			found->device = device;
+			found->function = function;
 			break;
 		}
 	}
@@ -119,3 +305,93 @@ EFI_STATUS probe_watchdogs(UINTN timeout)
 
 	return status;
 }
+
+/*
+ * Try the watchdog that was found on the last boot. A platform driver
+ * probed here is returned and a probed PCI device is reported, so that
+ * neither is probed a second time.
+ */
+static EFI_STATUS probe_hint(UINTN timeout, const WATCHDOG_HINT *hint,
+			     WATCHDOG_DRIVER **probed, BOOLEAN *probed_pci)
+{
+	WATCHDOG_DRIVER *driver = find_driver(hint->driver);
+	WATCHDOG_HINT found;
+	PCI_MATCH *matches;
+	EFI_STATUS status;
+	UINTN count;
+
+	if (!driver || (driver->pci_ids != NULL) != (hint->is_pci != 0)) {
+		return EFI_NOT_FOUND;
+	}
+	if (!hint->is_pci) {
+		*probed = driver;
+		return driver->probe(NULL, 0, 0, timeout);
+	}
+
+	matches = build_pci_matches(driver, TRUE, &count);
+	if (!matches) {
+		return EFI_NOT_FOUND;
+	}
+	*probed_pci = TRUE;
+	status = probe_pci(matches, count, timeout, hint, NULL, &found);
+	FreePool(matches);
+	return status;
+}
+
+EFI_STATUS probe_watchdogs(UINTN timeout)
+{
+#if GNU_EFI_VERSION < 3000016
+	const unsigned long *entry = wdfuncs_start;
+	for (entry++; entry < wdfuncs_end; entry++) {
+		((void (*)(void))*entry)();
+	}
+#endif
+	if (watchdog_drivers == NULL) {
+		if (timeout > 0) {
+			ERROR(L"No watchdog drivers registered, but timeout is non-zero.\n");
+			return EFI_UNSUPPORTED;
+		}
+		return EFI_SUCCESS;
+	}
+	if (timeout == 0) {
+		WARNING(L"Watchdog is disabled.\n");
+		return EFI_SUCCESS;
+	}
+
+	WATCHDOG_DRIVER *probed = NULL;
+	BOOLEAN probed_pci = FALSE;
+	WATCHDOG_HINT hint, found;
+	BOOLEAN has_hint = read_hint(&hint);
+	EFI_STATUS status;
+
+	if (has_hint) {
+		status = probe_hint(timeout, &hint, &probed, &probed_pci);
+		if (status == EFI_SUCCESS) {
+			return EFI_SUCCESS;
+		}
+		INFO(L"Watchdog of last boot not found, probing all drivers.\n");
+	}
+
+	status = probe_platform(timeout, probed, &found);
+	if (status != EFI_SUCCESS) {
+		UINTN match_count;
+		PCI_MATCH *matches = build_pci_matches(watchdog_drivers, FALSE,
+						       &match_count);
+		if (matches) {
+			ZeroMem(&found, sizeof(found));
+			status = probe_pci(matches, match_count, timeout, NULL,
+					   probed_pci ? &hint : NULL, &found);
+			FreePool(matches);
+		}
+	}
+
+	if (status == EFI_SUCCESS) {
+		/* spare the variable store a write if nothing changed */
+		if (!has_hint || CompareMem(&found, &hint, sizeof(found)) != 0) {
+			store_hint(&found);
+		}
+	} else if (has_hint) {
+		store_hint(NULL);
+	}
+	return status;
+}